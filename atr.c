@@ -3,12 +3,132 @@
  * Functions that have to be provided
  *
  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <common/atrace.h>
 #include "tracelib.h"
 
+/*
+  Handles wrap the atrace. atrace_general_change() copies the value, so
+  wide channel values are built in a per-handle scratch buffer that
+  grows to the widest channel seen. The handle also remembers the kind
+  of each signal in the last set read with atr_get_signals().
+*/
+#define ATR_KIND_ANALOG 0
+#define ATR_KIND_SMALL  1
+#define ATR_KIND_BIG    2
+
+struct atr_handle {
+  atrace *a;
+  unsigned long *scratch;
+  int scratch_len;
+  int late;			/* an integer time was out of range */
+  void **set;			/* signals of the last set, and */
+  char *kind;			/* their kinds */
+  int set_len, set_max;
+};
+
+#define ATR(handle) (((struct atr_handle *)(handle))->a)
+
+static void *_atr_wrap (atrace *a)
+{
+  struct atr_handle *h;
+
+  if (!a) {
+    return NULL;
+  }
+  h = (struct atr_handle *) malloc (sizeof (struct atr_handle));
+  if (!h) {
+    fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	     sizeof (struct atr_handle));
+    exit (1);
+  }
+  h->a = a;
+  h->scratch = NULL;
+  h->scratch_len = 0;
+  h->late = 0;
+  h->set = NULL;
+  h->kind = NULL;
+  h->set_len = 0;
+  h->set_max = 0;
+  return h;
+}
+
+static unsigned long *_atr_scratch (void *handle, int words)
+{
+  struct atr_handle *h = (struct atr_handle *)handle;
+
+  if (words > h->scratch_len) {
+    h->scratch = (unsigned long *)
+      realloc (h->scratch, sizeof (unsigned long)*words);
+    if (!h->scratch) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       sizeof (unsigned long)*words);
+      exit (1);
+    }
+    h->scratch_len = words;
+  }
+  return h->scratch;
+}
+
+/* encode a channel state that is not a value into a wide value */
+static void _atr_wide_state (unsigned long *w, int words, act_chan_state_t s)
+{
+  if (s == ACT_CHAN_SEND_BLOCKED) {
+    w[0] = ATRACE_CHAN_SEND_BLOCKED;
+  }
+  else if (s == ACT_CHAN_RECV_BLOCKED) {
+    w[0] = ATRACE_CHAN_RECV_BLOCKED;
+  }
+  else {
+    w[0] = ATRACE_CHAN_IDLE;
+  }
+  for (int i=1; i < words; i++) {
+    w[i] = 0;
+  }
+}
+
 void *atr_create (const  char *nm, float stop_time, float ts)
 {
-  return atrace_create (nm, ATRACE_DELTA, stop_time, ts);
+  return _atr_wrap (atrace_create (nm, ATRACE_DELTA, stop_time, ts));
+}
+
+/* integer time: see _atr_time() */
+void *atr_create_alt (const  char *nm, float stop_time, float ts)
+{
+  return atr_create (nm, stop_time, ts);
+}
+
+/*
+  atrace has no entry point that takes a step count: changes are
+  recorded against a float time, which atrace divides by its timestep
+  again. A float carries 24 bits, so the step survives only up to
+  2^23 steps; later changes are refused rather than recorded at the
+  wrong time.
+*/
+#define ATR_ALT_MAX_STEP (1UL << 23)
+
+static int _atr_time (void *handle, int len, unsigned long *tm, float *t)
+{
+  struct atr_handle *h = (struct atr_handle *)handle;
+  int late = (tm[0] > ATR_ALT_MAX_STEP);
+
+  for (int i=1; i < len; i++) {
+    if (tm[i] != 0) {
+      late = 1;
+    }
+  }
+  if (late) {
+    if (!h->late) {
+      fprintf (stderr, "ERROR: atr: integer time past %lu steps cannot be "
+	       "recorded exactly; dropping changes\n", ATR_ALT_MAX_STEP);
+      h->late = 1;
+    }
+    return 0;
+  }
+  *t = (double)tm[0] * h->a->vdt;
+  return 1;
 }
 
 int atr_signal_start (void *handle)
@@ -19,7 +139,7 @@ int atr_signal_start (void *handle)
 void *atr_add_analog_signal (void *handle, const char *s)
 {
   name_t *nm;
-  nm = atrace_create_node ((atrace *)handle, s);
+  nm = atrace_create_node (ATR (handle), s);
   atrace_mk_analog (nm);
   return nm;
 }
@@ -27,7 +147,7 @@ void *atr_add_analog_signal (void *handle, const char *s)
 void *atr_add_digital_signal (void *handle, const char *s)
 {
   name_t *nm;
-  nm = atrace_create_node ((atrace *)handle, s);
+  nm = atrace_create_node (ATR (handle), s);
   atrace_mk_digital (nm);
   return nm;
 }
@@ -35,7 +155,7 @@ void *atr_add_digital_signal (void *handle, const char *s)
 void *atr_add_int_signal (void *handle, const char *s, int width)
 {
   name_t *nm;
-  nm = atrace_create_node ((atrace *)handle, s);
+  nm = atrace_create_node (ATR (handle), s);
   atrace_mk_digital (nm);
   atrace_mk_width (nm, width);
   return nm;
@@ -44,7 +164,7 @@ void *atr_add_int_signal (void *handle, const char *s, int width)
 void *atr_add_chan_signal (void *handle, const char *s, int width)
 {
   name_t *nm;
-  nm = atrace_create_node ((atrace *)handle, s);
+  nm = atrace_create_node (ATR (handle), s);
   atrace_mk_channel (nm);
   atrace_mk_width (nm, width);
   return nm;
@@ -68,7 +188,7 @@ int atr_init_end (void *handle)
 
 int atr_change_analog (void *handle, void *node, float t, float v)
 {
-  atrace_signal_change ((atrace *)handle, (name_t *)node, t, v);
+  atrace_signal_change (ATR (handle), (name_t *)node, t, v);
   return 1;
 }
 
@@ -77,7 +197,7 @@ int atr_change_digital (void *handle, void *node, float t, unsigned long v)
   atrace_val_t av;
   name_t *nm = (name_t *)node;
   av.val = v;
-  atrace_general_change ((atrace *)handle, nm, t, &av);
+  atrace_general_change (ATR (handle), nm, t, &av);
   return 1;
 }
 
@@ -86,7 +206,7 @@ int atr_change_wide_digital (void *handle, void *node, float t, int len, unsigne
   atrace_val_t av;
   name_t *nm = (name_t *)node;
   av.valp = v;
-  atrace_general_change ((atrace *)handle, nm, t, &av);
+  atrace_general_change (ATR (handle), nm, t, &av);
   return 1;
 }
 
@@ -96,24 +216,19 @@ int atr_change_chan (void *handle, void *node, float t,
   atrace_val_t av;
   name_t *nm = (name_t *)node;
 
-  atrace_alloc_val_entry (nm, &av);
   if (ATRACE_WIDE_NODE(nm)) {
-    for (int i=0; i < ATRACE_WIDE_NUM(nm); i++) {
-      av.valp[i] = 0;
-    }
-    if (s == ACT_CHAN_SEND_BLOCKED) {
-      av.valp[0] = ATRACE_CHAN_SEND_BLOCKED;
-    }
-    else if (s == ACT_CHAN_RECV_BLOCKED) {
-      av.valp[0] = ATRACE_CHAN_RECV_BLOCKED;
-    }
-    else if (s == ACT_CHAN_IDLE) {
-      av.valp[0] = ATRACE_CHAN_IDLE;
+    int words = ATRACE_WIDE_NUM(nm);
+    av.valp = _atr_scratch (handle, words);
+    if (s != ACT_CHAN_VALUE) {
+      _atr_wide_state (av.valp, words, s);
     }
     else {
       av.valp[0] = v + ATRACE_CHAN_VAL_OFFSET;
-      if (av.valp[0] < v) {
-	av.valp[1]++;
+      for (int i=1; i < words; i++) {
+	av.valp[i] = 0;
+      }
+      if (av.valp[0] < v && words > 1) {
+	av.valp[1] = 1;
       }
     }
   }
@@ -131,8 +246,7 @@ int atr_change_chan (void *handle, void *node, float t,
       av.val = ATRACE_CHAN_IDLE;
     }
   } 
-  atrace_general_change ((atrace *)handle, nm, t, &av);
-  atrace_free_val_entry (nm, &av);
+  atrace_general_change (ATR (handle), nm, t, &av);
   return 1;
 }
 
@@ -141,68 +255,117 @@ int atr_change_wide_chan (void *handle, void *node, float t,
 {
   atrace_val_t av;
   name_t *nm = (name_t *)node;
-  
-  atrace_alloc_val_entry (nm, &av);
-  for (int i=0; i < ATRACE_WIDE_NUM(nm); i++) {
-    av.valp[i] = 0;
-  }
+  int words = ATRACE_WIDE_NUM(nm);
 
-  if (s == ACT_CHAN_SEND_BLOCKED) {
-    av.valp[0] = ATRACE_CHAN_SEND_BLOCKED;
-  }
-  else if (s == ACT_CHAN_RECV_BLOCKED) {
-    av.valp[0] = ATRACE_CHAN_RECV_BLOCKED;
-  }
-  else if (s == ACT_CHAN_IDLE) {
-    av.valp[0] = ATRACE_CHAN_IDLE;
+  av.valp = _atr_scratch (handle, words);
+  if (s != ACT_CHAN_VALUE) {
+    _atr_wide_state (av.valp, words, s);
   }
   else {
-    int carry = ATRACE_CHAN_VAL_OFFSET;
-    if (len > ATRACE_WIDE_NUM(nm)) {
-      len = ATRACE_WIDE_NUM(nm);
+    unsigned long carry = ATRACE_CHAN_VAL_OFFSET;
+    int i;
+    if (len > words) {
+      len = words;
     }
-    for (int i=0; i < len; i++) {
-      unsigned long oval = v[i];
+    for (i=0; i < len; i++) {
       av.valp[i] = v[i] + carry;
-      if (av.valp[i] < oval) {
-	carry = 1;
-      }
-      else {
-	carry = 0;
-      }
+      carry = (av.valp[i] < carry) ? 1 : 0;
     }
-    if (carry) {
-      av.valp[len]++;
+    /* the offset carries into the words the caller did not supply;
+       a carry out of the top word is dropped */
+    for (; i < words; i++) {
+      av.valp[i] = carry;
+      carry = 0;
     }
   }
-  atrace_general_change ((atrace *)handle, nm, t, &av);
-  atrace_free_val_entry (nm, &av);
+  atrace_general_change (ATR (handle), nm, t, &av);
   return 1;
 }
 
+int atr_change_analog_alt (void *handle, void *node, int len,
+			   unsigned long *tm, float v)
+{
+  float t;
+  if (!_atr_time (handle, len, tm, &t)) {
+    return 0;
+  }
+  return atr_change_analog (handle, node, t, v);
+}
+
+int atr_change_digital_alt (void *handle, void *node, int len,
+			    unsigned long *tm, unsigned long v)
+{
+  float t;
+  if (!_atr_time (handle, len, tm, &t)) {
+    return 0;
+  }
+  return atr_change_digital (handle, node, t, v);
+}
+
+int atr_change_wide_digital_alt (void *handle, void *node, int len,
+				 unsigned long *tm, int lenv, unsigned long *v)
+{
+  float t;
+  if (!_atr_time (handle, len, tm, &t)) {
+    return 0;
+  }
+  return atr_change_wide_digital (handle, node, t, lenv, v);
+}
+
+int atr_change_chan_alt (void *handle, void *node, int len,
+			 unsigned long *tm, act_chan_state_t s, unsigned long v)
+{
+  float t;
+  if (!_atr_time (handle, len, tm, &t)) {
+    return 0;
+  }
+  return atr_change_chan (handle, node, t, s, v);
+}
+
+int atr_change_wide_chan_alt (void *handle, void *node, int len,
+			      unsigned long *tm, act_chan_state_t s,
+			      int lenv, unsigned long *v)
+{
+  float t;
+  if (!_atr_time (handle, len, tm, &t)) {
+    return 0;
+  }
+  return atr_change_wide_chan (handle, node, t, s, lenv, v);
+}
+
 int atr_close (void *handle)
 {
-  atrace_close ((atrace *)handle);
+  struct atr_handle *h = (struct atr_handle *)handle;
+
+  atrace_close (h->a);
+  if (h->scratch) {
+    free (h->scratch);
+  }
+  if (h->set) {
+    free (h->set);
+    free (h->kind);
+  }
+  free (h);
   return 1;
 }
 
 
 void *atr_open (const char *name)
 {
-  return atrace_open (name);
+  return _atr_wrap (atrace_open (name));
 }
 
 void atr_header (void *handle, float *stop_time, float *dt)
 {
   int nnodes, nsteps, fmt, ts;
-  atrace_header ((atrace *)handle, &ts, &nnodes, &nsteps, &fmt);
-  *stop_time = ((atrace *)handle)->stop_time;
-  *dt = ((atrace *)handle)->vdt;
+  atrace_header (ATR (handle), &ts, &nnodes, &nsteps, &fmt);
+  *stop_time = ATR (handle)->stop_time;
+  *dt = ATR (handle)->vdt;
 }
 
 void *atr_signal_lookup (void *handle, const char *name)
 {
-  return atrace_lookup ((atrace *)handle, name);
+  return atrace_lookup (ATR (handle), name);
 }
 
 act_signal_type_t atr_signal_type (void *handle, void *sig)
@@ -228,22 +391,31 @@ act_signal_type_t atr_signal_type (void *handle, void *sig)
   }
 }  
 
+int atr_signal_width (void *handle, void *sig)
+{
+  name_t *n = (name_t *)sig;
+  if (atrace_is_analog (n)) {
+    return 0;
+  }
+  return atrace_bitwidth (n);
+}
+
 void atr_advance_time (void *handle, int steps)
 {
-  atrace *a = (atrace *)handle;
+  atrace *a = ATR (handle);
   atrace_advance_time (a, steps);
 }
 
 
 void atr_advance_time_by (void *handle, float dt)
 {
-  atrace *a = (atrace *)handle;
+  atrace *a = ATR (handle);
   atrace_advance_time (a, (int)((dt+0.9*a->vdt)/(a->vdt)));
 }
 
 int atr_has_more_data (void *handle)
 {
-  return atrace_more_data ((atrace *)handle);
+  return atrace_more_data (ATR (handle));
 }
 
 act_signal_val_t atr_get_signal (void *handle, void *sig)
@@ -265,3 +437,55 @@ act_signal_val_t atr_get_signal (void *handle, void *sig)
   return ret;
 }
   
+
+/* classify the signals of a set that differs from the last one */
+static void _atr_set (struct atr_handle *h, void **sigs, int n)
+{
+  if (n == h->set_len &&
+      (n == 0 || memcmp (sigs, h->set, sizeof (void *)*n) == 0)) {
+    return;
+  }
+  if (n > h->set_max) {
+    h->set_max = n;
+    h->set = (void **) realloc (h->set, sizeof (void *)*n);
+    h->kind = (char *) realloc (h->kind, n);
+    if (!h->set || !h->kind) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       (sizeof (void *) + 1)*n);
+      exit (1);
+    }
+  }
+  for (int i=0; i < n; i++) {
+    name_t *nm = (name_t *)sigs[i];
+    h->set[i] = sigs[i];
+    if (atrace_is_analog (nm)) {
+      h->kind[i] = ATR_KIND_ANALOG;
+    }
+    else if (atrace_bitwidth (nm) <= ATRACE_SHORT_WIDTH) {
+      h->kind[i] = ATR_KIND_SMALL;
+    }
+    else {
+      h->kind[i] = ATR_KIND_BIG;
+    }
+  }
+  h->set_len = n;
+}
+
+void atr_get_signals (void *handle, void **sigs, int n, act_signal_val_t *out)
+{
+  struct atr_handle *h = (struct atr_handle *)handle;
+
+  _atr_set (h, sigs, n);
+  for (int i=0; i < n; i++) {
+    atrace_val_t v = ATRACE_GET_VAL ((name_t *)sigs[i]);
+    if (h->kind[i] == ATR_KIND_ANALOG) {
+      out[i].v = ATRACE_FLOATVAL (&v);
+    }
+    else if (h->kind[i] == ATR_KIND_SMALL) {
+      out[i].val = ATRACE_SMALLVAL (&v);
+    }
+    else {
+      out[i].valp = ATRACE_BIGVAL (&v);
+    }
+  }
+}
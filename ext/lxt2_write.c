@@ -56,6 +56,73 @@ for(;;s++)
 }
 
 
+
+/*
+ * packed values: bit i of the value lives in word i/64 of pval, with the
+ * x/z plane following the value plane.  x is (xz=1,val=0), z is (xz=1,val=1).
+ */
+#define LXT2_WR_PWORDS(len) (((len)+63)/64)
+
+static unsigned long lxt2_wr_topmask(int len)
+{
+return((len&63) ? ((1UL<<(len&63))-1) : ~0UL);
+}
+
+
+static void lxt2_wr_unpack_value(struct lxt2_wr_symbol *s)
+{
+int nw = LXT2_WR_PWORDS(s->len);
+int i;
+
+if(!s->value_stale) return;
+
+for(i=0;i<s->len;i++)
+	{
+	int b = s->len-1-i;
+	unsigned long v = (s->pval[b/64] >> (b&63)) & 1;
+	unsigned long x = (s->pval[nw+b/64] >> (b&63)) & 1;
+
+	s->value[i] = x ? (v ? 'z' : 'x') : (char)('0' | v);
+	}
+s->value_stale = 0;
+}
+
+
+static int lxt2_wr_pack_value(struct lxt2_wr_symbol *s)
+{
+int nw = LXT2_WR_PWORDS(s->len);
+int i;
+
+if(s->packed) return(1);
+
+if(!s->pval)
+	{
+	s->pval = (unsigned long *)calloc(2*nw, sizeof(unsigned long));
+	}
+	else
+	{
+	memset(s->pval, 0, 2*nw*sizeof(unsigned long));
+	}
+
+for(i=0;i<s->len;i++)
+	{
+	int b = s->len-1-i;
+	unsigned long bit = 1UL<<(b&63);
+
+	switch(s->value[i])
+		{
+		case '0':	break;
+		case '1':	s->pval[b/64] |= bit; break;
+		case 'x':	s->pval[nw+b/64] |= bit; break;
+		case 'z':	s->pval[b/64] |= bit; s->pval[nw+b/64] |= bit; break;
+		default:	return(0);	/* e.g., dumpon marker */
+		}
+	}
+
+s->packed = 1;
+return(1);
+}
+
 /*
  * in-place sort to keep chained facs from migrating...
  */
@@ -105,178 +172,218 @@ wave_mergesort(a, b, 0, num-1);
 free(b);
 }
 
-/************************ splay ************************/
+/************************ dictionaries ************************/
+
+/*
+ * values and granule bitmaps are numbered in order of first appearance
+ * within a block; both are looked up through open-addressed hash tables
+ * that are emptied when the block is written out
+ */
+#define LXT2_WR_ARENA_CHUNK (64*1024)
 
-static lxt2_wr_ds_Tree * lxt2_wr_ds_splay (granmsk_t i, lxt2_wr_ds_Tree * t) {
-/* Simple top down splay, not requiring i to be in the tree t.  */
-/* What it does is described above.                             */
-    lxt2_wr_ds_Tree N, *l, *r, *y;
-    if (t == NULL) return t;
-    N.left = N.right = NULL;
-    l = r = &N;
-
-    for (;;) {
-	if (i < t->item) {
-	    if (t->left == NULL) break;
-	    if (i < t->left->item) {
-		y = t->left;                           /* rotate right */
-		t->left = y->right;
-		y->right = t;
-		t = y;
-		if (t->left == NULL) break;
-	    }
-	    r->left = t;                               /* link right */
-	    r = t;
-	    t = t->left;
-	} else if (i > t->item) {
-	    if (t->right == NULL) break;
-	    if (i > t->right->item) {
-		y = t->right;                          /* rotate left */
-		t->right = y->left;
-		y->left = t;
-		t = y;
-		if (t->right == NULL) break;
-	    }
-	    l->right = t;                              /* link left */
-	    l = t;
-	    t = t->right;
-	} else {
-	    break;
-	}
-    }
-    l->right = t->left;                                /* assemble */
-    r->left = t->right;
-    t->left = N.right;
-    t->right = N.left;
-    return t;
-}
-
-
-static lxt2_wr_ds_Tree * lxt2_wr_ds_insert(granmsk_t i, lxt2_wr_ds_Tree * t, int val) {
-/* Insert i into the tree t, unless it's already there.    */
-/* Return a pointer to the resulting tree.                 */
-    lxt2_wr_ds_Tree * n;
-
-    n = (lxt2_wr_ds_Tree *) calloc (1, sizeof (lxt2_wr_ds_Tree));
-    if (n == NULL) {
-	fprintf(stderr, "ds_insert: ran out of memory, exiting.\n");
+static void *lxt2_wr_xrealloc(void *p, size_t siz)
+{
+p = realloc(p, siz);
+if(!p)
+	{
+	fprintf(stderr, "lxt2_wr: ran out of memory, exiting.\n");
 	exit(255);
-    }
-    n->item = i;
-    n->val = val;
-    if (t == NULL) {
-	n->left = n->right = NULL;
-	return n;
-    }
-    t = lxt2_wr_ds_splay(i,t);
-    if (i < t->item) {
-	n->left = t->left;
-	n->right = t;
-	t->left = NULL;
-	return n;
-    } else if (i > t->item) {
-	n->right = t->right;
-	n->left = t;
-	t->right = NULL;
-	return n;
-    } else { /* We get here if it's already in the tree */
-             /* Don't add it again                      */
-	free(n);
-	return t;
-    }
+	}
+return(p);
 }
 
-/************************ splay ************************/
 
-static int lxt2_wr_dslxt_success;
-
-static lxt2_wr_dslxt_Tree * lxt2_wr_dslxt_splay (char *i, lxt2_wr_dslxt_Tree * t) {
-/* Simple top down splay, not requiring i to be in the tree t.  */
-/* What it does is described above.                             */
-    lxt2_wr_dslxt_Tree N, *l, *r, *y;
-    int dir;
-
-    lxt2_wr_dslxt_success = 0;
-
-    if (t == NULL) return t;
-    N.left = N.right = NULL;
-    l = r = &N;
-
-    for (;;) {
-	dir = strcmp(i, t->item);
-	if (dir < 0) {
-	    if (t->left == NULL) break;
-	    if (strcmp(i, t->left->item)<0) {
-		y = t->left;                           /* rotate right */
-		t->left = y->right;
-		y->right = t;
-		t = y;
-		if (t->left == NULL) break;
-	    }
-	    r->left = t;                               /* link right */
-	    r = t;
-	    t = t->left;
-	} else if (dir > 0) {
-	    if (t->right == NULL) break;
-	    if (strcmp(i, t->right->item)>0) {
-		y = t->right;                          /* rotate left */
-		t->right = y->left;
-		y->left = t;
-		t = y;
-		if (t->right == NULL) break;
-	    }
-	    l->right = t;                              /* link left */
-	    l = t;
-	    t = t->right;
-	} else {
-	    lxt2_wr_dslxt_success=1;
-	    break;
-	}
-    }
-    l->right = t->left;                                /* assemble */
-    r->left = t->right;
-    t->left = N.right;
-    t->right = N.left;
-    return t;
-}
-
-
-static lxt2_wr_dslxt_Tree * lxt2_wr_dslxt_insert(char *i, lxt2_wr_dslxt_Tree * t, unsigned int val) {
-/* Insert i into the tree t, unless it's already there.    */
-/* Return a pointer to the resulting tree.                 */
-    lxt2_wr_dslxt_Tree * n;
-    int dir;
-
-    n = (lxt2_wr_dslxt_Tree *) calloc (1, sizeof (lxt2_wr_dslxt_Tree));
-    if (n == NULL) {
-	fprintf(stderr, "dslxt_insert: ran out of memory, exiting.\n");
+static char *lxt2_wr_arena_alloc(struct lxt2_wr_dict *d, unsigned int len)
+{
+struct lxt2_wr_arena *a = d->arena_curr;
+char *rc;
+
+while((!a)||(a->used + len > a->size))
+	{
+	if((a)&&(a->next))
+		{
+		a = a->next;
+		a->used = 0;
+		continue;
+		}
+
+	{
+	struct lxt2_wr_arena *n;
+	size_t siz = (len > LXT2_WR_ARENA_CHUNK) ? len : LXT2_WR_ARENA_CHUNK;
+
+	n = (struct lxt2_wr_arena *)lxt2_wr_xrealloc(NULL, sizeof(struct lxt2_wr_arena) + siz);
+	n->next = NULL;
+	n->size = siz;
+	n->used = 0;
+	if(a) a->next = n; else d->arena = n;
+	a = n;
+	}
+	}
+
+d->arena_curr = a;
+rc = (char *)(a+1) + a->used;
+a->used += len;
+return(rc);
+}
+
+
+static unsigned int lxt2_wr_dict_hash(const char *s, unsigned int len)
+{
+unsigned int h = 2166136261U;
+unsigned int i;
+
+for(i=0;i<len;i++)
+	{
+	h ^= (unsigned char)s[i];
+	h *= 16777619U;
+	}
+return(h);
+}
+
+
+static void lxt2_wr_dict_grow(struct lxt2_wr_dict *d)
+{
+unsigned int i, hmask;
+
+d->table_size = d->table_size ? 2*d->table_size : 1024;
+hmask = d->table_size - 1;
+free(d->table);
+d->table = (unsigned int *)calloc(d->table_size, sizeof(unsigned int));
+if(!d->table)
+	{
+	fprintf(stderr, "lxt2_wr: ran out of memory, exiting.\n");
 	exit(255);
-    }
-    n->item = i;
-    n->val  = val;
-    if (t == NULL) {
-	n->left = n->right = NULL;
-	return n;
-    }
-    t = lxt2_wr_dslxt_splay(i,t);
-    dir = strcmp(i,t->item);
-    if (dir<0) {
-	n->left = t->left;
-	n->right = t;
-	t->left = NULL;
-	return n;
-    } else if (dir>0) {
-	n->right = t->right;
-	n->left = t;
-	t->right = NULL;
-	return n;
-    } else { /* We get here if it's already in the tree */
-             /* Don't add it again                      */
-	free(n);
-	return t;
-    }
+	}
+
+for(i=0;i<d->num_entries;i++)
+	{
+	unsigned int h = d->entries[i].hv & hmask;
+	while(d->table[h]) h = (h+1) & hmask;
+	d->table[h] = i+1;
+	}
+}
+
+
+/*
+ * number of the value string (of length len), adding it if it is new
+ */
+static unsigned int lxt2_wr_dict_find(struct lxt2_wr_dict *d, const char *s, unsigned int len)
+{
+unsigned int hv = lxt2_wr_dict_hash(s, len);
+unsigned int hmask, h, e;
+struct lxt2_wr_dict_entry *ent;
+
+if(2*(d->num_entries+1) > d->table_size) lxt2_wr_dict_grow(d);
+hmask = d->table_size - 1;
+
+for(h = hv & hmask; (e = d->table[h]); h = (h+1) & hmask)
+	{
+	ent = &d->entries[e-1];
+	if((ent->hv == hv)&&(ent->len == len)&&(!memcmp(ent->item, s, len)))
+		{
+		return(e-1);
+		}
+	}
+
+if(d->num_entries == d->max_entries)
+	{
+	d->max_entries = d->max_entries ? 2*d->max_entries : 1024;
+	d->entries = (struct lxt2_wr_dict_entry *)lxt2_wr_xrealloc(d->entries, d->max_entries * sizeof(struct lxt2_wr_dict_entry));
+	}
+
+ent = &d->entries[d->num_entries];
+ent->item = lxt2_wr_arena_alloc(d, len+1);
+memcpy(ent->item, s, len);
+ent->item[len] = 0;
+ent->len = len;
+ent->hv = hv;
+d->string_mem_required += len+1;
+d->table[h] = ++d->num_entries;
+
+return(d->num_entries-1);
+}
+
+
+static void lxt2_wr_dict_reset(struct lxt2_wr_dict *d)
+{
+if(d->num_entries)
+	{
+	memset(d->table, 0, d->table_size * sizeof(unsigned int));
+	}
+d->num_entries = 0;
+d->string_mem_required = 0;
+d->arena_curr = d->arena;
+if(d->arena) d->arena->used = 0;
+}
+
+
+static void lxt2_wr_dict_free(struct lxt2_wr_dict *d)
+{
+struct lxt2_wr_arena *a, *a2;
+
+for(a=d->arena;a;a=a2)
+	{
+	a2 = a->next;
+	free(a);
+	}
+free(d->table);
+free(d->entries);
+memset(d, 0, sizeof(struct lxt2_wr_dict));
+}
+
+
+/*
+ * value change index of a value string in the current block
+ */
+static int lxt2_wr_dict_index(struct lxt2_wr_trace *lt, char *vpnt)
+{
+return(lxt2_wr_dict_find(lt->dict, vpnt, strlen(vpnt)) + LXT2_WR_DICT_START);
+}
+
+
+static unsigned int lxt2_wr_mapdict_find(struct lxt2_wr_mapdict *d, granmsk_t item)
+{
+unsigned int hmask, h, e;
+
+if(2*(d->num_entries+1) > d->table_size)
+	{
+	unsigned int i;
+
+	d->table_size = d->table_size ? 2*d->table_size : 1024;
+	hmask = d->table_size - 1;
+	free(d->table);
+	d->table = (unsigned int *)calloc(d->table_size, sizeof(unsigned int));
+	if(!d->table)
+		{
+		fprintf(stderr, "lxt2_wr: ran out of memory, exiting.\n");
+		exit(255);
+		}
+	for(i=0;i<d->num_entries;i++)
+		{
+		h = (unsigned int)((d->items[i] * LXT2_WR_ULLDESC(0x9e3779b97f4a7c15)) >> 32) & hmask;
+		while(d->table[h]) h = (h+1) & hmask;
+		d->table[h] = i+1;
+		}
+	}
+hmask = d->table_size - 1;
+
+for(h = (unsigned int)((item * LXT2_WR_ULLDESC(0x9e3779b97f4a7c15)) >> 32) & hmask; (e = d->table[h]); h = (h+1) & hmask)
+	{
+	if(d->items[e-1] == item) return(e-1);
+	}
+
+if(d->num_entries == d->max_entries)
+	{
+	d->max_entries = d->max_entries ? 2*d->max_entries : 1024;
+	d->items = (granmsk_t *)lxt2_wr_xrealloc(d->items, d->max_entries * sizeof(granmsk_t));
+	}
+d->items[d->num_entries] = item;
+d->table[h] = ++d->num_entries;
+
+return(d->num_entries-1);
 }
 
+
 /************************ splay ************************/
 
 /*
@@ -342,14 +449,32 @@ return(rc);
  * fixed up on gzclose so the tables don't
  * get out of sync!)
  */
+static void lxt2_wr_zsect_append(struct lxt2_wr_zsect *zs, const unsigned char *p, size_t len)
+{
+if(zs->raw_len + len > zs->raw_alloc)
+	{
+	zs->raw_alloc = 2*(zs->raw_len + len);
+	zs->raw = (unsigned char *)lxt2_wr_xrealloc(zs->raw, zs->raw_alloc);
+	}
+memcpy(zs->raw + zs->raw_len, p, len);
+zs->raw_len += len;
+}
+
 static int gzwrite_buffered(struct lxt2_wr_trace *lt)
 {
 int rc = 1;
 
 if(lt->gzbufpnt > LXT2_WR_GZWRITE_BUFFER)
 	{
-	rc = gzwrite(lt->zhandle, lt->gzdest, lt->gzbufpnt);
-	rc = rc ? 1 : 0;
+	if(lt->zcapture)
+		{
+		lxt2_wr_zsect_append(lt->zcapture, lt->gzdest, lt->gzbufpnt);
+		}
+		else
+		{
+		rc = gzwrite(lt->zhandle, lt->gzdest, lt->gzbufpnt);
+		rc = rc ? 1 : 0;
+		}
 	lt->gzbufpnt = 0;
 	}
 
@@ -358,11 +483,29 @@ return(rc);
 
 static void gzflush_buffered(struct lxt2_wr_trace *lt, int doclose)
 {
+struct lxt2_wr_zsect *zs = lt->zcapture;
+
 if(lt->gzbufpnt)
 	{
-	gzwrite(lt->zhandle, lt->gzdest, lt->gzbufpnt);
+	if(zs)
+		{
+		lxt2_wr_zsect_append(zs, lt->gzdest, lt->gzbufpnt);
+		if((!doclose)&&(zs->raw_len))
+			{
+			if(zs->nsyncs == zs->syncs_alloc)
+				{
+				zs->syncs_alloc = zs->syncs_alloc ? 2*zs->syncs_alloc : 8;
+				zs->syncs = (size_t *)lxt2_wr_xrealloc(zs->syncs, zs->syncs_alloc * sizeof(size_t));
+				}
+			zs->syncs[zs->nsyncs++] = zs->raw_len;
+			}
+		}
+		else
+		{
+		gzwrite(lt->zhandle, lt->gzdest, lt->gzbufpnt);
+		}
 	lt->gzbufpnt = 0;
-	if(!doclose)
+	if((!doclose)&&(!zs))
 		{
 		gzflush(lt->zhandle, Z_SYNC_FLUSH);
 		}
@@ -370,8 +513,180 @@ if(lt->gzbufpnt)
 
 if(doclose)
 	{
-	gzclose(lt->zhandle);
+	if(zs)
+		{
+		lt->zcapture = NULL;
+		}
+		else
+		{
+		gzclose(lt->zhandle);
+		}
+	}
+}
+
+
+/*
+ * compress a captured section the way gzdopen()/gzwrite() would have
+ */
+static void lxt2_wr_zsect_compress(struct lxt2_wr_zsect *zs, int level)
+{
+z_stream strm;
+size_t pos = 0;
+unsigned int i;
+
+memset(&strm, 0, sizeof(strm));
+if(deflateInit2(&strm, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+	fprintf(stderr, "lxt2_wr: could not initialize zlib, exiting.\n");
+	exit(255);
+	}
+
+i = deflateBound(&strm, zs->raw_len) + 6*(zs->nsyncs+1);
+if(i > zs->z_alloc)
+	{
+	zs->z_alloc = i;
+	zs->z = (unsigned char *)lxt2_wr_xrealloc(zs->z, zs->z_alloc);
+	}
+strm.next_out = zs->z;
+strm.avail_out = zs->z_alloc;
+
+for(i=0;i<zs->nsyncs;i++)
+	{
+	strm.next_in = zs->raw + pos;
+	strm.avail_in = zs->syncs[i] - pos;
+	deflate(&strm, Z_SYNC_FLUSH);
+	pos = zs->syncs[i];
+	}
+strm.next_in = zs->raw + pos;
+strm.avail_in = zs->raw_len - pos;
+deflate(&strm, Z_FINISH);
+
+zs->z_len = strm.total_out;
+deflateEnd(&strm);
+}
+
+
+static void *lxt2_wr_zpool_thread(void *arg)
+{
+struct lxt2_wr_trace *lt = (struct lxt2_wr_trace *)arg;
+unsigned int i;
+
+pthread_mutex_lock(&lt->zlock);
+for(;;)
+	{
+	while((lt->znext >= lt->zjobs)&&(!lt->zstop))
+		{
+		pthread_cond_wait(&lt->zcv, &lt->zlock);
+		}
+	if(lt->zstop) break;
+
+	i = lt->znext++;
+	pthread_mutex_unlock(&lt->zlock);
+
+	lxt2_wr_zsect_compress(&lt->zsect[i], lt->zlevel);
+
+	pthread_mutex_lock(&lt->zlock);
+	if(++lt->zdone == lt->zjobs)
+		{
+		pthread_cond_signal(&lt->zdone_cv);
+		}
+	}
+pthread_mutex_unlock(&lt->zlock);
+
+return(NULL);
+}
+
+
+/*
+ * compress sections [0, n) with the pool, the calling thread included
+ */
+static void lxt2_wr_zsect_run(struct lxt2_wr_trace *lt, unsigned int n, int level)
+{
+unsigned int i;
+
+if((!lt->zpool)&&(lt->zthreads > 1)&&(n > 1))
+	{
+	lt->zpool = (pthread_t *)calloc(lt->zthreads - 1, sizeof(pthread_t));
+	pthread_mutex_init(&lt->zlock, NULL);
+	pthread_cond_init(&lt->zcv, NULL);
+	pthread_cond_init(&lt->zdone_cv, NULL);
+	for(i=0;i<lt->zthreads-1;i++)
+		{
+		if(pthread_create(&lt->zpool[i], NULL, lxt2_wr_zpool_thread, lt)) break;
+		}
+	lt->zpool_size = i;
+	}
+
+if(!lt->zpool_size)
+	{
+	for(i=0;i<n;i++)
+		{
+		lxt2_wr_zsect_compress(&lt->zsect[i], level);
+		}
+	return;
+	}
+
+pthread_mutex_lock(&lt->zlock);
+lt->zlevel = level;
+lt->zjobs = n;
+lt->znext = 0;
+lt->zdone = 0;
+pthread_cond_broadcast(&lt->zcv);
+while(lt->znext < lt->zjobs)
+	{
+	i = lt->znext++;
+	pthread_mutex_unlock(&lt->zlock);
+
+	lxt2_wr_zsect_compress(&lt->zsect[i], level);
+
+	pthread_mutex_lock(&lt->zlock);
+	lt->zdone++;
+	}
+while(lt->zdone < lt->zjobs)
+	{
+	pthread_cond_wait(&lt->zdone_cv, &lt->zlock);
 	}
+lt->zjobs = 0;
+lt->znext = 0;
+pthread_mutex_unlock(&lt->zlock);
+}
+
+
+static void lxt2_wr_zpool_stop(struct lxt2_wr_trace *lt)
+{
+unsigned int i;
+
+if(lt->zpool)
+	{
+	if(lt->zpool_size)
+		{
+		pthread_mutex_lock(&lt->zlock);
+		lt->zstop = 1;
+		pthread_cond_broadcast(&lt->zcv);
+		pthread_mutex_unlock(&lt->zlock);
+
+		for(i=0;i<lt->zpool_size;i++)
+			{
+			pthread_join(lt->zpool[i], NULL);
+			}
+		}
+	pthread_mutex_destroy(&lt->zlock);
+	pthread_cond_destroy(&lt->zcv);
+	pthread_cond_destroy(&lt->zdone_cv);
+	free(lt->zpool);
+	lt->zpool = NULL;
+	lt->zpool_size = 0;
+	}
+
+for(i=0;i<lt->zsect_alloc;i++)
+	{
+	free(lt->zsect[i].raw);
+	free(lt->zsect[i].syncs);
+	free(lt->zsect[i].z);
+	}
+free(lt->zsect);
+lt->zsect = NULL;
+lt->zsect_alloc = 0;
 }
 
 
@@ -458,58 +773,99 @@ return(rc);
 /*
  * hash/symtable manipulation
  */
-static int lxt2_wr_hash(const char *s)
+static unsigned int lxt2_wr_hash(const char *s, size_t len)
 {
-const char *p;
-char ch;
-unsigned int h=0, h2=0, pos=0, g;
-for(p=s;*p;p++)
-        {
-	ch=*p;
-	h2<<=3;
-	h2-=((unsigned int)ch+(pos++));		/* this handles stranded vectors quite well.. */
+uint64_t h = len * LXT2_WR_ULLDESC(0x9e3779b97f4a7c15);
+uint64_t k;
 
-        h=(h<<4)+ch;
-        if((g=h&0xf0000000))
-                {
-                h=h^(g>>24);
-                h=h^g;
-                }
-        }
+while(len >= 8)				/* a word at a time */
+	{
+	memcpy(&k, s, 8);
+	k *= LXT2_WR_ULLDESC(0xbf58476d1ce4e5b9);
+	h ^= k ^ (k >> 31);
+	h = ((h << 27) | (h >> 37)) * LXT2_WR_ULLDESC(0x94d049bb133111eb);
+	s += 8;
+	len -= 8;
+	}
+
+k = 0;
+memcpy(&k, s, len);
+h ^= k * LXT2_WR_ULLDESC(0xbf58476d1ce4e5b9);
 
-h^=h2;						/* combine the two hashes */
-return(h%LXT2_WR_SYMPRIME);
+h ^= h >> 32;				/* mix the high bits down */
+h *= LXT2_WR_ULLDESC(0xd6e8feb86659fd93);
+h ^= h >> 32;
+return((unsigned int)h);
 }
 
 
-static struct lxt2_wr_symbol *lxt2_wr_symadd(struct lxt2_wr_trace *lt, const char *name, int hv)
+/*
+ * the symbol table doubles once it averages one symbol per bucket
+ */
+static void lxt2_wr_symgrow(struct lxt2_wr_trace *lt)
+{
+unsigned int i, nsize = lt->sym_size ? 2*lt->sym_size : 1024;
+struct lxt2_wr_symbol **nsym = (struct lxt2_wr_symbol **)calloc(nsize, sizeof(struct lxt2_wr_symbol *));
+
+if(!nsym)
+	{
+	fprintf(stderr, "lxt2_wr: ran out of memory, exiting.\n");
+	exit(255);
+	}
+
+for(i=0;i<lt->sym_size;i++)
+	{
+	struct lxt2_wr_symbol *s = lt->sym[i], *s2;
+
+	while(s)
+		{
+		s2 = s->next;
+		s->next = nsym[s->hv & (nsize-1)];
+		nsym[s->hv & (nsize-1)] = s;
+		s = s2;
+		}
+	}
+
+free(lt->sym);
+lt->sym = nsym;
+lt->sym_size = nsize;
+}
+
+
+static struct lxt2_wr_symbol *lxt2_wr_symadd(struct lxt2_wr_trace *lt, const char *name, unsigned int hv)
 {
 struct lxt2_wr_symbol *s;
 
+if(lt->sym_count >= lt->sym_size) lxt2_wr_symgrow(lt);
+
 s=(struct lxt2_wr_symbol *)calloc(1,sizeof(struct lxt2_wr_symbol));
 strcpy(s->name=(char *)malloc((s->namlen=strlen(name))+1),name);
-s->next=lt->sym[hv];
-lt->sym[hv]=s;
+s->hv=hv;
+s->gslot=-1;
+s->next=lt->sym[hv & (lt->sym_size-1)];
+lt->sym[hv & (lt->sym_size-1)]=s;
+lt->sym_count++;
 return(s);
 }
 
 
 static struct lxt2_wr_symbol *lxt2_wr_symfind(struct lxt2_wr_trace *lt, const char *s)
 {
-int hv;
+unsigned int hv;
+size_t len;
 struct lxt2_wr_symbol *temp;
 
-hv=lxt2_wr_hash(s);
-if(!(temp=lt->sym[hv])) return(NULL); /* no hash entry, add here wanted to add */
+if(!lt->sym_size) return(NULL);
 
-while(temp)
+len=strlen(s);
+hv=lxt2_wr_hash(s, len);
+
+for(temp=lt->sym[hv & (lt->sym_size-1)];temp;temp=temp->next)
         {
-        if(!strcmp(temp->name,s))
+        if((temp->hv==hv)&&(temp->name)&&((size_t)temp->namlen==len)&&(!memcmp(temp->name,s,len)))
                 {
                 return(temp); /* in table already */
                 }
-        if(!temp->next) break;
-        temp=temp->next;
         }
 
 return(NULL); /* not found, add here if you want to add*/
@@ -577,6 +933,9 @@ return;
 }
 
 
+static struct lxt2_wr_granule *lxt2_wr_granule_get(struct lxt2_wr_trace *lt);
+static void lxt2_wr_granule_chg(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s, unsigned int idx);
+
 static void lxt2_wr_emitfacs(struct lxt2_wr_trace *lt)
 {
 unsigned int i;
@@ -740,6 +1099,20 @@ if((lt)&&(lt->numfacs))
 		lxt2_wr_emit_u32(lt, lt->zfacgeometry_size);
 
 		lt->numfacs = facs_encountered;				/* don't process alias value changes ever */
+
+		lt->gcur = lxt2_wr_granule_get(lt);
+		for(i=0;i<lt->numfacs;i++)
+			{
+			s = lt->sorted_facs[i];
+			switch(s->initial_value)
+				{
+				case 0:		break;		/* doubles */
+				case '0':	lxt2_wr_granule_chg(lt, s, LXT2_WR_ENC_0); break;
+				case '1':	lxt2_wr_granule_chg(lt, s, LXT2_WR_ENC_1); break;
+				case 'z':	lxt2_wr_granule_chg(lt, s, LXT2_WR_ENC_Z); break;
+				default:	lxt2_wr_granule_chg(lt, s, LXT2_WR_ENC_X); break;
+				}
+			}
 		}
 
 	free(aliascache);
@@ -770,6 +1143,9 @@ if((!name)||(!(lt->handle=fopen(name, "wb"))))
 	lt->maxgranule = LXT2_WR_GRANULE_NUM;
 	lxt2_wr_set_compression_depth(lt, 4);	/* set fast/loose compression depth, user can fix this any time after init */
 	lt->initial_value = 'x';
+	lt->zthreads = 1;
+	lt->dict = &lt->dicts[0];
+	lt->mapdict.zero_val = -1;
 	}
 
 return(lt);
@@ -899,7 +1275,7 @@ flagcnt = ((flags&LXT2_WR_SYM_F_INTEGER)!=0) + ((flags&LXT2_WR_SYM_F_DOUBLE)!=0)
 
 if((flagcnt>1)||(!lt)||(!name)||(lxt2_wr_symfind(lt, name))) return (NULL);
 
-s=lxt2_wr_symadd(lt, name, lxt2_wr_hash(name));
+s=lxt2_wr_symadd(lt, name, lxt2_wr_hash(name, strlen(name)));
 s->rows = rows;
 s->flags = flags&(~LXT2_WR_SYM_F_ALIAS);	/* aliasing makes no sense here.. */
 
@@ -925,15 +1301,7 @@ if(flags&LXT2_WR_SYM_F_DOUBLE)
 	memset(s->value, lt->initial_value, s->len);
 	s->value[s->len]=0;
 
-	s->msk = LXT2_WR_GRAN_1VAL; /* stuff in an initial value */
-	switch(lt->initial_value)
-		{
-		case '0':	s->chg[0] = LXT2_WR_ENC_0; break;
-		case '1':	s->chg[0] = LXT2_WR_ENC_1; break;
-		case 'z':	s->chg[0] = LXT2_WR_ENC_Z; break;
-		default:	s->chg[0] = LXT2_WR_ENC_X; break;
-		}
-        s->chgpos++;		/* don't worry that a time doesn't exist as it will soon enough.. */
+	s->initial_value = lt->initial_value;	/* stuffed in as a change by emitfacs */
 	}
 
 s->symchain = lt->symchain;
@@ -970,7 +1338,7 @@ flagcnt = ((s->flags&LXT2_WR_SYM_F_INTEGER)!=0) + ((s->flags&LXT2_WR_SYM_F_DOUBL
 bitlen = (msb<lsb) ? (lsb-msb+1) : (msb-lsb+1);
 if((!flagcnt)&&(bitlen!=s->len)) return(NULL);
 
-sa=lxt2_wr_symadd(lt, alias, lxt2_wr_hash(alias));
+sa=lxt2_wr_symadd(lt, alias, lxt2_wr_hash(alias, strlen(alias)));
 sa->flags = LXT2_WR_SYM_F_ALIAS;	/* only point this can get set */
 sa->aliased_to = s;
 
@@ -1077,41 +1445,20 @@ free(tname);
 
 
 /*
- * emit granule
+ * write out a granule (and the block trailer if it is the last one in the
+ * block); runs on the granule thread when one is active
  */
-void lxt2_wr_flush_granule(struct lxt2_wr_trace *lt, int do_finalize)
+static void lxt2_wr_write_granule(struct lxt2_wr_trace *lt, struct lxt2_wr_granule *g)
 {
 unsigned int idx_nbytes, map_nbytes, i, j;
-struct lxt2_wr_symbol *s;
-unsigned int partial_iter;
+unsigned int partial_iter = g->partial_iter;
 unsigned int iter, iter_hi;
-unsigned char using_partial, using_partial_zip=0;
+unsigned int k, k0, k1;
+unsigned int nsect = 0;
+unsigned char using_partial = g->using_partial, using_partial_zip = g->using_partial_zip;
 off_t current_iter_pos=0;
-int early_flush;
-
-if(lt->flush_valid)
-	{
-	if(lt->flushtime == lt->lasttime)
-		{
-		return;
-		}
-
-	lt->flush_valid = 0;
-	}
-
-lt->granule_dirty = 0;
 
-if((using_partial=(lt->partial)&&(lt->numfacs>lt->partial_iter)))
-	{
-	partial_iter = lt->partial_iter;
-	using_partial_zip = lt->partial_zip;
-	}
-	else
-	{
-	partial_iter = lt->numfacs;
-	}
-
-if(!lt->timegranule)
+if(g->first)
 	{
 	int attempt_break_state = 2;
 
@@ -1141,7 +1488,7 @@ if(!lt->timegranule)
 
 	if(!using_partial_zip)
 		{
-		lt->zhandle = gzdopen(dup(fileno(lt->handle)), lt->zmode);
+		lt->zhandle = gzdopen(dup(fileno(lt->handle)), g->zmode);
 		}
 		else
 		{
@@ -1152,7 +1499,8 @@ if(!lt->timegranule)
 
 
 
-for(iter=0; iter<lt->numfacs; iter=iter_hi)
+k1 = 0;
+for(iter=0; iter<g->numfacs; iter=iter_hi)
 {
 unsigned int total_chgs;
 unsigned int partial_length;
@@ -1161,69 +1509,67 @@ total_chgs = 0;
 /* partial_length = 0; */ /* scan-build : never read */
 
 iter_hi = iter + partial_iter;
-if(iter_hi > lt->numfacs) iter_hi = lt->numfacs;
+if(iter_hi > g->numfacs) iter_hi = g->numfacs;
 
-for(j=iter;j<iter_hi;j++)
-	{
-	granmsk_t msk = lt->sorted_facs[j]->msk;
+/* facs that changed in [iter, iter_hi) are ranks [k0, k1) */
+k0 = k1;
+while((k1 < g->ndirty)&&(g->facnum[g->order[k1]] < iter_hi)) k1++;
 
-	lt->mapdict = lxt2_wr_ds_splay (msk, lt->mapdict);
-	if((!lt->mapdict)||(lt->mapdict->item != msk))
+for(j=iter, k=k0;j<iter_hi;j++)
+	{
+	if((k<k1)&&(g->facnum[g->order[k]] == j))
 		{
-		lt->mapdict = lxt2_wr_ds_insert(msk, lt->mapdict, lt->num_map_entries);
-		lt->num_map_entries++;
-
-		if(lt->mapdict_curr)
-			{
-			lt->mapdict_curr->next = lt->mapdict;
-			lt->mapdict_curr = lt->mapdict;
-			}
-			else
-			{
-			lt->mapdict_head =  lt->mapdict_curr = lt->mapdict;
-			}
+		g->mapval[k] = lxt2_wr_mapdict_find(&lt->mapdict, g->msk[g->order[k]]);
+		k++;
+		}
+	else if(lt->mapdict.zero_val < 0)
+		{
+		lt->mapdict.zero_val = lxt2_wr_mapdict_find(&lt->mapdict, LXT2_WR_GRAN_0VAL);
 		}
 	}
 
-if(lt->num_map_entries <= 256) { map_nbytes = 1; }
-else if(lt->num_map_entries <= 256*256) { map_nbytes = 2; }
-else if(lt->num_map_entries <= 256*256*256) { map_nbytes = 3; }
+if(lt->mapdict.num_entries <= 256) { map_nbytes = 1; }
+else if(lt->mapdict.num_entries <= 256*256) { map_nbytes = 2; }
+else if(lt->mapdict.num_entries <= 256*256*256) { map_nbytes = 3; }
 else { map_nbytes = 4; }
 
-if((lt->num_dict_entries+LXT2_WR_DICT_START) <= 256) { idx_nbytes = 1; }
-else if((lt->num_dict_entries+LXT2_WR_DICT_START) <= 256*256) { idx_nbytes = 2; }
-else if((lt->num_dict_entries+LXT2_WR_DICT_START) <= 256*256*256) { idx_nbytes = 3; }
+if((g->num_dict_entries+LXT2_WR_DICT_START) <= 256) { idx_nbytes = 1; }
+else if((g->num_dict_entries+LXT2_WR_DICT_START) <= 256*256) { idx_nbytes = 2; }
+else if((g->num_dict_entries+LXT2_WR_DICT_START) <= 256*256*256) { idx_nbytes = 3; }
 else { idx_nbytes = 4; }
 
 if(using_partial)
 	{
 	/* skip */
-	partial_length = 1 +			/* lt->timepos */
-	lt->timepos * sizeof(lxttime_t)+	/* timevals */
+	partial_length = 1 +			/* g->timepos */
+	g->timepos * sizeof(lxttime_t)+	/* timevals */
 
 	1 +					/* map_nbytes */
 	(iter_hi-iter) * map_nbytes +		/* actual map */
 	1;					/* idx_nbytes */
 
-	for(j=iter;j<iter_hi;j++)
-		{
-	        s=lt->sorted_facs[j];
-		total_chgs += s->chgpos;
-		}
+	total_chgs = g->chgpos[k1] - g->chgpos[k0];
 	total_chgs *= idx_nbytes;		/* vch skip */
 
 	partial_length += total_chgs; 		/* actual changes */
 
 	if(using_partial_zip)
 		{
-		fseeko(lt->handle, 0L, SEEK_END);
-		current_iter_pos = ftello(lt->handle);
-		lxt2_wr_emit_u32(lt, 0);		/* size of this section (compressed)   */
-		lxt2_wr_emit_u32(lt, partial_length+9);	/* size of this section (uncompressed) */
-		lxt2_wr_emit_u32(lt, iter);		/* begin iter of section               */
-		fflush(lt->handle);
+		struct lxt2_wr_zsect *zs;
 
-		lt->zhandle = gzdopen(dup(fileno(lt->handle)), lt->zmode);
+		/* captured here, compressed and written after the loop */
+		if(nsect == lt->zsect_alloc)
+			{
+			lt->zsect_alloc = lt->zsect_alloc ? 2*lt->zsect_alloc : 16;
+			lt->zsect = (struct lxt2_wr_zsect *)lxt2_wr_xrealloc(lt->zsect, lt->zsect_alloc * sizeof(struct lxt2_wr_zsect));
+			memset(lt->zsect + nsect, 0, (lt->zsect_alloc - nsect) * sizeof(struct lxt2_wr_zsect));
+			}
+		zs = &lt->zsect[nsect++];
+		zs->raw_len = 0;
+		zs->nsyncs = 0;
+		zs->iter = iter;
+		zs->unclen = partial_length+9;
+		lt->zcapture = zs;
 		lt->zpackcount = 0;
 		}
 
@@ -1236,21 +1582,27 @@ if(using_partial)
 	lxt2_wr_emit_u8z(lt, LXT2_WR_GRAN_SECT_TIME);
 	}
 
-lxt2_wr_emit_u8z(lt, lt->timepos);
-for(i=0;i<lt->timepos;i++)
+lxt2_wr_emit_u8z(lt, g->timepos);
+for(i=0;i<g->timepos;i++)
 	{
-	lxt2_wr_emit_u64z(lt, (lt->timetable[i]>>32)&0xffffffff, lt->timetable[i]&0xffffffff);
+	lxt2_wr_emit_u64z(lt, (g->timetable[i]>>32)&0xffffffff, g->timetable[i]&0xffffffff);
 	}
 gzflush_buffered(lt, 0);
 
 
 lxt2_wr_emit_u8z(lt, map_nbytes);
-for(j=iter;j<iter_hi;j++)
+for(j=iter, k=k0;j<iter_hi;j++)
 	{
 	unsigned int val;
-        s=lt->sorted_facs[j];
-	lt->mapdict = lxt2_wr_ds_splay (s->msk, lt->mapdict);
-	val = lt->mapdict->val;
+
+	if((k<k1)&&(g->facnum[g->order[k]] == j))
+		{
+		val = g->mapval[k++];
+		}
+		else
+		{
+		val = lt->mapdict.zero_val;
+		}
 
 	switch(map_nbytes)
 		{
@@ -1259,45 +1611,26 @@ for(j=iter;j<iter_hi;j++)
 		case 3: lxt2_wr_emit_u24z(lt, val); break;
 		case 4: lxt2_wr_emit_u32z(lt, val); break;
 		}
-
-	s->msk = LXT2_WR_GRAN_0VAL;
 	}
 
 
 lxt2_wr_emit_u8z(lt, idx_nbytes);
 gzflush_buffered(lt, 0);
-for(j=iter;j<iter_hi;j++)
+for(i=g->chgpos[k0];i<g->chgpos[k1];i++)
 	{
-        s=lt->sorted_facs[j];
-
-	for(i=0;i<s->chgpos;i++)
+	switch(idx_nbytes)
 		{
-		switch(idx_nbytes)
-			{
-			case 1:	lxt2_wr_emit_u8z (lt, s->chg[i]); break;
-			case 2: lxt2_wr_emit_u16z(lt, s->chg[i]); break;
-			case 3: lxt2_wr_emit_u24z(lt, s->chg[i]); break;
-			case 4: lxt2_wr_emit_u32z(lt, s->chg[i]); break;
-			}
+		case 1:	lxt2_wr_emit_u8z (lt, g->chg[i]); break;
+		case 2: lxt2_wr_emit_u16z(lt, g->chg[i]); break;
+		case 3: lxt2_wr_emit_u24z(lt, g->chg[i]); break;
+		case 4: lxt2_wr_emit_u32z(lt, g->chg[i]); break;
 		}
-
-	s->chgpos = 0;
 	}
 
 if(using_partial_zip)
 	{
-	off_t clen;
-
 	gzflush_buffered(lt, 1);
-	fseeko(lt->handle, 0L, SEEK_END);
-	lt->position=ftello(lt->handle);
-
-	clen = lt->position - current_iter_pos - 12;
-	fseeko(lt->handle, current_iter_pos, SEEK_SET);
-
 	lt->zpackcount_cumulative+=lt->zpackcount;
-
-	lxt2_wr_emit_u32(lt, clen);
 	}
 	else
 	{
@@ -1305,24 +1638,29 @@ if(using_partial_zip)
 	}
 } /* ...for(iter) */
 
+if(nsect)
+	{
+	lxt2_wr_zsect_run(lt, nsect, g->zmode[2] - '0');
 
-lt->timepos = 0;
-lt->timegranule++;
+	fseeko(lt->handle, 0L, SEEK_END);
+	lt->position = ftello(lt->handle);
+	for(i=0;i<nsect;i++)
+		{
+		struct lxt2_wr_zsect *zs = &lt->zsect[i];
 
-if(lt->break_size)
-	{
-	early_flush = (ftello(lt->handle) >= lt->break_size);
-	}
-	else
-	{
-	early_flush = 0;
+		lxt2_wr_emit_u32(lt, zs->z_len);	/* size of this section (compressed)   */
+		lxt2_wr_emit_u32(lt, zs->unclen);	/* size of this section (uncompressed) */
+		lxt2_wr_emit_u32(lt, zs->iter);		/* begin iter of section               */
+		fwrite(zs->z, 1, zs->z_len, lt->handle);
+		lt->position += zs->z_len;
+		}
 	}
 
-if((lt->timegranule>=lt->maxgranule)||(do_finalize)||(early_flush))
+
+if(g->last)
 	{
 	off_t unclen, clen;
-	lxt2_wr_ds_Tree *dt, *dt2;
-	lxt2_wr_dslxt_Tree *ds, *ds2;
+	struct lxt2_wr_dict *ds = g->dict;
 
 	if(using_partial_zip)
 		{
@@ -1333,7 +1671,7 @@ if((lt->timegranule>=lt->maxgranule)||(do_finalize)||(early_flush))
 		lxt2_wr_emit_u32(lt, ~0);		/* control section		       */
 		fflush(lt->handle);
 
-		lt->zhandle = gzdopen(dup(fileno(lt->handle)), lt->zmode);
+		lt->zhandle = gzdopen(dup(fileno(lt->handle)), g->zmode);
 		lt->zpackcount = 0;
 		}
 
@@ -1343,113 +1681,445 @@ if((lt->timegranule>=lt->maxgranule)||(do_finalize)||(early_flush))
 	/* finalize string dictionary */
 	lxt2_wr_emit_u8z(lt, LXT2_WR_GRAN_SECT_DICT);
 
-	ds = lt->dict_head;
-	/* fprintf(stderr, "num_dict_entries: %d\n", lt->num_dict_entries); */
+	/* fprintf(stderr, "num_dict_entries: %d\n", ds->num_entries); */
 	gzflush_buffered(lt, 0);
-	for(i=0;i<lt->num_dict_entries;i++)
+	for(i=0;i<ds->num_entries;i++)
 		{
-		/* fprintf(stderr, "%8d %8d) '%s'\n", ds->val, i, ds->item); */
-		if(ds->val != i)
-			{
-			fprintf(stderr, "internal error line %d\n", __LINE__);
-			exit(255);
-			}
-
-		lxt2_wr_emit_stringz(lt, ds->item);
-		ds2 = ds->next;
-		free(ds->item);
-		free(ds);
-		ds = ds2;
+		lxt2_wr_emit_stringz(lt, ds->entries[i].item);
 		}
-	lt->dict_head = lt->dict_curr = lt->dict = NULL;
 
 	/* finalize map dictionary */
-	dt = lt->mapdict_head;
-	/* fprintf(stderr, "num_map_entries: %d\n", lt->num_map_entries); */
+	/* fprintf(stderr, "num_map_entries: %d\n", lt->mapdict.num_entries); */
 	gzflush_buffered(lt, 0);
-	for(i=0;i<lt->num_map_entries;i++)
+	for(i=0;i<lt->mapdict.num_entries;i++)
 		{
-		/* fprintf(stderr, "+++ %08x (%d)(%d)\n", dt->item, i, dt->val); */
-		if(((unsigned int)dt->val) != i)
-			{
-			fprintf(stderr, "internal error line %d\n", __LINE__);
-			exit(255);
-			}
+		granmsk_t item = lt->mapdict.items[i];
 
 #if LXT2_WR_GRANULE_SIZE > 32
-		lxt2_wr_emit_u64z(lt, (dt->item>>32)&0xffffffff, dt->item&0xffffffff);
+		lxt2_wr_emit_u64z(lt, (item>>32)&0xffffffff, item&0xffffffff);
 #else
-		lxt2_wr_emit_u32z(lt, dt->item);
+		lxt2_wr_emit_u32z(lt, item);
 #endif
+		}
+
+	lxt2_wr_emit_u32z(lt, ds->num_entries);		/* -12 */
+	lxt2_wr_emit_u32z(lt, ds->string_mem_required);	/* -8 */
+	lxt2_wr_emit_u32z(lt, lt->mapdict.num_entries);		/* -4 */
+
+	/* both dictionaries start over with the next block */
+	if(lt->mapdict.num_entries)
+		{
+		memset(lt->mapdict.table, 0, lt->mapdict.table_size * sizeof(unsigned int));
+		}
+	lt->mapdict.num_entries = 0;
+	lt->mapdict.zero_val = -1;
+	lxt2_wr_dict_reset(ds);
+
+	/* fprintf(stderr, "returned from finalize..\n"); */
 
-		dt2 = dt->next;
-		free(dt);
-		dt = dt2;
+	if(using_partial_zip)
+		{
+		off_t c_len;
+
+		gzflush_buffered(lt, 1);
+		fseeko(lt->handle, 0L, SEEK_END);
+		lt->position=ftello(lt->handle);
+
+		c_len = lt->position - current_iter_pos - 12;
+		fseeko(lt->handle, current_iter_pos, SEEK_SET);
+
+		lt->zpackcount_cumulative+=lt->zpackcount;
+		lxt2_wr_emit_u32(lt, c_len);
+		lxt2_wr_emit_u32(lt, lt->zpackcount);
+		}
+		else
+		{
+		gzflush_buffered(lt, 1);
+		}
+
+        fseeko(lt->handle, 0L, SEEK_END);
+        lt->position=ftello(lt->handle);
+	/* fprintf(stderr, "file position after dumping dict: %d 0x%08x\n", lt->position, lt->position); */
+
+	unclen = lt->zpackcount;
+	clen = lt->position - lt->current_chunkz;
+
+	/* fprintf(stderr, "%d/%d un/compressed bytes in section\n", unclen, clen); */
+
+	fseeko(lt->handle, lt->current_chunk, SEEK_SET);
+	if(using_partial_zip)
+		{
+		lxt2_wr_emit_u32(lt, lt->zpackcount_cumulative);
+		lxt2_wr_emit_u32(lt, clen);
+		}
+		else
+		{
+		lxt2_wr_emit_u32(lt, unclen);
+		lxt2_wr_emit_u32(lt, clen);
+		}
+	lxt2_wr_emit_u64(lt, (g->firsttime>>32)&0xffffffff, g->firsttime&0xffffffff);
+	lxt2_wr_emit_u64(lt, (g->lasttime>>32)&0xffffffff, g->lasttime&0xffffffff);
+
+	if(lt->gran_running) pthread_mutex_lock(&lt->gran_lock);
+	lt->stat_blocks++;
+	lt->stat_unpacked += using_partial_zip ? lt->zpackcount_cumulative : unclen;
+	lt->stat_packed += clen;
+	if(lt->gran_running) pthread_mutex_unlock(&lt->gran_lock);
+
+	/* fprintf(stderr, "start: %lld, end %lld\n", g->firsttime, g->lasttime); */
+	}
+}
+
+
+static void *lxt2_wr_granule_thread(void *arg)
+{
+struct lxt2_wr_trace *lt = (struct lxt2_wr_trace *)arg;
+
+pthread_mutex_lock(&lt->gran_lock);
+for(;;)
+	{
+	while((!lt->gran_queued)&&(!lt->gran_stop))
+		{
+		pthread_cond_wait(&lt->gran_cv, &lt->gran_lock);
+		}
+	if(!lt->gran_queued) break;
+
+	lt->gran_busy = lt->gran_queued;
+	lt->gran_queued = NULL;
+	pthread_cond_broadcast(&lt->gran_cv);
+	pthread_mutex_unlock(&lt->gran_lock);
+
+	lxt2_wr_write_granule(lt, lt->gran_busy);
+
+	pthread_mutex_lock(&lt->gran_lock);
+	lt->gran_busy = NULL;
+	pthread_cond_broadcast(&lt->gran_cv);
+	}
+pthread_mutex_unlock(&lt->gran_lock);
+
+return(NULL);
+}
+
+
+/*
+ * wait for the granule thread to write out everything handed to it
+ */
+static void lxt2_wr_granule_drain(struct lxt2_wr_trace *lt)
+{
+if(lt->gran_running)
+	{
+	pthread_mutex_lock(&lt->gran_lock);
+	while((lt->gran_queued)||(lt->gran_busy))
+		{
+		pthread_cond_wait(&lt->gran_cv, &lt->gran_lock);
+		}
+	pthread_mutex_unlock(&lt->gran_lock);
+	}
+}
+
+
+static void lxt2_wr_granule_stop(struct lxt2_wr_trace *lt)
+{
+if(lt->gran_running)
+	{
+	pthread_mutex_lock(&lt->gran_lock);
+	lt->gran_stop = 1;
+	pthread_cond_broadcast(&lt->gran_cv);
+	pthread_mutex_unlock(&lt->gran_lock);
+
+	pthread_join(lt->gran_thread, NULL);
+	pthread_mutex_destroy(&lt->gran_lock);
+	pthread_cond_destroy(&lt->gran_cv);
+	lt->gran_running = 0;
+	lt->gran_stop = 0;
+	}
+}
+
+
+/*
+ * get the granule buffer to fill next: the one the thread is not using
+ */
+static struct lxt2_wr_granule *lxt2_wr_granule_get(struct lxt2_wr_trace *lt)
+{
+struct lxt2_wr_granule *g = &lt->gran[lt->gran_fill];
+
+if(lt->gran_running)
+	{
+	pthread_mutex_lock(&lt->gran_lock);
+	while((lt->gran_busy == g)||(lt->gran_queued == g))
+		{
+		pthread_cond_wait(&lt->gran_cv, &lt->gran_lock);
+		}
+	pthread_mutex_unlock(&lt->gran_lock);
+	}
+
+if(!g->dirty)
+	{
+	g->dirty_words = lt->numfacs/64 + 1;
+	g->dirty = (uint64_t *)calloc(g->dirty_words, sizeof(uint64_t));
+	if(!g->dirty)
+		{
+		fprintf(stderr, "lxt2_wr: ran out of memory, exiting.\n");
+		exit(255);
+		}
+	}
+
+g->ndirty = 0;
+g->nlog = 0;
+return(g);
+}
+
+
+/*
+ * nonzero if s already has a change at the current time position: a
+ * replacement must not use an encoding relative to that change
+ */
+static int lxt2_wr_granule_samepos(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s)
+{
+return((s->gslot >= 0) && ((lt->gcur->msk[s->gslot] & (LXT2_WR_GRAN_1VAL<<lt->timepos)) != LXT2_WR_GRAN_0VAL));
+}
+
+
+/*
+ * record a value change for s at the current time position; a second
+ * change at the same position replaces the first
+ */
+static void lxt2_wr_granule_chg(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s, unsigned int idx)
+{
+struct lxt2_wr_granule *g = lt->gcur;
+granmsk_t bit = LXT2_WR_GRAN_1VAL<<lt->timepos;
+int slot = s->gslot;
+
+if(slot < 0)
+	{
+	if(g->ndirty == g->max_dirty)
+		{
+		g->max_dirty = g->max_dirty ? 2*g->max_dirty : 1024;
+		g->facnum = (unsigned int *)lxt2_wr_xrealloc(g->facnum, g->max_dirty * sizeof(unsigned int));
+		g->msk = (granmsk_t *)lxt2_wr_xrealloc(g->msk, g->max_dirty * sizeof(granmsk_t));
+		g->lastlog = (unsigned int *)lxt2_wr_xrealloc(g->lastlog, g->max_dirty * sizeof(unsigned int));
+		g->order = (unsigned int *)lxt2_wr_xrealloc(g->order, g->max_dirty * sizeof(unsigned int));
+		g->chgpos = (unsigned int *)lxt2_wr_xrealloc(g->chgpos, (g->max_dirty+1) * sizeof(unsigned int));
+		g->mapval = (unsigned int *)lxt2_wr_xrealloc(g->mapval, (g->max_dirty+1) * sizeof(unsigned int));
+		}
+	slot = s->gslot = g->ndirty++;
+	g->facnum[slot] = s->facnum;
+	g->msk[slot] = LXT2_WR_GRAN_0VAL;
+	g->dirty[s->facnum/64] |= LXT2_WR_ULLDESC(1) << (s->facnum&63);
+	}
+
+if(g->msk[slot] & bit)
+	{
+	g->log_idx[g->lastlog[slot]] = idx;
+	return;
+	}
+
+if(g->nlog == g->max_log)
+	{
+	g->max_log = g->max_log ? 2*g->max_log : 4096;
+	g->log_slot = (unsigned int *)lxt2_wr_xrealloc(g->log_slot, g->max_log * sizeof(unsigned int));
+	g->log_idx = (unsigned int *)lxt2_wr_xrealloc(g->log_idx, g->max_log * sizeof(unsigned int));
+	g->chg = (unsigned int *)lxt2_wr_xrealloc(g->chg, g->max_log * sizeof(unsigned int));
+	}
+
+g->msk[slot] |= bit;
+g->lastlog[slot] = g->nlog;
+g->log_slot[g->nlog] = slot;
+g->log_idx[g->nlog++] = idx;
+}
+
+
+static int lxt2_wr_ctz64(uint64_t b)
+{
+#if defined(__GNUC__)
+return(__builtin_ctzll(b));
+#else
+int n = 0;
+while(!(b & 1)) { b >>= 1; n++; }
+return(n);
+#endif
+}
+
+
+static void lxt2_wr_granule_submit(struct lxt2_wr_trace *lt, struct lxt2_wr_granule *g)
+{
+if((lt->use_thread)&&(!lt->gran_running))
+	{
+	pthread_mutex_init(&lt->gran_lock, NULL);
+	pthread_cond_init(&lt->gran_cv, NULL);
+	lt->gran_running = (pthread_create(&lt->gran_thread, NULL, lxt2_wr_granule_thread, lt) == 0);
+	}
+
+if(!lt->gran_running)
+	{
+	lxt2_wr_write_granule(lt, g);
+	return;
+	}
+
+pthread_mutex_lock(&lt->gran_lock);
+while(lt->gran_queued)
+	{
+	pthread_cond_wait(&lt->gran_cv, &lt->gran_lock);
+	}
+lt->gran_queued = g;
+pthread_cond_broadcast(&lt->gran_cv);
+pthread_mutex_unlock(&lt->gran_lock);
+
+lt->gran_fill ^= 1;
+}
+
+
+/*
+ * hand off the block trailer: the string dictionary gathered so far and the
+ * block's time range
+ */
+static void lxt2_wr_granule_end_block(struct lxt2_wr_trace *lt, struct lxt2_wr_granule *g)
+{
+g->last = 1;
+g->dict = lt->dict;
+g->num_dict_entries = lt->dict->num_entries;
+g->firsttime = lt->firsttime;
+g->lasttime = lt->lasttime;
+
+/* switch to the other dictionary once the thread is done with it */
+lt->dict = (lt->dict == &lt->dicts[0]) ? &lt->dicts[1] : &lt->dicts[0];
+if(lt->gran_running)
+	{
+	pthread_mutex_lock(&lt->gran_lock);
+	while(((lt->gran_busy)&&(lt->gran_busy->last)&&(lt->gran_busy->dict == lt->dict)) ||
+	      ((lt->gran_queued)&&(lt->gran_queued->last)&&(lt->gran_queued->dict == lt->dict)))
+		{
+		pthread_cond_wait(&lt->gran_cv, &lt->gran_lock);
+		}
+	pthread_mutex_unlock(&lt->gran_lock);
+	}
+
+lt->timegranule=0;
+lt->numblock++;
+}
+
+
+/*
+ * emit granule: the change data is moved out of the symbols into a granule
+ * buffer so that encoding and compression can overlap the next granule
+ */
+void lxt2_wr_flush_granule(struct lxt2_wr_trace *lt, int do_finalize)
+{
+struct lxt2_wr_granule *g;
+struct lxt2_wr_symbol *s;
+unsigned int i, k, w;
+int early_flush;
+
+if(lt->flush_valid)
+	{
+	if(lt->flushtime == lt->lasttime)
+		{
+		return;
 		}
-	lt->mapdict_head = lt->mapdict_curr = lt->mapdict = NULL;
 
-	lxt2_wr_emit_u32z(lt, lt->num_dict_entries);		/* -12 */
-	lxt2_wr_emit_u32z(lt, lt->dict_string_mem_required);	/* -8 */
-	lxt2_wr_emit_u32z(lt, lt->num_map_entries);		/* -4 */
+	lt->flush_valid = 0;
+	}
 
-	lt->num_map_entries = 0;
-	lt->num_dict_entries = lt->dict_string_mem_required = 0;
+lt->granule_dirty = 0;
 
-	/* fprintf(stderr, "returned from finalize..\n"); */
+if(!lt->gcur)
+	{
+	lt->gcur = lxt2_wr_granule_get(lt);	/* no facs were ever emitted */
+	}
+g = lt->gcur;
 
-	if(using_partial_zip)
-		{
-		off_t c_len;
+if((g->using_partial=(lt->partial)&&(lt->numfacs>lt->partial_iter)))
+	{
+	g->partial_iter = lt->partial_iter;
+	g->using_partial_zip = lt->partial_zip;
+	}
+	else
+	{
+	g->partial_iter = lt->numfacs;
+	g->using_partial_zip = 0;
+	}
 
-		gzflush_buffered(lt, 1);
-		fseeko(lt->handle, 0L, SEEK_END);
-		lt->position=ftello(lt->handle);
+g->first = !lt->timegranule;
+g->last = 0;
+memcpy(g->zmode, lt->zmode, sizeof(g->zmode));
+g->numfacs = lt->numfacs;
+g->num_dict_entries = lt->dict->num_entries;
+g->timepos = lt->timepos;
+memcpy(g->timetable, lt->timetable, lt->timepos * sizeof(lxttime_t));
 
-		c_len = lt->position - current_iter_pos - 12;
-		fseeko(lt->handle, current_iter_pos, SEEK_SET);
+/* changed facs in facnum order; lastlog[] becomes each slot's rank */
+k = 0;
+for(w=0;w<g->dirty_words;w++)
+	{
+	uint64_t b = g->dirty[w];
 
-		lt->zpackcount_cumulative+=lt->zpackcount;
-		lxt2_wr_emit_u32(lt, c_len);
-		lxt2_wr_emit_u32(lt, lt->zpackcount);
-		}
-		else
+	g->dirty[w] = 0;
+	while(b)
 		{
-		gzflush_buffered(lt, 1);
+		s = lt->sorted_facs[w*64 + lxt2_wr_ctz64(b)];
+		b &= b-1;
+		g->order[k] = s->gslot;
+		g->lastlog[s->gslot] = k++;
+		s->gslot = -1;
 		}
+	}
 
-        fseeko(lt->handle, 0L, SEEK_END);
-        lt->position=ftello(lt->handle);
-	/* fprintf(stderr, "file position after dumping dict: %d 0x%08x\n", lt->position, lt->position); */
+/* group the change log by rank (counting sort keeps each fac's order) */
+memset(g->chgpos, 0, (g->ndirty+1) * sizeof(unsigned int));
+for(i=0;i<g->nlog;i++)
+	{
+	g->chgpos[g->lastlog[g->log_slot[i]]+1]++;
+	}
+for(k=0;k<g->ndirty;k++)
+	{
+	g->chgpos[k+1] += g->chgpos[k];
+	g->mapval[k] = g->chgpos[k];
+	}
+for(i=0;i<g->nlog;i++)
+	{
+	g->chg[g->mapval[g->lastlog[g->log_slot[i]]]++] = g->log_idx[i];
+	}
 
-	unclen = lt->zpackcount;
-	clen = lt->position - lt->current_chunkz;
+lt->timepos = 0;
+lt->timegranule++;
 
-	/* fprintf(stderr, "%d/%d un/compressed bytes in section\n", unclen, clen); */
+if((lt->timegranule>=lt->maxgranule)||(do_finalize))
+	{
+	lxt2_wr_granule_end_block(lt, g);
+	lxt2_wr_granule_submit(lt, g);
+	lt->gcur = lxt2_wr_granule_get(lt);
+	}
+	else
+	{
+	lxt2_wr_granule_submit(lt, g);
+	lt->gcur = lxt2_wr_granule_get(lt);
 
-	fseeko(lt->handle, lt->current_chunk, SEEK_SET);
-	if(using_partial_zip)
-		{
-		lxt2_wr_emit_u32(lt, lt->zpackcount_cumulative);
-		lxt2_wr_emit_u32(lt, clen);
-		}
-		else
+	if(lt->break_size)
 		{
-		lxt2_wr_emit_u32(lt, unclen);
-		lxt2_wr_emit_u32(lt, clen);
-		}
-	lxt2_wr_emit_u64(lt, (lt->firsttime>>32)&0xffffffff, lt->firsttime&0xffffffff);
-	lxt2_wr_emit_u64(lt, (lt->lasttime>>32)&0xffffffff, lt->lasttime&0xffffffff);
+		/* the block is cut short once the file passes the break size */
+		lxt2_wr_granule_drain(lt);
+		early_flush = (ftello(lt->handle) >= lt->break_size);
 
-	/* fprintf(stderr, "start: %lld, end %lld\n", lt->firsttime, lt->lasttime); */
-
-	lt->timegranule=0;
-	lt->numblock++;
+		if(early_flush)
+			{
+			g = lt->gcur;		/* nothing in it yet */
+			memcpy(g->zmode, lt->zmode, sizeof(g->zmode));
+			g->first = 0;
+			g->numfacs = 0;
+			g->using_partial = 0;
+			g->using_partial_zip = lt->partial_zip && lt->partial && (lt->numfacs>lt->partial_iter);
+			lxt2_wr_granule_end_block(lt, g);
+			lxt2_wr_granule_submit(lt, g);
+			lt->gcur = lxt2_wr_granule_get(lt);
+			}
+		}
 	}
 
 if(do_finalize)
 	{
 	lt->flush_valid = 1;
 	lt->flushtime = lt->lasttime;
+	lxt2_wr_granule_drain(lt);
 	}
 }
 
@@ -1484,7 +2154,7 @@ if(lt)
 					}
 				}
 
-			/* fprintf(stderr, "updating time to %d (%d dict entries/%d bytes)\n", (unsigned int)timeval, lt->num_dict_entries, lt->dict_string_mem_required); */
+			/* fprintf(stderr, "updating time to %d (%d dict entries/%d bytes)\n", (unsigned int)timeval, lt->dict->num_entries, lt->dict->string_mem_required); */
 			lt->timetable[lt->timepos] = timeval;
 			lt->lasttime = timeval;
 			}
@@ -1520,6 +2190,7 @@ if(lt)
 		                        {
 					if(!(s->flags&(LXT2_WR_SYM_F_DOUBLE|LXT2_WR_SYM_F_STRING)))
 						{
+						lxt2_wr_unpack_value(s);
 			                        lxt2_wr_emit_value_bit_string(lt, s, 0, s->value);
 						}
 					else if (s->flags&LXT2_WR_SYM_F_DOUBLE)
@@ -1649,51 +2320,15 @@ if(s->flags&LXT2_WR_SYM_F_DOUBLE)
 
 	rc = 1;
 	sprintf(d_buf, "%.16g", value);
-	if(!strcmp(d_buf, s->value)) return(rc);
+	if(((lt->timepos)||(lt->timegranule))&&(!strcmp(d_buf, s->value))) return(rc);
 
 	lt->bumptime = 1;
 	free(s->value);
 	s->value = strdup(d_buf);
 
-	lt->dict = lxt2_wr_dslxt_splay (s->value, lt->dict);
-
-	if(!lxt2_wr_dslxt_success)
-		{
-		unsigned int vlen = strlen(d_buf)+1;
-		char *vcopy = (char *)malloc(vlen);
-		strcpy(vcopy, d_buf);
-		lt->dict_string_mem_required += vlen;
-		lt->dict = lxt2_wr_dslxt_insert(vcopy, lt->dict, lt->num_dict_entries);
-
-		if(lt->dict_curr)
-			{
-			lt->dict_curr->next = lt->dict;
-			lt->dict_curr = lt->dict;
-			}
-			else
-			{
-			lt->dict_head =  lt->dict_curr = lt->dict;
-			}
-
-		idx = lt->num_dict_entries + LXT2_WR_DICT_START;
-		lt->num_dict_entries++;
-		}
-		else
-		{
-		idx = lt->dict->val + LXT2_WR_DICT_START;
-		}
-
-	if((s->msk & (LXT2_WR_GRAN_1VAL<<lt->timepos)) == LXT2_WR_GRAN_0VAL)
-		{
-		s->msk |= (LXT2_WR_GRAN_1VAL<<lt->timepos);
-		s->chg[s->chgpos] = idx;
+	idx = lxt2_wr_dict_index(lt, s->value);
 
-		s->chgpos++;
-		}
-		else
-		{
-		s->chg[s->chgpos-1] = idx;
-		}
+	lxt2_wr_granule_chg(lt, s, idx);
 
 	lt->granule_dirty = 1;
 	}
@@ -1729,51 +2364,15 @@ if(s->flags&LXT2_WR_SYM_F_STRING)
 	unsigned int idx;
 
 	rc = 1;
-	if(!strcmp(value, s->value)) return(rc);
+	if(((lt->timepos)||(lt->timegranule))&&(!strcmp(value, s->value))) return(rc);
 
 	lt->bumptime = 1;
 	free(s->value);
 	s->value = strdup(value);
 
-	lt->dict = lxt2_wr_dslxt_splay (s->value, lt->dict);
-
-	if(!lxt2_wr_dslxt_success)
-		{
-		unsigned int vlen = strlen(value)+1;
-		char *vcopy = (char *)malloc(vlen);
-		strcpy(vcopy, value);
-		lt->dict_string_mem_required += vlen;
-		lt->dict = lxt2_wr_dslxt_insert(vcopy, lt->dict, lt->num_dict_entries);
-
-		if(lt->dict_curr)
-			{
-			lt->dict_curr->next = lt->dict;
-			lt->dict_curr = lt->dict;
-			}
-			else
-			{
-			lt->dict_head =  lt->dict_curr = lt->dict;
-			}
-
-		idx = lt->num_dict_entries + LXT2_WR_DICT_START;
-		lt->num_dict_entries++;
-		}
-		else
-		{
-		idx = lt->dict->val + LXT2_WR_DICT_START;
-		}
-
-	if((s->msk & (LXT2_WR_GRAN_1VAL<<lt->timepos)) == LXT2_WR_GRAN_0VAL)
-		{
-		s->msk |= (LXT2_WR_GRAN_1VAL<<lt->timepos);
-		s->chg[s->chgpos] = idx;
+	idx = lxt2_wr_dict_index(lt, s->value);
 
-		s->chgpos++;
-		}
-		else
-		{
-		s->chg[s->chgpos-1] = idx;
-		}
+	lxt2_wr_granule_chg(lt, s, idx);
 
 	lt->granule_dirty = 1;
 	}
@@ -1808,6 +2407,8 @@ while(s->aliased_to)	/* find root alias if exists */
 	s=s->aliased_to;
 	}
 
+lxt2_wr_unpack_value(s);
+
 valuelen = strlen(value);	/* ensure string is proper length */
 if(valuelen == s->len)
 	{
@@ -1879,7 +2480,7 @@ if(!(s->flags&(LXT2_WR_SYM_F_DOUBLE|LXT2_WR_SYM_F_STRING)))
 		default:	idx = -1; break;
 		}
 
-	if((lt->timepos)||(lt->timegranule))
+	if(((lt->timepos)||(lt->timegranule))&&(!lxt2_wr_granule_samepos(lt, s)))
 		{
 		for(i=0;i<s->len;i++)
 			{
@@ -1957,54 +2558,231 @@ if(!(s->flags&(LXT2_WR_SYM_F_DOUBLE|LXT2_WR_SYM_F_STRING)))
 idxchk:	if(idx<0)
 		{
 		vpnt = lxt2_wr_vcd_truncate_bitvec(value);
-		lt->dict = lxt2_wr_dslxt_splay (vpnt, lt->dict);
+		idx = lxt2_wr_dict_index(lt, vpnt);
+		}
+
+do_enc:
+	lxt2_wr_granule_chg(lt, s, idx);
+
+	strncpy(s->value, value, s->len);
+	s->packed = 0;
+
+	lt->granule_dirty = 1;
+	}
+
+return(rc);
+}
+
+
+/*
+ * 1 if plane n equals plane o shifted by one bit (left = toward the msb),
+ * ignoring the bit shifted in
+ */
+static int lxt2_wr_packed_shifted(unsigned long *n, unsigned long *o, int nw, int len, int left)
+{
+int k;
+
+for(k=0;k<nw;k++)
+	{
+	unsigned long exp, msk = (k==nw-1) ? lxt2_wr_topmask(len) : ~0UL;
+
+	if(left)
+		{
+		exp = (o[k]<<1) | (k ? (o[k-1]>>63) : 0);
+		if(!k) msk &= ~1UL;
+		}
+		else
+		{
+		exp = (o[k]>>1) | ((k+1<nw) ? (o[k+1]<<63) : 0);
+		if(k==nw-1) msk &= ~(1UL<<((len-1)&63));
+		}
+
+	if((n[k]^exp)&msk) return(0);
+	}
+
+return(1);
+}
+
+
+/* 0 = all clear, 1 = all set, -1 = mixed */
+static int lxt2_wr_packed_uniform(unsigned long *p, int nw, int len)
+{
+unsigned long top = lxt2_wr_topmask(len);
+int k;
+
+if(!p[0])
+	{
+	for(k=1;k<nw;k++) if(p[k]) return(-1);
+	return(0);
+	}
+
+for(k=0;k<nw;k++)
+	{
+	unsigned long msk = (k==nw-1) ? top : ~0UL;
+	if(p[k]!=msk) return(-1);
+	}
+return(1);
+}
+
+
+int lxt2_wr_emit_value_bits(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s, unsigned int row, unsigned long *bits, unsigned long *xzmask)
+{
+int rc=0;
+int nw, k, idx;
+int uv, ux;
+unsigned long *nv, *nx, *ov, *ox;
+unsigned long top;
+int prev;
+
+if((!lt)||(lt->blackout)||(!s)||(!bits)||(row)) return(rc);
+
+if(!lt->emitted)
+	{
+	lxt2_wr_emitfacs(lt);
+	lt->emitted = 1;
+
+	if(!lt->timeset)
+		{
+		lxt2_wr_set_time(lt, 0);
+		}
+	}
+
+while(s->aliased_to)	/* find root alias if exists */
+	{
+	s=s->aliased_to;
+	}
 
-		if(!lxt2_wr_dslxt_success)
+if(s->flags&(LXT2_WR_SYM_F_DOUBLE|LXT2_WR_SYM_F_STRING)) return(rc);
+
+nw = LXT2_WR_PWORDS(s->len);
+top = lxt2_wr_topmask(s->len);
+nv = (unsigned long *)wave_alloca(2*nw*sizeof(unsigned long));
+nx = nv + nw;
+for(k=0;k<nw;k++)
+	{
+	nv[k] = bits[k];
+	nx[k] = xzmask ? xzmask[k] : 0;
+	}
+nv[nw-1] &= top;
+nx[nw-1] &= top;
+
+prev = (lt->timepos || lt->timegranule);
+
+if(!lxt2_wr_pack_value(s))
+	{
+	/* previous value has no packed form: take the string path */
+	char *str = (char *)wave_alloca(s->len+1);
+	for(k=0;k<s->len;k++)
+		{
+		int b = s->len-1-k;
+		unsigned long v = (nv[b/64] >> (b&63)) & 1;
+		unsigned long x = (nx[b/64] >> (b&63)) & 1;
+		str[k] = x ? (v ? 'z' : 'x') : (char)('0' | v);
+		}
+	str[s->len] = 0;
+	return(lxt2_wr_emit_value_bit_string(lt, s, row, str));
+	}
+
+ov = s->pval;
+ox = s->pval + nw;
+
+if(prev && !memcmp(ov, nv, 2*nw*sizeof(unsigned long)))
+	{
+	return(1);	/* redundant value change */
+	}
+
+lt->bumptime = 1;
+
+/* same classification order as the bit string path */
+uv = lxt2_wr_packed_uniform(nv, nw, s->len);
+ux = lxt2_wr_packed_uniform(nx, nw, s->len);
+if((uv<0)||(ux<0)) idx = -1;
+else if(!ux) idx = uv ? LXT2_WR_ENC_1 : LXT2_WR_ENC_0;
+else idx = uv ? LXT2_WR_ENC_Z : LXT2_WR_ENC_X;
+
+if((prev)&&(!lxt2_wr_granule_samepos(lt, s)))
+	{
+	int bin = (lxt2_wr_packed_uniform(nx, nw, s->len)==0) && (lxt2_wr_packed_uniform(ox, nw, s->len)==0);
+
+	if(bin)
+		{
+		for(k=0;k<nw;k++)
 			{
-			unsigned int vlen = strlen(vpnt)+1;
-			char *vcopy = (char *)malloc(vlen);
-			strcpy(vcopy, vpnt);
-			lt->dict_string_mem_required += vlen;
-			lt->dict = lxt2_wr_dslxt_insert(vcopy, lt->dict, lt->num_dict_entries);
+			unsigned long msk = (k==nw-1) ? top : ~0UL;
+			if((nv[k]^~ov[k])&msk) break;
+			}
+		if(k==nw) { idx = LXT2_WR_ENC_INV; goto do_enc; }
+		}
+
+	if(s->len > 1)
+		{
+		int hb = s->len-1;
 
-			if(lt->dict_curr)
+		if(lxt2_wr_packed_shifted(nv, ov, nw, s->len, 1) && lxt2_wr_packed_shifted(nx, ox, nw, s->len, 1))
+			{
+			if(!(nx[0]&1))
 				{
-				lt->dict_curr->next = lt->dict;
-				lt->dict_curr = lt->dict;
+				idx = LXT2_WR_ENC_LSH0 + (int)(nv[0]&1);
+				goto do_enc;
 				}
-				else
+			}
+		else
+		if(lxt2_wr_packed_shifted(nv, ov, nw, s->len, 0) && lxt2_wr_packed_shifted(nx, ox, nw, s->len, 0))
+			{
+			if(!((nx[hb/64]>>(hb&63))&1))
 				{
-				lt->dict_head =  lt->dict_curr = lt->dict;
+				idx = LXT2_WR_ENC_RSH0 + (int)((nv[hb/64]>>(hb&63))&1);
+				goto do_enc;
 				}
-
-			idx = lt->num_dict_entries + LXT2_WR_DICT_START;
-			lt->num_dict_entries++;
 			}
-			else
+
+		if((s->len <= 32) && bin)
 			{
-			idx = lt->dict->val + LXT2_WR_DICT_START;
-			}
-		}
+			unsigned int intval_old = ov[0], intval_new = nv[0];
+			unsigned int msk = (~0)>>(32-s->len);	/* as in the bit string path */
 
-do_enc:
-	if((s->msk & (LXT2_WR_GRAN_1VAL<<lt->timepos)) == LXT2_WR_GRAN_0VAL)
-		{
-		s->msk |= (LXT2_WR_GRAN_1VAL<<lt->timepos);
-		s->chg[s->chgpos] = idx;
+			if( ((intval_old+1)&msk) == intval_new ) { idx = LXT2_WR_ENC_ADD1; goto do_enc; }
+			if( ((intval_old-1)&msk) == intval_new ) { idx = LXT2_WR_ENC_SUB1; goto do_enc; }
 
-		s->chgpos++;
+			if( ((intval_old+2)&msk) == intval_new ) { idx = LXT2_WR_ENC_ADD2; goto do_enc; }
+			if( ((intval_old-2)&msk) == intval_new ) { idx = LXT2_WR_ENC_SUB2; goto do_enc; }
+
+			if( ((intval_old+3)&msk) == intval_new ) { idx = LXT2_WR_ENC_ADD3; goto do_enc; }
+			if( ((intval_old-3)&msk) == intval_new ) { idx = LXT2_WR_ENC_SUB3; goto do_enc; }
+
+			if(s->len > 2)
+				{
+				if( ((intval_old+4)&msk) == intval_new ) { idx = LXT2_WR_ENC_ADD4; goto do_enc; }
+				if( ((intval_old-4)&msk) == intval_new ) { idx = LXT2_WR_ENC_SUB4; goto do_enc; }
+				}
+			}
 		}
-		else
+	}
+
+if(idx<0)
+	{
+	/* only now is the string form needed, as the dictionary key */
+	char *str = (char *)wave_alloca(s->len+1);
+	for(k=0;k<s->len;k++)
 		{
-		s->chg[s->chgpos-1] = idx;
+		int b = s->len-1-k;
+		unsigned long v = (nv[b/64] >> (b&63)) & 1;
+		unsigned long x = (nx[b/64] >> (b&63)) & 1;
+		str[k] = x ? (v ? 'z' : 'x') : (char)('0' | v);
 		}
+	str[s->len] = 0;
+	idx = lxt2_wr_dict_index(lt, lxt2_wr_vcd_truncate_bitvec(str));
+	}
 
-	strncpy(s->value, value, s->len);
+do_enc:
+lxt2_wr_granule_chg(lt, s, idx);
 
-	lt->granule_dirty = 1;
-	}
+memcpy(s->pval, nv, 2*nw*sizeof(unsigned long));
+s->value_stale = 1;
 
-return(rc);
+lt->granule_dirty = 1;
+
+return(1);
 }
 
 
@@ -2033,17 +2811,7 @@ if((lt)&&(!lt->blackout))
 		{
 		if(!(s->flags&LXT2_WR_SYM_F_ALIAS))
 			{
-			if((s->msk & (LXT2_WR_GRAN_1VAL<<lt->timepos)) == LXT2_WR_GRAN_0VAL)
-				{
-				s->msk |= (LXT2_WR_GRAN_1VAL<<lt->timepos);
-				s->chg[s->chgpos] = LXT2_WR_ENC_BLACKOUT;
-
-				s->chgpos++;
-				}
-				else
-				{
-				s->chg[s->chgpos-1] = LXT2_WR_ENC_BLACKOUT;
-				}
+			lxt2_wr_granule_chg(lt, s, LXT2_WR_ENC_BLACKOUT);
 			}
 
 		s=s->symchain;
@@ -2079,6 +2847,8 @@ if((lt)&&(lt->blackout))
 			        {
 				if(!(s->flags&LXT2_WR_SYM_F_STRING))
 					{
+					s->packed = 0;
+					s->value_stale = 0;
 					s->value[0] = '-';		/* will cause mismatch then flush */
 				        for(i=1;i<s->len;i++)
 				                {
@@ -2150,6 +2920,8 @@ if(lt)
  */
 void lxt2_wr_close(struct lxt2_wr_trace *lt)
 {
+int i;
+
 if(lt)
 	{
 	if(lt->granule_dirty)
@@ -2158,6 +2930,25 @@ if(lt)
 		lxt2_wr_flush_granule(lt, 1);
 		}
 
+	lxt2_wr_granule_stop(lt);
+	lxt2_wr_zpool_stop(lt);
+	for(i=0;i<2;i++)
+		{
+		free(lt->gran[i].facnum);
+		free(lt->gran[i].msk);
+		free(lt->gran[i].lastlog);
+		free(lt->gran[i].log_slot);
+		free(lt->gran[i].log_idx);
+		free(lt->gran[i].dirty);
+		free(lt->gran[i].order);
+		free(lt->gran[i].chgpos);
+		free(lt->gran[i].chg);
+		free(lt->gran[i].mapval);
+		lxt2_wr_dict_free(&lt->dicts[i]);
+		}
+	free(lt->mapdict.table);
+	free(lt->mapdict.items);
+
 	if(lt->symchain)
 		{
 		struct lxt2_wr_symbol *s = lt->symchain;
@@ -2167,6 +2958,7 @@ if(lt)
 			{
 			free(s->name);
 			free(s->value);
+			free(s->pval);
 			s2=s->symchain;
 			free(s);
 			s=s2;
@@ -2175,6 +2967,7 @@ if(lt)
 		lt->symchain=NULL;
 		}
 
+	free(lt->sym);
 	free(lt->lxtname);
 	free(lt->sorted_facs);
 	fclose(lt->handle);
@@ -2196,6 +2989,56 @@ if(lt)
 }
 
 
+/*
+ * enable/disable compressing and writing granules on a separate thread
+ */
+void lxt2_wr_set_thread_off(struct lxt2_wr_trace *lt)
+{
+if(lt)
+	{
+	lxt2_wr_granule_stop(lt);
+	lt->use_thread = 0;
+	}
+}
+
+void lxt2_wr_set_thread_on(struct lxt2_wr_trace *lt)
+{
+if(lt)
+	{
+	lt->use_thread = 1;
+	}
+}
+
+
+
+/*
+ * compress the sections of a partial-zip granule on this many threads
+ */
+void lxt2_wr_set_partial_threads(struct lxt2_wr_trace *lt, unsigned int nthreads)
+{
+if((lt)&&(!lt->zpool))
+	{
+	lt->zthreads = nthreads ? nthreads : 1;
+	}
+}
+
+
+/*
+ * blocks written so far and their un/compressed sizes
+ */
+void lxt2_wr_get_stats(struct lxt2_wr_trace *lt, unsigned int *nblocks, off_t *unpacked, off_t *packed)
+{
+if(lt)
+	{
+	if(lt->gran_running) pthread_mutex_lock(&lt->gran_lock);
+	*nblocks = lt->stat_blocks;
+	*unpacked = lt->stat_unpacked;
+	*packed = lt->stat_packed;
+	if(lt->gran_running) pthread_mutex_unlock(&lt->gran_lock);
+	}
+}
+
+
 /*
  * time zero offset
  */
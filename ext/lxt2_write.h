@@ -34,6 +34,7 @@ extern "C" {
 #include <errno.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <zlib.h>
 
 #ifndef HAVE_FSEEKO
@@ -53,7 +54,6 @@ extern "C" {
 #define LXT2_WR_GRAN_SECT_TIME_PARTIAL 2
 
 #define LXT2_WR_GZWRITE_BUFFER 4096
-#define LXT2_WR_SYMPRIME 500009
 
 typedef uint64_t lxttime_t;
 typedef  int64_t lxtstime_t;
@@ -112,26 +112,101 @@ enum LXT2_WR_Encodings {
 	};
 
 /*
- * integer splay
+ * value string dictionary: hash table over entries kept in insertion
+ * order, with the strings in an arena that is reused for every block
  */
-typedef struct lxt2_wr_ds_tree_node lxt2_wr_ds_Tree;
-struct lxt2_wr_ds_tree_node {
-    lxt2_wr_ds_Tree * left, * right;
-    granmsk_t item;
-    int val;
-    lxt2_wr_ds_Tree * next;
+struct lxt2_wr_arena
+{
+struct lxt2_wr_arena *next;
+size_t size, used;
+};
+
+struct lxt2_wr_dict_entry
+{
+char *item;
+unsigned int len;
+unsigned int hv;
+};
+
+struct lxt2_wr_dict
+{
+unsigned int *table;			/* entry number + 1, 0 = empty */
+unsigned int table_size;		/* power of two */
+struct lxt2_wr_dict_entry *entries;
+unsigned int num_entries, max_entries;
+unsigned int string_mem_required;
+struct lxt2_wr_arena *arena, *arena_curr;
+};
+
+
+/*
+ * granule bitmap dictionary
+ */
+struct lxt2_wr_mapdict
+{
+unsigned int *table;
+unsigned int table_size;
+granmsk_t *items;
+unsigned int num_entries, max_entries;
+int zero_val;				/* number of the empty bitmap, -1 if not in yet */
+};
+
+
+/*
+ * a partial-zip section: encoded in order, compressed on any thread
+ */
+struct lxt2_wr_zsect
+{
+unsigned char *raw;
+size_t raw_len, raw_alloc;
+size_t *syncs;				/* raw offsets where gzflush() would sync */
+unsigned int nsyncs, syncs_alloc;
+unsigned char *z;
+size_t z_len, z_alloc;
+unsigned int iter;			/* first fac of the section */
+unsigned int unclen;
 };
 
 
 /*
- * string splay
+ * one granule of change data handed off to be encoded and compressed
  */
-typedef struct lxt2_wr_dslxt_tree_node lxt2_wr_dslxt_Tree;
-struct lxt2_wr_dslxt_tree_node {
-    lxt2_wr_dslxt_Tree * left, * right;
-    char *item;
-    unsigned int val;
-    lxt2_wr_dslxt_Tree * next;
+struct lxt2_wr_granule
+{
+unsigned int numfacs;
+
+/* facs that changed in this granule, by slot */
+unsigned int ndirty, max_dirty;
+unsigned int *facnum;
+granmsk_t *msk;
+unsigned int *lastlog;			/* log position of the latest change, rank once sorted */
+uint64_t *dirty;			/* bit per facnum */
+unsigned int dirty_words;
+
+/* value changes in the order they were made */
+unsigned int nlog, max_log;
+unsigned int *log_slot;
+unsigned int *log_idx;
+
+/* at flush: slots in facnum order, and their changes grouped to match */
+unsigned int *order;
+unsigned int *chgpos;			/* per rank (+1) offset into chg */
+unsigned int *chg;
+unsigned int *mapval;			/* per rank, filled in by the writer */
+
+unsigned int timepos;
+lxttime_t timetable[LXT2_WR_GRANULE_SIZE];
+unsigned int num_dict_entries;		/* sizes the change indices */
+
+char zmode[4];				/* compression depth when queued */
+unsigned int partial_iter;
+unsigned using_partial : 1;
+unsigned using_partial_zip : 1;
+unsigned first : 1;			/* first granule in the block */
+unsigned last : 1;			/* emit the block trailer after it */
+
+struct lxt2_wr_dict *dict;		/* trailer only */
+lxttime_t firsttime, lasttime;
 };
 
 
@@ -140,23 +215,20 @@ struct lxt2_wr_trace
 FILE *handle;
 gzFile zhandle;
 
-lxt2_wr_dslxt_Tree *dict;	/* dictionary manipulation */
-unsigned int num_dict_entries;
-unsigned int dict_string_mem_required;
-lxt2_wr_dslxt_Tree *dict_head;
-lxt2_wr_dslxt_Tree *dict_curr;
+struct lxt2_wr_dict *dict;	/* dictionary manipulation, one of dicts[] */
+struct lxt2_wr_dict dicts[2];	/* the other one may be with the writer */
 
-lxt2_wr_ds_Tree *mapdict;	/* bitmap compression */
-unsigned int num_map_entries;
-lxt2_wr_ds_Tree *mapdict_head;
-lxt2_wr_ds_Tree *mapdict_curr;
+struct lxt2_wr_mapdict mapdict;	/* bitmap compression */
 
 off_t position;
 off_t zfacname_predec_size, zfacname_size, zfacgeometry_size;
 off_t zpackcount, zpackcount_cumulative;
 off_t current_chunk, current_chunkz;
+off_t stat_unpacked, stat_packed;	/* totals over finished blocks */
+unsigned int stat_blocks;
 
-struct lxt2_wr_symbol *sym[LXT2_WR_SYMPRIME];
+struct lxt2_wr_symbol **sym;		/* hash buckets, grown as symbols are added */
+unsigned int sym_size, sym_count;
 struct lxt2_wr_symbol **sorted_facs;
 struct lxt2_wr_symbol *symchain;
 unsigned int numfacs, numalias;
@@ -204,6 +276,30 @@ char *lxtname;
 off_t break_size;
 off_t break_header_size;
 unsigned int break_number;
+
+struct lxt2_wr_granule gran[2];		/* filled alternately */
+struct lxt2_wr_granule *gcur;		/* the one being filled */
+int gran_fill;
+struct lxt2_wr_granule *gran_queued;	/* waiting for the thread */
+struct lxt2_wr_granule *gran_busy;	/* being written by the thread */
+pthread_t gran_thread;
+pthread_mutex_t gran_lock;
+pthread_cond_t gran_cv;
+int use_thread;
+int gran_running;
+int gran_stop;				/* under gran_lock */
+
+struct lxt2_wr_zsect *zsect;		/* partial-zip sections of the current granule */
+unsigned int zsect_alloc;
+struct lxt2_wr_zsect *zcapture;		/* section gz output goes to instead of zhandle */
+unsigned int zthreads;			/* threads compressing sections, including the writer */
+pthread_t *zpool;
+unsigned int zpool_size;		/* workers started */
+pthread_mutex_t zlock;
+pthread_cond_t zcv, zdone_cv;
+unsigned int zjobs, znext, zdone;	/* under zlock */
+int zlevel;
+int zstop;
 };
 
 
@@ -214,6 +310,7 @@ struct lxt2_wr_symbol *symchain;
 char *name;
 int namlen;
 
+unsigned int hv;			/* name hash */
 int facnum;
 struct lxt2_wr_symbol *aliased_to;
 
@@ -225,10 +322,13 @@ int len;
 int flags;
 
 unsigned partial_preference : 1;	/* in order to shove nets to the first partial group */
+char initial_value;			/* 0 for doubles */
+unsigned packed : 1;			/* pval holds the current value */
+unsigned value_stale : 1;		/* value string lags behind pval */
 
-unsigned int chgpos;
-granmsk_t msk;				/* must contain LXT2_WR_GRANULE_SIZE bits! */
-unsigned int chg[LXT2_WR_GRANULE_SIZE];
+unsigned long *pval;			/* packed value: value words then x/z words, lsb first */
+
+int gslot;				/* slot in the granule being filled, -1 if unchanged */
 };
 
 
@@ -277,6 +377,12 @@ void			lxt2_wr_set_partial_preference(struct lxt2_wr_trace *lt, const char *name
 void			lxt2_wr_set_checkpoint_off(struct lxt2_wr_trace *lt);
 void			lxt2_wr_set_checkpoint_on(struct lxt2_wr_trace *lt);
 
+			/* compress and write granules on a background thread (default off) */
+void			lxt2_wr_set_thread_off(struct lxt2_wr_trace *lt);
+void			lxt2_wr_set_thread_on(struct lxt2_wr_trace *lt);
+			/* number of threads compressing partial-zip sections of a granule (default 1) */
+void			lxt2_wr_set_partial_threads(struct lxt2_wr_trace *lt, unsigned int nthreads);
+
 			/* facility creation */
 void                    lxt2_wr_set_initial_value(struct lxt2_wr_trace *lt, char value);
 struct lxt2_wr_symbol *	lxt2_wr_symbol_find(struct lxt2_wr_trace *lt, const char *name);
@@ -287,6 +393,9 @@ void			lxt2_wr_symbol_bracket_stripping(struct lxt2_wr_trace *lt, int doit);
 			/* each granule is LXT2_WR_GRANULE_SIZE (32 or 64) timesteps, default is 256 per section */
 void 			lxt2_wr_set_maxgranule(struct lxt2_wr_trace *lt, unsigned int maxgranule);
 
+			/* finished blocks and their total uncompressed/compressed sizes */
+void			lxt2_wr_get_stats(struct lxt2_wr_trace *lt, unsigned int *nblocks, off_t *unpacked, off_t *packed);
+
 			/* time ops */
 void 			lxt2_wr_set_timescale(struct lxt2_wr_trace *lt, int timescale);
 void 			lxt2_wr_set_timezero(struct lxt2_wr_trace *lt, lxtstime_t timeval);
@@ -305,6 +414,9 @@ int 			lxt2_wr_emit_value_double(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol
 int 			lxt2_wr_emit_value_string(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s, unsigned int row, char *value);
 int 			lxt2_wr_emit_value_bit_string(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s, unsigned int row, char *value);
 
+			/* packed form of bit_string: ceil(len/64) words lsb first, bits set in xzmask (optional) are x when 0 and z when 1 */
+int 			lxt2_wr_emit_value_bits(struct lxt2_wr_trace *lt, struct lxt2_wr_symbol *s, unsigned int row, unsigned long *bits, unsigned long *xzmask);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,16 +5,46 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "ext/lxt2_write.h"
 #include "tracelib.h"
 
 
 struct local_lxt2_state {
+  int _reader;			/* 0: shares lxt2_close with the reader */
   float _last_time;
   float _ts;
   struct lxt2_wr_trace *f;
+
+  /* integer time (alt) interface */
+  unsigned long _last_tm;
+  unsigned long _mult;		/* file time units per integer time step */
+  unsigned int _warned:1;	/* warned about time overflow */
+
+  /* autotune: adjust the compression depth over the first few blocks */
+  unsigned int _tune:2;		/* 0 = off, 1 = events/s, 2 = ratio */
+  double _tune_target;
+  int _depth;
+  int _tune_steps;
+  unsigned long _nevents;
+  unsigned long _tune_ev0;
+  double _tune_t0;
+  unsigned int _tune_blocks;
+  off_t _tune_unpacked, _tune_packed;
 };
+
+struct local_lxt2_reader;
+static int _rd_set_option (struct local_lxt2_reader *, const char *,
+			   const char *);
+
+#define LXT2_TUNE_STEPS 8	/* blocks to measure before settling */
+#define LXT2_TUNE_CHECK 0xfff	/* look at the block count every 4096 events */
   
 
 void *lxt2_create (const  char *nm, float stop_time, float ts)
@@ -23,6 +53,7 @@ void *lxt2_create (const  char *nm, float stop_time, float ts)
   struct lxt2_wr_trace *f;
   int il10;
   double l10;
+  long ncpu;
   
   f = lxt2_wr_init (nm);
   l10 = log10 (ts);
@@ -34,14 +65,29 @@ void *lxt2_create (const  char *nm, float stop_time, float ts)
   lxt2_wr_set_break_size (f, 0);
   lxt2_wr_set_maxgranule (f, 8);
   lxt2_wr_set_timescale (f, il10);
+  lxt2_wr_set_thread_on (f);
+
+  /* wide designs: sections of a granule are compressed in parallel */
+  ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+  if (ncpu > 32) {
+    ncpu = 32;
+  }
+  lxt2_wr_set_partial_on (f, 1);
+  lxt2_wr_set_partial_threads (f, ncpu > 1 ? ncpu : 1);
 
   st = (struct local_lxt2_state *) malloc (sizeof (struct local_lxt2_state));
   if (!st) {
     fprintf (stderr, "Failed to allocate %lu bytes\n", sizeof (struct local_lxt2_state));
     exit (1);
   }
+  st->_reader = 0;
   st->f = f;
   st->_last_time = -1;
+  st->_last_tm = 0;
+  st->_warned = 0;
+  st->_tune = 0;
+  st->_depth = 4;
+  st->_nevents = 0;
   st->_ts = 1;
   if (il10 >= 0) {
     while (il10 > 0) {
@@ -55,9 +101,238 @@ void *lxt2_create (const  char *nm, float stop_time, float ts)
       il10++;
     }
   }
+  /* the timescale is ts rounded down to a power of ten */
+  st->_mult = (unsigned long) (ts/st->_ts + 0.5);
+  if (st->_mult == 0) {
+    st->_mult = 1;
+  }
   return st;
 }
 
+void *lxt2_create_alt (const  char *nm, float stop_time, float ts)
+{
+  return lxt2_create (nm, stop_time, ts);
+}
+
+static double _now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/*
+  Each time a block is finished, compare the events/s or compression
+  ratio seen since the previous one against the target and move the
+  compression depth by one. With the granule thread on, the block
+  just finished may still have been compressed at the older depth, so
+  this settles over a few blocks rather than in one step.
+*/
+static void _autotune (struct local_lxt2_state *st)
+{
+  unsigned int nblocks;
+  off_t unpacked, packed;
+  double t, rate, ratio;
+  int depth;
+
+  st->_nevents++;
+  if ((st->_nevents & LXT2_TUNE_CHECK) != 0) {
+    return;
+  }
+  lxt2_wr_get_stats (st->f, &nblocks, &unpacked, &packed);
+  if (nblocks == st->_tune_blocks) {
+    return;
+  }
+  t = _now ();
+  depth = st->_depth;
+  if (st->_tune == 1) {
+    rate = (st->_nevents - st->_tune_ev0)/(t - st->_tune_t0 + 1e-9);
+    if (rate < st->_tune_target && depth > 1) {
+      depth--;
+    }
+    else if (rate > 2*st->_tune_target && depth < 9) {
+      depth++;
+    }
+  }
+  else {
+    ratio = (double)(unpacked - st->_tune_unpacked)/
+      (packed - st->_tune_packed + 1);
+    if (ratio < st->_tune_target && depth < 9) {
+      depth++;
+    }
+    else if (ratio > 1.25*st->_tune_target && depth > 1) {
+      depth--;
+    }
+  }
+  if (depth != st->_depth) {
+    st->_depth = depth;
+    lxt2_wr_set_compression_depth (st->f, depth);
+  }
+  st->_tune_blocks = nblocks;
+  st->_tune_unpacked = unpacked;
+  st->_tune_packed = packed;
+  st->_tune_ev0 = st->_nevents;
+  st->_tune_t0 = t;
+  if (++st->_tune_steps == LXT2_TUNE_STEPS) {
+    st->_tune = 0;
+  }
+}
+
+#define TUNE(st) do { if ((st)->_tune) _autotune (st); } while (0)
+
+static int _on_off (const char *value)
+{
+  if (!strcmp (value, "1") || !strcmp (value, "on")) {
+    return 1;
+  }
+  if (!strcmp (value, "0") || !strcmp (value, "off")) {
+    return 0;
+  }
+  return -1;
+}
+
+/*
+  Options:
+     depth       zlib compression level, 0-9 (default 4)
+     maxgranule  granules per block, 0 for unlimited (default 8)
+     break       start a new file once this many bytes are written, 0
+                 to disable (default 0)
+     partial     on, off, or zip: split blocks into groups of signals
+                 for faster reads; zip compresses each group
+                 separately, in parallel (default zip)
+     zthreads    threads compressing zip groups (default: #cpus)
+     checkpoint  on or off: dump all values at the start of each block
+                 (default on)
+     thread      on or off: compress on a separate thread (default on)
+     autotune    rate=<events/s>, ratio=<x>, or off: adjust depth over
+                 the first few blocks to meet the target
+
+  partial, zthreads, checkpoint and thread must be set before the
+  first value change.
+
+  Reader options:
+     cache       megabytes of decoded blocks kept per file, for seeking
+                 back and for its other cursors (default 64)
+
+  Returns 1 if the option was applied, 0 otherwise.
+*/
+int lxt2_set_option (void *handle, const char *key, const char *value)
+{
+  struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+  char *end;
+  long v;
+  int b;
+
+  if (!key || !value) {
+    return 0;
+  }
+  if (st->_reader) {
+    return _rd_set_option ((struct local_lxt2_reader *)handle, key, value);
+  }
+
+  if (!strcmp (key, "depth") || !strcmp (key, "maxgranule")
+      || !strcmp (key, "break")) {
+    v = strtol (value, &end, 10);
+    if (end == value || *end || v < 0) {
+      fprintf (stderr, "WARNING: lxt2: bad value `%s' for option `%s'\n",
+	       value, key);
+      return 0;
+    }
+    if (key[0] == 'd') {
+      st->_depth = (v > 9 ? 9 : v);
+      lxt2_wr_set_compression_depth (st->f, st->_depth);
+    }
+    else if (key[0] == 'm') {
+      lxt2_wr_set_maxgranule (st->f, v);
+    }
+    else {
+      lxt2_wr_set_break_size (st->f, v);
+    }
+    return 1;
+  }
+
+  if (!strcmp (key, "autotune")) {
+    if (!strcmp (value, "off")) {
+      st->_tune = 0;
+      return 1;
+    }
+    if (!strncmp (value, "rate=", 5)) {
+      b = 1;
+    }
+    else if (!strncmp (value, "ratio=", 6)) {
+      b = 2;
+    }
+    else {
+      b = 0;
+    }
+    if (b) {
+      st->_tune_target = strtod (strchr (value, '=') + 1, &end);
+    }
+    if (!b || *end || st->_tune_target <= 0) {
+      fprintf (stderr, "WARNING: lxt2: bad value `%s' for option `%s'\n",
+	       value, key);
+      return 0;
+    }
+    st->_tune = b;
+    st->_tune_steps = 0;
+    lxt2_wr_get_stats (st->f, &st->_tune_blocks, &st->_tune_unpacked,
+		       &st->_tune_packed);
+    st->_tune_ev0 = st->_nevents;
+    st->_tune_t0 = _now ();
+    return 1;
+  }
+
+  if (strcmp (key, "partial") && strcmp (key, "checkpoint")
+      && strcmp (key, "thread") && strcmp (key, "zthreads")) {
+    return 0;
+  }
+  if (st->_last_time >= 0) {
+    fprintf (stderr, "WARNING: lxt2: option `%s' must be set before any value changes\n", key);
+    return 0;
+  }
+  if (key[0] == 'z') {
+    v = strtol (value, &end, 10);
+    if (end == value || *end || v < 1) {
+      fprintf (stderr, "WARNING: lxt2: bad value `%s' for option `%s'\n",
+	       value, key);
+      return 0;
+    }
+    lxt2_wr_set_partial_threads (st->f, v);
+    return 1;
+  }
+  b = _on_off (value);
+  if (b < 0 && !(key[0] == 'p' && !strcmp (value, "zip"))) {
+    fprintf (stderr, "WARNING: lxt2: bad value `%s' for option `%s'\n",
+	     value, key);
+    return 0;
+  }
+  if (key[0] == 'p') {
+    if (b == 0) {
+      lxt2_wr_set_partial_off (st->f);
+    }
+    else {
+      lxt2_wr_set_partial_on (st->f, b < 0);
+    }
+  }
+  else if (key[0] == 'c') {
+    if (b) {
+      lxt2_wr_set_checkpoint_on (st->f);
+    }
+    else {
+      lxt2_wr_set_checkpoint_off (st->f);
+    }
+  }
+  else {
+    if (b) {
+      lxt2_wr_set_thread_on (st->f);
+    }
+    else {
+      lxt2_wr_set_thread_off (st->f);
+    }
+  }
+  return 1;
+}
+
 int lxt2_signal_start (void *handle)
 {
   return 1;
@@ -117,102 +392,100 @@ int lxt2_init_end (void *handle)
 
 
 
-static char *_local_bits = NULL;
-static int _iwidth = 0;
-static char *_getbits (int width, unsigned long v)
+static unsigned long *_local_words = NULL;
+static int _nwords = 0;
+
+/* wide values with fewer words than the signal needs are zero-extended */
+static unsigned long *_getwords (struct lxt2_wr_symbol *s, int len,
+				 unsigned long *v)
 {
-  if (width < 0) {
-    width = -width;
+  int nw = (s->len + 63)/64;
+  int i;
+
+  if (len >= nw) {
+    return v;
   }
-  
-  if (_iwidth <= width+1) {
-    if (_iwidth == 0) {
-      _iwidth = width + 1;
-      if (_iwidth < 65) {
-	_iwidth = 65;
-      }
-      _local_bits = (char *) malloc (_iwidth);
-    }
-    else {
-      _iwidth = width + 32;
-      _local_bits = (char *) realloc (_local_bits, _iwidth);
-    }
-    if (!_local_bits) {
-      fprintf (stderr, "FATAL: could not allocate %d bytes\n", _iwidth);
+  if (_nwords < nw) {
+    _nwords = nw;
+    _local_words = (unsigned long *)
+      realloc (_local_words, sizeof (unsigned long)*_nwords);
+    if (!_local_words) {
+      fprintf (stderr, "FATAL: could not allocate %d words\n", _nwords);
       exit (1);
     }
   }
+  for (i=0; i < nw; i++) {
+    _local_words[i] = (i < len) ? v[i] : 0;
+  }
+  return _local_words;
+}
 
-  if (width == 1) {
-    if (v == ACT_SIG_BOOL_FALSE) {
-      _local_bits[0] = '0';
-    }
-    else if (v == ACT_SIG_BOOL_TRUE) {
-      _local_bits[0] = '1';
-    }
-    else if (v == ACT_SIG_BOOL_X) {
-      _local_bits[0] = 'x';
-    }
-    else if (v == ACT_SIG_BOOL_Z) {
-      _local_bits[0] = 'z';
-    }
-    _local_bits[1] = '\0';
+static void _emit_small (struct lxt2_wr_trace *f,
+			 struct lxt2_wr_symbol *s, unsigned long v)
+{
+  if (s->len == 1) {
+    /* ACT_SIG_BOOL_X and ACT_SIG_BOOL_Z set bit 1 */
+    unsigned long b = v & 1;
+    unsigned long xz = (v >> 1) & 1;
+    lxt2_wr_emit_value_bits (f, s, 0, &b, &xz);
   }
   else {
-    int i;
-    for (i = width-1; i >= 0; i--) {
-      _local_bits[i] = '0' + (v & 1);
-      v >>= 1;
-    }
-    _local_bits[width] = '\0';
+    /* zero-extended to the width of the signal */
+    lxt2_wr_emit_value_bits (f, s, 0, _getwords (s, 1, &v), NULL);
+  }
+}
+
+static char _chan_idle[] = "z";
+static char _chan_recv_blocked[] = "z01";
+static char _chan_send_blocked[] = "z10";
+
+static char *_chan_state_str (struct lxt2_wr_symbol *s, act_chan_state_t state)
+{
+  if (s->len < 3 || state == ACT_CHAN_IDLE) {
+    return _chan_idle;
+  }
+  else if (state == ACT_CHAN_RECV_BLOCKED) {
+    return _chan_recv_blocked;
+  }
+  else {
+    /* send blocked */
+    return _chan_send_blocked;
   }
-  return _local_bits;
 }
 
-static char *_getlongbits (int width, int len, unsigned long *v)
+
+/*
+  Integer times are in units of ts. LXT2 times are 64 bits wide, so
+  times that need more than tm[0] (or overflow when scaled to the
+  file timescale) are clamped to the largest representable time
+  after a one-time warning; that keeps the trace monotonic.
+*/
+static void _set_time_alt (struct local_lxt2_state *st,
+			   int len, unsigned long *tm)
 {
+  unsigned long t = tm[0];
   int i;
-  unsigned long val;
-  int pos;
 
-  if (width < 0) {
-    width = -width;
-  }
-  
-  if (_iwidth <= width+1) {
-    if (_iwidth == 0) {
-      _iwidth = width + 1;
-      if (_iwidth < 65) {
-	_iwidth = 65;
-      }
-      _local_bits = (char *) malloc (_iwidth);
-    }
-    else {
-      _iwidth = width + 32;
-      _local_bits = (char *) realloc (_local_bits, _iwidth);
-    }
-    if (!_local_bits) {
-      fprintf (stderr, "FATAL: could not allocate %d bytes\n", _iwidth);
-      exit (1);
+  for (i=1; i < len; i++) {
+    if (tm[i] != 0) {
+      break;
     }
   }
-  val = v[0];
-  pos = 0;
-  for (i = width-1; i >= 0; i--) {
-    _local_bits[i] = '0' + (val & 1);
-    val >>= 1;
-    pos++;
-    if (pos % 64 == 0) {
-      if (pos/64 >= len) {
-	val = 0;
-      }
-      else {
-	val = v[pos/64];
-      }
+  if (i < len || (st->_mult > 1 && t > ~0UL/st->_mult)) {
+    if (!st->_warned) {
+      fprintf (stderr, "WARNING: lxt2: time exceeds 64 bits; clamping\n");
+      st->_warned = 1;
     }
+    t = ~0UL;
+  }
+  else {
+    t *= st->_mult;
+  }
+  if (st->_last_time < 0 || t != st->_last_tm) {
+    lxt2_wr_set_time64 (st->f, t);
+    st->_last_tm = t;
+    st->_last_time = 0;
   }
-  _local_bits[width] = '\0';
-  return _local_bits;
 }
 
 
@@ -225,8 +498,9 @@ int lxt2_change_digital (void *handle, void *node, float t, unsigned long v)
     lxt2_wr_set_time64 (st->f, (unsigned long) (t/st->_ts));
     st->_last_time = t;
   }
+  TUNE (st);
 
-  lxt2_wr_emit_value_bit_string (st->f, s, 0, _getbits (s->msb - s->lsb + 1,v));
+  _emit_small (st->f, s, v);
 
   return 1;
 }
@@ -239,6 +513,7 @@ int lxt2_change_analog (void *handle, void *node, float t, float v)
     lxt2_wr_set_time64 (st->f, (unsigned long) (t/st->_ts));
     st->_last_time = t;
   }
+  TUNE (st);
   
   lxt2_wr_emit_value_double (st->f, (struct lxt2_wr_symbol *) node, 0, v);
   
@@ -254,16 +529,13 @@ int lxt2_change_wide_digital (void *handle, void *node, float t, int len, unsign
     lxt2_wr_set_time64 (st->f, (unsigned long) (t/st->_ts));
     st->_last_time = t;
   }
+  TUNE (st);
   
-  lxt2_wr_emit_value_bit_string (st->f, s, 0, _getlongbits (s->msb - s->lsb + 1,
-							    len, v));
-    
+  lxt2_wr_emit_value_bits (st->f, s, 0, _getwords (s, len, v), NULL);
 
   return 1;
 }
 
-#define ABS(x) ((x) < 0 ? -(x) : (x))
-
 int lxt2_change_chan (void *handle, void *node, float t,
 		      act_chan_state_t state, unsigned long v)
 {
@@ -274,27 +546,12 @@ int lxt2_change_chan (void *handle, void *node, float t,
     lxt2_wr_set_time64 (st->f, (unsigned long) (t/st->_ts));
     st->_last_time = t;
   }
+  TUNE (st);
   if (state == ACT_CHAN_VALUE) {
-    lxt2_wr_emit_value_bit_string (st->f, s, 0, _getbits (s->msb - s->lsb + 1,v));
+    _emit_small (st->f, s, v);
   }
   else {
-    char buf[4];
-    if (ABS(s->msb - s->lsb + 1) >= 3) {
-      if (state == ACT_CHAN_IDLE) {
-	snprintf (buf, 4, "z");
-      }
-      else if (state == ACT_CHAN_RECV_BLOCKED) {
-	snprintf (buf, 4, "z01");
-      }
-      else {
-	/* send blocked */
-	snprintf (buf, 4, "z10");
-      }
-    }
-    else {
-      snprintf (buf, 4, "z");
-    }
-    lxt2_wr_emit_value_bit_string (st->f, s, 0, buf);
+    lxt2_wr_emit_value_bit_string (st->f, s, 0, _chan_state_str (s, state));
   }
   return 1;
 }
@@ -310,31 +567,2276 @@ int lxt2_change_wide_chan (void *handle, void *node, float t,
     lxt2_wr_set_time64 (st->f, (unsigned long) (t/st->_ts));
     st->_last_time = t;
   }
+  TUNE (st);
 
   if (state == ACT_CHAN_VALUE) {
-    lxt2_wr_emit_value_bit_string (st->f, s, 0, _getlongbits (s->msb - s->lsb + 1,
-							      len, v));
+    lxt2_wr_emit_value_bits (st->f, s, 0, _getwords (s, len, v), NULL);
   }
   else {
-    char buf[4];
-    if (state == ACT_CHAN_IDLE) {
-      snprintf (buf, 4, "z");
-    }
-    else if (state == ACT_CHAN_RECV_BLOCKED) {
-      snprintf (buf, 4, "z01");
-    }
-    else {
-      /* send blocked */
-      snprintf (buf, 4, "z10");
-    }
-    lxt2_wr_emit_value_bit_string (st->f, s, 0, buf);
+    lxt2_wr_emit_value_bit_string (st->f, s, 0, _chan_state_str (s, state));
   }
   return 1;
 }
 
-int lxt2_close (void *handle)
+int lxt2_change_digital_alt (void *handle, void *node, int len,
+			     unsigned long *tm, unsigned long v)
+{
+  struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+
+  _set_time_alt (st, len, tm);
+  TUNE (st);
+  _emit_small (st->f, (struct lxt2_wr_symbol *)node, v);
+
+  return 1;
+}
+
+int lxt2_change_analog_alt (void *handle, void *node, int len,
+			    unsigned long *tm, float v)
+{
+  struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+
+  _set_time_alt (st, len, tm);
+  TUNE (st);
+  lxt2_wr_emit_value_double (st->f, (struct lxt2_wr_symbol *) node, 0, v);
+
+  return 1;
+}
+
+int lxt2_change_wide_digital_alt (void *handle, void *node, int len,
+				  unsigned long *tm,
+				  int lenv, unsigned long *v)
+{
+  struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+  struct lxt2_wr_symbol *s = (struct lxt2_wr_symbol *)node;
+
+  _set_time_alt (st, len, tm);
+  TUNE (st);
+  lxt2_wr_emit_value_bits (st->f, s, 0, _getwords (s, lenv, v), NULL);
+
+  return 1;
+}
+
+int lxt2_change_chan_alt (void *handle, void *node, int len,
+			  unsigned long *tm,
+			  act_chan_state_t state, unsigned long v)
 {
   struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+  struct lxt2_wr_symbol *s = (struct lxt2_wr_symbol *)node;
+
+  _set_time_alt (st, len, tm);
+  TUNE (st);
+  if (state == ACT_CHAN_VALUE) {
+    _emit_small (st->f, s, v);
+  }
+  else {
+    lxt2_wr_emit_value_bit_string (st->f, s, 0, _chan_state_str (s, state));
+  }
+  return 1;
+}
+
+int lxt2_change_wide_chan_alt (void *handle, void *node, int len,
+			       unsigned long *tm,
+			       act_chan_state_t state,
+			       int lenv, unsigned long *v)
+{
+  struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+  struct lxt2_wr_symbol *s = (struct lxt2_wr_symbol *)node;
+
+  _set_time_alt (st, len, tm);
+  TUNE (st);
+  if (state == ACT_CHAN_VALUE) {
+    lxt2_wr_emit_value_bits (st->f, s, 0, _getwords (s, lenv, v), NULL);
+  }
+  else {
+    lxt2_wr_emit_value_bit_string (st->f, s, 0, _chan_state_str (s, state));
+  }
+  return 1;
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Reader
+ *
+ *  Blocks are independent gzip streams (or, in partial-zip mode, runs
+ *  of them), so they are inflated and parsed on worker threads a few
+ *  blocks ahead of the reader. Parsing keeps only the changes of the
+ *  signals that were looked up, as a time-ordered event list per
+ *  block; the encodings are relative to the previous value, so they
+ *  are applied in order on the calling thread.
+ *
+ *  Several cursors can read one file (lxt2_cursor()). They share the
+ *  file's tables and a size-bounded cache of decoded blocks, and keep
+ *  their own time, values and workers.
+ *
+ *------------------------------------------------------------------------
+ */
+
+enum { LXT2_BLK_FREE, LXT2_BLK_BUSY, LXT2_BLK_READY };
+
+#define LXT2_RD_SNAPS 32	/* signal states kept at block starts */
+#define LXT2_RD_CACHE_MB 64	/* decoded blocks kept per file, default */
+#define LXT2_RD_SPARE 4		/* evicted blocks kept for their buffers */
+
+struct lxt2_rd_block {
+  size_t off;			/* payload offset in the file */
+  unsigned long clen;		/* payload length */
+  unsigned long unclen;		/* inflated length */
+  lxttime_t t0, t1;
+};
+
+/* what the values of one signal in a block can be, so that searches
+   can pass over blocks without looking at their events */
+#define LXT2_RD_SEEN_0		0x01
+#define LXT2_RD_SEEN_1		0x02
+#define LXT2_RD_SEEN_X		0x04
+#define LXT2_RD_SEEN_Z		0x08
+#define LXT2_RD_SEEN_VAL	0x10	/* a value without x or z */
+
+struct lxt2_rd_sum {
+  unsigned long nev;		/* changes in the block */
+  unsigned int any:1;		/* relative or wide values: no bounds */
+  unsigned int bounded:1;	/* min/max are set */
+  unsigned int seen;		/* LXT2_RD_SEEN_... */
+  unsigned long min, max;	/* digital values, x and z read as 0 */
+  float rmin, rmax;		/* analog values */
+};
+
+/* a decoded block; read-only once ready, and shared by the cursors of
+   a file through its cache */
+struct lxt2_rd_dec {
+  long blk;
+  unsigned long gen;		/* has the signals of this generation */
+  int state;			/* LXT2_BLK_BUSY or LXT2_BLK_READY */
+  int refs;			/* ring slots and callers using it */
+  unsigned long used;		/* for LRU replacement */
+  size_t bytes;			/* memory held, once ready */
+  struct lxt2_rd_dec *link;	/* in the cache or the spare list */
+
+  unsigned char *buf;
+  size_t maxbuf;
+  char **dict;			/* value strings of the block */
+  unsigned int maxdict;
+  granmsk_t *maps;
+  unsigned int maxmaps;
+
+  lxttime_t *ev_time;
+  int *ev_sig;
+  unsigned int *ev_code;
+  unsigned long nev, maxev;
+
+  struct lxt2_rd_sum *sum;	/* per signal; none past nsum */
+  int nsum, maxsum;
+
+  /* changes of the current granule, before sorting by time */
+  unsigned char *g_pos;
+  int *g_sig;
+  unsigned int *g_code;
+  unsigned long ng, maxg;
+};
+
+/* a block in a cursor's ring */
+struct lxt2_rd_slot {
+  int state;
+  long blk;
+  unsigned long next;		/* first event not yet applied */
+  struct lxt2_rd_dec *d;
+};
+
+/* the values of all signals before block blk is applied */
+struct lxt2_rd_snap {
+  long blk;			/* -1: unused */
+  unsigned long used;
+  int nsig;
+  char *bits;
+  size_t maxbits;
+  double *real;
+  int maxreal;
+};
+
+struct lxt2_rd_sig {
+  int fac;
+  int len;			/* bits */
+  unsigned int analog:1;
+  unsigned int dirty:1;		/* val needs to be recomputed */
+  unsigned int watch:1;		/* reported by lxt2_next_change */
+  char *bits;			/* current value, msb first */
+  double real;
+  act_signal_val_t val;
+  unsigned long *wide;
+};
+
+/*
+  The opened file, shared by all cursors on it. Signals are numbered
+  per file: a block is decoded once with the signals that any cursor
+  looked up, and each cursor applies the changes of its own. Adding a
+  signal starts a new generation; blocks of an older one lack it.
+*/
+struct lxt2_rd_file {
+  int refs;			/* cursors */
+
+  int fd;
+  unsigned char *map;
+  size_t maplen;
+
+  int gran;			/* timesteps per granule, 32 or 64 */
+  double ts;
+
+  unsigned int numfacs;		/* including aliases */
+  unsigned int nreal;		/* facs that have changes recorded */
+  char *namebuf;
+  unsigned int *name;		/* offset into namebuf */
+  int *root;			/* fac that an alias refers to */
+  int *flen;
+  unsigned int *fflags;
+  unsigned int *htab;		/* fac+1, 0 = empty */
+  unsigned int hsize;
+
+  struct lxt2_rd_block *blk;
+  long nblk, maxblk;
+
+  pthread_mutex_t lock;		/* for everything below */
+  pthread_cond_t cv;		/* a block was decoded */
+
+  int *req;			/* signal per fac, -1 if not looked up,
+				   then 1 per partial section with one;
+				   replaced, not changed, while busy */
+  unsigned int nreq;
+  int **oldreq;			/* earlier ones, still in use */
+  int noldreq;
+  int busy;			/* blocks being decoded */
+  unsigned long *sgen;		/* generation that added each signal */
+  int nsig, maxsig;
+  unsigned long gen;
+
+  struct lxt2_rd_dec *cache;	/* decoded blocks */
+  struct lxt2_rd_dec *spare;	/* evicted ones, to reuse their buffers */
+  int nspare;
+  size_t bytes, maxbytes;	/* held by ready blocks in the cache */
+  unsigned long clock;
+};
+
+/* a cursor: a position in the file and the values of its signals */
+struct local_lxt2_reader {
+  int _reader;			/* 1: shares lxt2_close with the writer */
+
+  struct lxt2_rd_file *f;
+  unsigned long gen;		/* blocks must have this generation */
+
+  struct lxt2_rd_sig *sig;	/* by file signal; NULL bits if not
+				   looked up by this cursor */
+  int nsig, maxsig;
+  char *prev;			/* previous value of a watched signal */
+  int maxprev;
+  unsigned long *hist;		/* wide values from lxt2_get_history() */
+  long maxhist;
+
+  lxttime_t cur;
+  lxttime_t done;		/* events up to here were applied... */
+  unsigned int skip:1;		/* ...when the current block was discarded */
+  unsigned int started:1;
+
+  /* recently used states, so stepping back is cheap */
+  struct lxt2_rd_snap snap[LXT2_RD_SNAPS];
+  unsigned long clock;
+
+  struct lxt2_rd_slot *ring;
+  int nring;
+  long fill;			/* next block to decode */
+  long use;			/* block being applied */
+  int nthreads;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t cv_work, cv_done;
+  int hold;			/* workers must not start a block */
+  int stop;
+};
+
+
+static void *_rd_realloc (void *p, size_t sz)
+{
+  p = realloc (p, sz);
+  if (!p && sz) {
+    fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	     (unsigned long)sz);
+    exit (1);
+  }
+  return p;
+}
+
+static unsigned int _rd_u16 (const unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static unsigned int _rd_u32 (const unsigned char *p)
+{
+  return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static lxttime_t _rd_u64 (const unsigned char *p)
+{
+  return ((lxttime_t)_rd_u32 (p) << 32) | _rd_u32 (p + 4);
+}
+
+static unsigned int _rd_uN (const unsigned char *p, int n)
+{
+  unsigned int v = 0;
+  while (n-- > 0) {
+    v = (v << 8) | *p++;
+  }
+  return v;
+}
+
+static unsigned int _rd_hash (const char *s)
+{
+  unsigned int h = 2166136261U;
+  while (*s) {
+    h = (h ^ (unsigned char)*s++) * 16777619U;
+  }
+  return h;
+}
+
+/* inflate one gzip member; returns the number of bytes produced */
+static long _rd_inflate (const unsigned char *src, size_t slen,
+			 unsigned char *dst, size_t dlen)
+{
+  z_stream z;
+  int r;
+
+  memset (&z, 0, sizeof (z));
+  if (inflateInit2 (&z, MAX_WBITS + 16) != Z_OK) {
+    return -1;
+  }
+  z.next_in = (unsigned char *)src;
+  z.avail_in = slen;
+  z.next_out = dst;
+  z.avail_out = dlen;
+  r = inflate (&z, Z_FINISH);
+  inflateEnd (&z);
+  if (r != Z_STREAM_END && r != Z_BUF_ERROR && r != Z_OK) {
+    return -1;
+  }
+  return z.total_out;
+}
+
+static void _rd_grow_buf (struct lxt2_rd_dec *d, size_t n)
+{
+  if (n > d->maxbuf) {
+    d->maxbuf = 2*n;
+    d->buf = (unsigned char *) _rd_realloc (d->buf, d->maxbuf);
+  }
+}
+
+/* move the changes of one granule into the block's event list, in time order */
+static void _rd_flush_granule (struct lxt2_rd_dec *d, const lxttime_t *times)
+{
+  unsigned long cnt[LXT2_WR_GRANULE_SIZE+1];
+  unsigned long i, base;
+
+  if (!d->ng) {
+    return;
+  }
+  if (d->nev + d->ng > d->maxev) {
+    d->maxev = 2*(d->nev + d->ng);
+    d->ev_time = (lxttime_t *)
+      _rd_realloc (d->ev_time, sizeof (lxttime_t)*d->maxev);
+    d->ev_sig = (int *) _rd_realloc (d->ev_sig, sizeof (int)*d->maxev);
+    d->ev_code = (unsigned int *)
+      _rd_realloc (d->ev_code, sizeof (unsigned int)*d->maxev);
+  }
+  memset (cnt, 0, sizeof (cnt));
+  for (i=0; i < d->ng; i++) {
+    cnt[d->g_pos[i]+1]++;
+  }
+  for (i=0; i < LXT2_WR_GRANULE_SIZE; i++) {
+    cnt[i+1] += cnt[i];
+  }
+  base = d->nev;
+  for (i=0; i < d->ng; i++) {
+    unsigned long k = base + cnt[d->g_pos[i]]++;
+    d->ev_time[k] = times[d->g_pos[i]];
+    d->ev_sig[k] = d->g_sig[i];
+    d->ev_code[k] = d->g_code[i];
+  }
+  d->nev += d->ng;
+  d->ng = 0;
+}
+
+/* add the change of signal s (fac) with the given code to its summary */
+static void _rd_sum_event (struct lxt2_rd_file *f,
+			   struct lxt2_rd_dec *d, int s, int fac,
+			   unsigned int code)
+{
+  struct lxt2_rd_sum *u;
+  const char *str;
+  unsigned long v;
+  int len = f->flen[fac];
+  int i, n;
+  char c;
+
+  if (s >= d->nsum) {
+    if (s >= d->maxsum) {
+      d->maxsum = 2*(s + 1);
+      d->sum = (struct lxt2_rd_sum *)
+	_rd_realloc (d->sum, sizeof (struct lxt2_rd_sum)*d->maxsum);
+    }
+    memset (d->sum + d->nsum, 0,
+	    sizeof (struct lxt2_rd_sum)*(s + 1 - d->nsum));
+    d->nsum = s + 1;
+  }
+  u = &d->sum[s];
+  u->nev++;
+
+  if (f->fflags[fac] & LXT2_WR_SYM_F_DOUBLE) {
+    if (code >= LXT2_WR_DICT_START) {
+      float x = strtod (d->dict[code - LXT2_WR_DICT_START], NULL);
+      if (!u->bounded || x < u->rmin) {
+	u->rmin = x;
+      }
+      if (!u->bounded || x > u->rmax) {
+	u->rmax = x;
+      }
+      u->bounded = 1;
+    }
+    return;
+  }
+  if (len > 64) {
+    u->any = 1;
+    return;
+  }
+  switch (code) {
+  case LXT2_WR_ENC_0:
+    u->seen |= LXT2_RD_SEEN_0 | LXT2_RD_SEEN_VAL;
+    v = 0;
+    break;
+  case LXT2_WR_ENC_1:
+    u->seen |= LXT2_RD_SEEN_1 | LXT2_RD_SEEN_VAL;
+    v = (len == 64) ? ~0UL : ((1UL << len) - 1);
+    break;
+  case LXT2_WR_ENC_X:
+  case LXT2_WR_ENC_BLACKOUT:
+    u->seen |= LXT2_RD_SEEN_X;
+    v = 0;
+    break;
+  case LXT2_WR_ENC_Z:
+    u->seen |= LXT2_RD_SEEN_Z;
+    v = 0;
+    break;
+  default:
+    if (code < LXT2_WR_DICT_START) {
+      /* relative to the previous value */
+      u->any = 1;
+      return;
+    }
+    /* the left fill of _rd_apply() */
+    str = d->dict[code - LXT2_WR_DICT_START];
+    n = strlen (str);
+    v = 0;
+    c = 0;
+    for (i=0; i < len; i++) {
+      if (n >= len) {
+	c = str[n - len + i];
+      }
+      else if (i < len - n) {
+	c = (str[0] != '1') ? str[0] : '0';
+      }
+      else {
+	c = str[i - (len - n)];
+      }
+      switch (c) {
+      case '0': u->seen |= LXT2_RD_SEEN_0; break;
+      case '1': u->seen |= LXT2_RD_SEEN_1; break;
+      case 'z': u->seen |= LXT2_RD_SEEN_Z; break;
+      default: u->seen |= LXT2_RD_SEEN_X; break;
+      }
+      v = (v << 1) | (c == '1');
+    }
+    for (i=0; i < n; i++) {
+      if (str[i] != '0' && str[i] != '1') {
+	break;
+      }
+    }
+    if (i == n) {
+      u->seen |= LXT2_RD_SEEN_VAL;
+    }
+    break;
+  }
+  if (!u->bounded || v < u->min) {
+    u->min = v;
+  }
+  if (!u->bounded || v > u->max) {
+    u->max = v;
+  }
+  u->bounded = 1;
+}
+
+/*
+  Does the partial section starting at fac iter have a wanted fac?
+  req has a flag per section after the facs; sections that do not
+  start on a section boundary (or the dictionary, at ~0) are kept.
+*/
+static int _rd_want_section (struct lxt2_rd_file *f, const int *req,
+			     unsigned int iter)
+{
+  if (iter >= f->numfacs || iter % LXT2_WR_PARTIAL_SIZE != 0) {
+    return 1;
+  }
+  return req[f->numfacs + iter/LXT2_WR_PARTIAL_SIZE];
+}
+
+/*
+  Inflate and parse block d->blk, keeping the changes of facs with
+  req[fac] >= 0. Runs on any thread: it only reads the file's fixed
+  tables. Returns 0 if the block is damaged.
+*/
+static int _rd_decode (struct lxt2_rd_file *f, struct lxt2_rd_dec *d,
+		       const int *req)
+{
+  struct lxt2_rd_block *b = &f->blk[d->blk];
+  const unsigned char *p = f->map + b->off;
+  const unsigned char *pend = p + b->clen;
+  size_t len, pos, dstart;
+  unsigned int ndict, strmem, nmaps, msz, i, j;
+  lxttime_t times[LXT2_WR_GRANULE_SIZE];
+  unsigned int ntimes = 0;
+  long last = -1;
+
+  d->nev = 0;
+  d->ng = 0;
+  d->nsum = 0;
+
+  /* inflate */
+  if (b->clen >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+    _rd_grow_buf (d, b->unclen);
+    if (_rd_inflate (p, b->clen, d->buf, b->unclen) != (long)b->unclen) {
+      return 0;
+    }
+    len = b->unclen;
+  }
+  else {
+    /* partial-zip: [compressed len][inflated len][first fac] gzip, ...;
+       sections without a wanted fac are not inflated */
+    len = 0;
+    while (p + 12 <= pend) {
+      unsigned int sc = _rd_u32 (p), su = _rd_u32 (p + 4);
+      unsigned int it = _rd_u32 (p + 8);
+      p += 12;
+      if (p + sc > pend) {
+	return 0;
+      }
+      if (!_rd_want_section (f, req, it)) {
+	p += sc;
+	continue;
+      }
+      _rd_grow_buf (d, len + su);
+      if (_rd_inflate (p, sc, d->buf + len, su) != (long)su) {
+	return 0;
+      }
+      len += su;
+      p += sc;
+    }
+  }
+
+  /* dictionaries at the end: strings, maps, then three counts */
+  msz = (f->gran > 32) ? 8 : 4;
+  if (len < 13) {
+    return 0;
+  }
+  ndict = _rd_u32 (d->buf + len - 12);
+  strmem = _rd_u32 (d->buf + len - 8);
+  nmaps = _rd_u32 (d->buf + len - 4);
+  if ((size_t)nmaps*msz + strmem + 13 > len) {
+    return 0;
+  }
+  dstart = len - 12 - (size_t)nmaps*msz - strmem - 1;
+  if (d->buf[dstart] != LXT2_WR_GRAN_SECT_DICT) {
+    return 0;
+  }
+  if (ndict > d->maxdict) {
+    d->maxdict = ndict;
+    d->dict = (char **) _rd_realloc (d->dict, sizeof (char *)*ndict);
+  }
+  pos = dstart + 1;
+  for (i=0; i < ndict; i++) {
+    d->dict[i] = (char *)d->buf + pos;
+    pos += strlen (d->dict[i]) + 1;
+    if (pos > len - 12 - (size_t)nmaps*msz) {
+      return 0;
+    }
+  }
+  if (nmaps > d->maxmaps) {
+    d->maxmaps = nmaps;
+    d->maps = (granmsk_t *) _rd_realloc (d->maps, sizeof (granmsk_t)*nmaps);
+  }
+  pos = len - 12 - (size_t)nmaps*msz;
+  for (i=0; i < nmaps; i++) {
+    d->maps[i] = (msz == 8) ? _rd_u64 (d->buf + pos) : _rd_u32 (d->buf + pos);
+    pos += msz;
+  }
+
+  /* granules */
+  pos = 0;
+  while (pos < dstart) {
+    unsigned int type = d->buf[pos++];
+    unsigned int iter, nf, mapn, idxn, slen;
+    size_t mp, cp;
+
+    if (type == LXT2_WR_GRAN_SECT_TIME) {
+      iter = 0;
+      nf = f->nreal;
+    }
+    else if (type == LXT2_WR_GRAN_SECT_TIME_PARTIAL && pos + 8 <= dstart) {
+      iter = _rd_u32 (d->buf + pos);
+      slen = _rd_u32 (d->buf + pos + 4);
+      pos += 8;
+      if (iter > f->nreal) {
+	return 0;
+      }
+      if (!_rd_want_section (f, req, iter)) {
+	if (slen > dstart - pos) {
+	  return 0;
+	}
+	pos += slen;
+	continue;
+      }
+      nf = f->nreal - iter;
+      if (nf > LXT2_WR_PARTIAL_SIZE) {
+	nf = LXT2_WR_PARTIAL_SIZE;
+      }
+    }
+    else {
+      return 0;
+    }
+    if ((long)iter <= last) {
+      /* sections of a granule come in fac order, and each repeats
+	 the time table; any of them can be the first one kept */
+      _rd_flush_granule (d, times);
+    }
+    last = iter;
+    if (pos >= dstart) {
+      return 0;
+    }
+    ntimes = d->buf[pos++];
+    if (ntimes > (unsigned)f->gran || pos + 8*ntimes > dstart) {
+      return 0;
+    }
+    for (i=0; i < ntimes; i++) {
+      times[i] = _rd_u64 (d->buf + pos);
+      pos += 8;
+    }
+    if (pos >= dstart) {
+      return 0;
+    }
+    mapn = d->buf[pos++];
+    mp = pos;
+    pos += (size_t)nf*mapn;
+    if (mapn < 1 || mapn > 4 || pos >= dstart) {
+      return 0;
+    }
+    idxn = d->buf[pos++];
+    if (idxn < 1 || idxn > 4) {
+      return 0;
+    }
+    cp = pos;
+
+    for (i=0; i < nf; i++, mp += mapn) {
+      unsigned int mv = _rd_uN (d->buf + mp, mapn);
+      granmsk_t msk;
+      int s;
+
+      if (mv >= nmaps) {
+	return 0;
+      }
+      msk = d->maps[mv];
+      s = req[iter + i];
+      if (s < 0) {
+	while (msk) {
+	  msk &= msk - 1;
+	  cp += idxn;
+	}
+	continue;
+      }
+      for (j=0; msk; j++, msk >>= 1) {
+	if (!(msk & 1)) {
+	  continue;
+	}
+	if (j >= ntimes || cp + idxn > dstart) {
+	  return 0;
+	}
+	if (d->ng == d->maxg) {
+	  d->maxg = d->maxg ? 2*d->maxg : 1024;
+	  d->g_pos = (unsigned char *) _rd_realloc (d->g_pos, d->maxg);
+	  d->g_sig = (int *) _rd_realloc (d->g_sig, sizeof (int)*d->maxg);
+	  d->g_code = (unsigned int *)
+	    _rd_realloc (d->g_code, sizeof (unsigned int)*d->maxg);
+	}
+	d->g_pos[d->ng] = j;
+	d->g_sig[d->ng] = s;
+	d->g_code[d->ng] = _rd_uN (d->buf + cp, idxn);
+	if (d->g_code[d->ng] < LXT2_WR_DICT_START + ndict) {
+	  _rd_sum_event (f, d, s, iter + i, d->g_code[d->ng]);
+	}
+	d->ng++;
+	cp += idxn;
+      }
+    }
+    pos = cp;
+  }
+  if (pos != dstart) {
+    return 0;
+  }
+  _rd_flush_granule (d, times);
+
+  /* codes must name a dictionary entry */
+  for (i=0; i < d->nev; i++) {
+    if (d->ev_code[i] >= LXT2_WR_DICT_START + ndict) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void _rd_decode_block (struct lxt2_rd_file *f,
+			      struct lxt2_rd_dec *d, const int *req)
+{
+  if (!_rd_decode (f, d, req)) {
+    fprintf (stderr, "WARNING: lxt2: block %ld is damaged; skipping it\n",
+	     d->blk);
+    d->nev = 0;
+    d->nsum = 0;
+  }
+  d->bytes = sizeof (*d) + d->maxbuf + sizeof (char *)*d->maxdict
+    + sizeof (granmsk_t)*d->maxmaps
+    + (sizeof (lxttime_t) + sizeof (int) + sizeof (unsigned int))*d->maxev
+    + sizeof (struct lxt2_rd_sum)*d->maxsum
+    + (1 + sizeof (int) + sizeof (unsigned int))*d->maxg;
+}
+
+static void _rd_dec_free (struct lxt2_rd_dec *d)
+{
+  free (d->buf);
+  free (d->dict);
+  free (d->maps);
+  free (d->ev_time);
+  free (d->ev_sig);
+  free (d->ev_code);
+  free (d->g_pos);
+  free (d->g_sig);
+  free (d->g_code);
+  free (d->sum);
+  free (d);
+}
+
+/*
+  Drop unused blocks, least recently used first, until the cache fits
+  in its size. Called with f->lock held.
+*/
+static void _rd_cache_trim (struct lxt2_rd_file *f)
+{
+  struct lxt2_rd_dec **pd, **lru;
+  struct lxt2_rd_dec *d;
+
+  while (f->bytes > f->maxbytes) {
+    lru = NULL;
+    for (pd = &f->cache; *pd; pd = &(*pd)->link) {
+      if ((*pd)->refs == 0 && (!lru || (*pd)->used < (*lru)->used)) {
+	lru = pd;
+      }
+    }
+    if (!lru) {
+      return;
+    }
+    d = *lru;
+    *lru = d->link;
+    f->bytes -= d->bytes;
+    if (f->nspare < LXT2_RD_SPARE) {
+      d->link = f->spare;
+      f->spare = d;
+      f->nspare++;
+    }
+    else {
+      _rd_dec_free (d);
+    }
+  }
+}
+
+/*
+  Block b with at least the signals of the cursor's generation, from
+  the file's cache, and held until _rd_dec_put(). If it is not there
+  and decode is set, it is decoded on this thread; a block another
+  cursor is decoding is waited for. Otherwise returns NULL.
+*/
+static struct lxt2_rd_dec *_rd_dec_get (struct local_lxt2_reader *r, long b,
+					int decode)
+{
+  struct lxt2_rd_file *f = r->f;
+  struct lxt2_rd_dec *d, *busy;
+  const int *req;
+
+  pthread_mutex_lock (&f->lock);
+  while (1) {
+    busy = NULL;
+    for (d = f->cache; d; d = d->link) {
+      if (d->blk == b && d->gen >= r->gen) {
+	if (d->state == LXT2_BLK_READY) {
+	  break;
+	}
+	busy = d;
+      }
+    }
+    if (d || !busy || !decode) {
+      break;
+    }
+    pthread_cond_wait (&f->cv, &f->lock);
+  }
+  if (d) {
+    d->refs++;
+    d->used = ++f->clock;
+    pthread_mutex_unlock (&f->lock);
+    return d;
+  }
+  if (!decode) {
+    pthread_mutex_unlock (&f->lock);
+    return NULL;
+  }
+  if (f->spare) {
+    d = f->spare;
+    f->spare = d->link;
+    f->nspare--;
+  }
+  else {
+    d = (struct lxt2_rd_dec *) _rd_realloc (NULL, sizeof (*d));
+    memset (d, 0, sizeof (*d));
+  }
+  d->blk = b;
+  d->gen = f->gen;
+  d->state = LXT2_BLK_BUSY;
+  d->refs = 1;
+  d->used = ++f->clock;
+  d->link = f->cache;
+  f->cache = d;
+  req = f->req;
+  f->busy++;
+  pthread_mutex_unlock (&f->lock);
+
+  _rd_decode_block (f, d, req);
+
+  pthread_mutex_lock (&f->lock);
+  if (--f->busy == 0) {
+    while (f->noldreq > 0) {
+      free (f->oldreq[--f->noldreq]);
+    }
+  }
+  d->state = LXT2_BLK_READY;
+  f->bytes += d->bytes;
+  _rd_cache_trim (f);
+  pthread_cond_broadcast (&f->cv);
+  pthread_mutex_unlock (&f->lock);
+  return d;
+}
+
+static void _rd_dec_put (struct lxt2_rd_file *f, struct lxt2_rd_dec *d)
+{
+  pthread_mutex_lock (&f->lock);
+  d->refs--;
+  _rd_cache_trim (f);
+  pthread_mutex_unlock (&f->lock);
+}
+
+static void *_rd_worker (void *arg)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)arg;
+  struct lxt2_rd_slot *sl;
+  struct lxt2_rd_dec *d;
+
+  pthread_mutex_lock (&r->lock);
+  while (1) {
+    while (!r->stop && (r->hold || r->fill >= r->f->nblk ||
+			r->ring[r->fill % r->nring].state != LXT2_BLK_FREE)) {
+      pthread_cond_wait (&r->cv_work, &r->lock);
+    }
+    if (r->stop) {
+      break;
+    }
+    sl = &r->ring[r->fill % r->nring];
+    sl->blk = r->fill++;
+    sl->state = LXT2_BLK_BUSY;
+    pthread_mutex_unlock (&r->lock);
+
+    d = _rd_dec_get (r, sl->blk, 1);
+
+    pthread_mutex_lock (&r->lock);
+    sl->d = d;
+    sl->next = 0;
+    sl->state = LXT2_BLK_READY;
+    pthread_cond_broadcast (&r->cv_done);
+  }
+  pthread_mutex_unlock (&r->lock);
+  return NULL;
+}
+
+static void _rd_snap_clear (struct local_lxt2_reader *r)
+{
+  int i;
+
+  for (i=0; i < LXT2_RD_SNAPS; i++) {
+    r->snap[i].blk = -1;
+  }
+}
+
+static void _rd_snap_save (struct local_lxt2_reader *r, long b)
+{
+  struct lxt2_rd_snap *p = &r->snap[0];
+  size_t pos;
+  int i;
+
+  if (r->nsig == 0) {
+    return;
+  }
+  for (i=0; i < LXT2_RD_SNAPS; i++) {
+    if (r->snap[i].blk == b) {
+      p = &r->snap[i];
+      break;
+    }
+    if (r->snap[i].used < p->used) {
+      p = &r->snap[i];
+    }
+  }
+  pos = 0;
+  for (i=0; i < r->nsig; i++) {
+    pos += r->sig[i].len;
+  }
+  if (pos > p->maxbits) {
+    p->maxbits = pos;
+    p->bits = (char *) _rd_realloc (p->bits, pos);
+  }
+  if (r->nsig > p->maxreal) {
+    p->maxreal = r->nsig;
+    p->real = (double *) _rd_realloc (p->real, sizeof (double)*r->nsig);
+  }
+  pos = 0;
+  for (i=0; i < r->nsig; i++) {
+    if (r->sig[i].bits) {
+      memcpy (p->bits + pos, r->sig[i].bits, r->sig[i].len);
+    }
+    pos += r->sig[i].len;
+    p->real[i] = r->sig[i].real;
+  }
+  p->blk = b;
+  p->nsig = r->nsig;
+  p->used = ++r->clock;
+}
+
+/* the latest saved state at or before block b, or NULL */
+static struct lxt2_rd_snap *_rd_snap_find (struct local_lxt2_reader *r, long b)
+{
+  struct lxt2_rd_snap *p = NULL;
+  int i;
+
+  for (i=0; i < LXT2_RD_SNAPS; i++) {
+    if (r->snap[i].blk >= 0 && r->snap[i].blk <= b &&
+	r->snap[i].nsig == r->nsig && (!p || r->snap[i].blk > p->blk)) {
+      p = &r->snap[i];
+    }
+  }
+  return p;
+}
+
+static void _rd_snap_load (struct local_lxt2_reader *r, struct lxt2_rd_snap *p)
+{
+  size_t pos = 0;
+  int i;
+
+  for (i=0; i < r->nsig; i++) {
+    if (r->sig[i].bits) {
+      memcpy (r->sig[i].bits, p->bits + pos, r->sig[i].len);
+    }
+    pos += r->sig[i].len;
+    r->sig[i].real = p->real[i];
+    r->sig[i].dirty = 1;
+  }
+  p->used = ++r->clock;
+}
+
+/* the decoded block r->use, or NULL past the last block */
+static struct lxt2_rd_slot *_rd_current (struct local_lxt2_reader *r)
+{
+  struct lxt2_rd_slot *sl;
+
+  if (r->use >= r->f->nblk) {
+    return NULL;
+  }
+  sl = &r->ring[r->use % r->nring];
+  if (r->nthreads > 0) {
+    pthread_mutex_lock (&r->lock);
+    while (sl->state != LXT2_BLK_READY || sl->blk != r->use) {
+      pthread_cond_wait (&r->cv_done, &r->lock);
+    }
+    pthread_mutex_unlock (&r->lock);
+  }
+  else if (sl->state != LXT2_BLK_READY || sl->blk != r->use) {
+    sl->blk = r->use;
+    sl->d = _rd_dec_get (r, sl->blk, 1);
+    sl->next = 0;
+    sl->state = LXT2_BLK_READY;
+  }
+  if (r->skip) {
+    while (sl->next < sl->d->nev && sl->d->ev_time[sl->next] <= r->done) {
+      sl->next++;
+    }
+    r->skip = 0;
+  }
+  return sl;
+}
+
+static void _rd_release (struct local_lxt2_reader *r, struct lxt2_rd_slot *sl)
+{
+  _rd_dec_put (r->f, sl->d);
+  sl->d = NULL;
+  if (r->use + 1 < r->f->nblk) {
+    _rd_snap_save (r, r->use + 1);
+  }
+  if (r->nthreads > 0) {
+    pthread_mutex_lock (&r->lock);
+    sl->state = LXT2_BLK_FREE;
+    r->use++;
+    pthread_cond_broadcast (&r->cv_work);
+    pthread_mutex_unlock (&r->lock);
+  }
+  else {
+    sl->state = LXT2_BLK_FREE;
+    r->use++;
+  }
+}
+
+/* apply one encoded change to a signal */
+static void _rd_apply (struct lxt2_rd_sig *s, unsigned int code,
+		       struct lxt2_rd_dec *d)
+{
+  int i, n;
+  unsigned int v;
+  char *str;
+
+  s->dirty = 1;
+  if (code >= LXT2_WR_DICT_START) {
+    str = d->dict[code - LXT2_WR_DICT_START];
+    if (s->analog) {
+      s->real = strtod (str, NULL);
+      return;
+    }
+    /* vcd-style left fill, as the writer truncated it */
+    n = strlen (str);
+    if (n >= s->len) {
+      memcpy (s->bits, str + n - s->len, s->len);
+    }
+    else {
+      memset (s->bits, (str[0] != '1') ? str[0] : '0', s->len - n);
+      memcpy (s->bits + s->len - n, str, n);
+    }
+    return;
+  }
+  if (s->analog) {
+    return;
+  }
+  switch (code) {
+  case LXT2_WR_ENC_0:
+    memset (s->bits, '0', s->len);
+    break;
+  case LXT2_WR_ENC_1:
+    memset (s->bits, '1', s->len);
+    break;
+  case LXT2_WR_ENC_X:
+  case LXT2_WR_ENC_BLACKOUT:
+    memset (s->bits, 'x', s->len);
+    break;
+  case LXT2_WR_ENC_Z:
+    memset (s->bits, 'z', s->len);
+    break;
+  case LXT2_WR_ENC_INV:
+    for (i=0; i < s->len; i++) {
+      s->bits[i] = (s->bits[i] == '0') ? '1' : '0';
+    }
+    break;
+  case LXT2_WR_ENC_LSH0:
+  case LXT2_WR_ENC_LSH1:
+    memmove (s->bits, s->bits + 1, s->len - 1);
+    s->bits[s->len-1] = '0' + (code - LXT2_WR_ENC_LSH0);
+    break;
+  case LXT2_WR_ENC_RSH0:
+  case LXT2_WR_ENC_RSH1:
+    memmove (s->bits + 1, s->bits, s->len - 1);
+    s->bits[0] = '0' + (code - LXT2_WR_ENC_RSH0);
+    break;
+  default:
+    /* ADD1..4, SUB1..4: only used for values of at most 32 bits */
+    v = 0;
+    for (i=0; i < s->len; i++) {
+      v = (v << 1) | (s->bits[i] == '1');
+    }
+    if (code <= LXT2_WR_ENC_ADD4) {
+      v += code - LXT2_WR_ENC_ADD1 + 1;
+    }
+    else {
+      v -= code - LXT2_WR_ENC_SUB1 + 1;
+    }
+    for (i=s->len-1; i >= 0; i--) {
+      s->bits[i] = '0' + (v & 1);
+      v >>= 1;
+    }
+    break;
+  }
+}
+
+/* the cursor's signal of the next event, or NULL if it has not looked
+   it up */
+static struct lxt2_rd_sig *_rd_ev_sig (struct local_lxt2_reader *r,
+				       struct lxt2_rd_slot *sl)
+{
+  int si = sl->d->ev_sig[sl->next];
+
+  if (si >= r->nsig || !r->sig[si].bits) {
+    return NULL;
+  }
+  return &r->sig[si];
+}
+
+/* apply the next event of the slot, if the cursor has its signal */
+static void _rd_apply_next (struct local_lxt2_reader *r,
+			    struct lxt2_rd_slot *sl)
+{
+  struct lxt2_rd_sig *s = _rd_ev_sig (r, sl);
+
+  if (s) {
+    _rd_apply (s, sl->d->ev_code[sl->next], sl->d);
+  }
+}
+
+static void _rd_run (struct local_lxt2_reader *r, lxttime_t target)
+{
+  struct lxt2_rd_slot *sl;
+
+  while (r->use < r->f->nblk && r->f->blk[r->use].t0 <= target) {
+    sl = _rd_current (r);
+    while (sl->next < sl->d->nev && sl->d->ev_time[sl->next] <= target) {
+      _rd_apply_next (r, sl);
+      sl->next++;
+    }
+    if (sl->next < sl->d->nev) {
+      return;
+    }
+    _rd_release (r, sl);
+  }
+}
+
+/* stop the workers once the blocks they are decoding are done */
+static void _rd_hold (struct local_lxt2_reader *r)
+{
+  int i;
+
+  if (r->nthreads > 0) {
+    pthread_mutex_lock (&r->lock);
+    r->hold = 1;
+    for (i=0; i < r->nring; i++) {
+      while (r->ring[i].state == LXT2_BLK_BUSY) {
+	pthread_cond_wait (&r->cv_done, &r->lock);
+      }
+    }
+  }
+}
+
+/*
+  Discard the ring, and continue decoding from block b. Blocks still in
+  the file's cache are used again.
+*/
+static void _rd_restart (struct local_lxt2_reader *r, long b)
+{
+  int i;
+
+  for (i=0; i < r->nring; i++) {
+    if (r->ring[i].state == LXT2_BLK_READY) {
+      _rd_dec_put (r->f, r->ring[i].d);
+      r->ring[i].d = NULL;
+    }
+    r->ring[i].state = LXT2_BLK_FREE;
+    r->ring[i].blk = -1;
+  }
+  r->use = b;
+  r->fill = b;
+  while (r->fill < r->f->nblk && r->fill < b + r->nring) {
+    struct lxt2_rd_slot *sl = &r->ring[r->fill % r->nring];
+    sl->d = _rd_dec_get (r, r->fill, 0);
+    if (!sl->d) {
+      break;
+    }
+    sl->blk = r->fill++;
+    sl->state = LXT2_BLK_READY;
+    sl->next = 0;
+  }
+  if (r->nthreads > 0) {
+    r->hold = 0;
+    pthread_cond_broadcast (&r->cv_work);
+    pthread_mutex_unlock (&r->lock);
+  }
+}
+
+/*
+  Signal si was looked up after time started to advance, and blocks
+  must now have generation gen. Blocks in the ring may not have its
+  changes: discard them, and replay the signal alone from the start of
+  the file up to the current time.
+*/
+static void _rd_catchup (struct local_lxt2_reader *r, int si,
+			 unsigned long gen)
+{
+  struct lxt2_rd_dec *d;
+  unsigned long i;
+  long b;
+
+  _rd_hold (r);
+  if (gen > r->gen) {
+    r->gen = gen;
+  }
+  r->done = r->cur;
+  r->skip = 1;
+  /* no saved state has the new signal */
+  _rd_snap_clear (r);
+  _rd_restart (r, r->use);
+
+  for (b=0; b <= r->use && b < r->f->nblk && r->f->blk[b].t0 <= r->cur; b++) {
+    d = _rd_dec_get (r, b, 1);
+    for (i=0; i < d->nev && d->ev_time[i] <= r->cur; i++) {
+      if (d->ev_sig[i] == si) {
+	_rd_apply (&r->sig[si], d->ev_code[i], d);
+      }
+    }
+    _rd_dec_put (r->f, d);
+  }
+}
+
+static void _rd_start (struct local_lxt2_reader *r)
+{
+  long ncpu;
+  int i;
+
+  if (r->started) {
+    return;
+  }
+  r->started = 1;
+
+  ncpu = sysconf (_SC_NPROCESSORS_ONLN);
+  if (ncpu > 32) {
+    ncpu = 32;
+  }
+  r->nthreads = (ncpu > 1 && r->f->nblk > 1) ? ncpu : 0;
+  r->nring = r->nthreads > 0 ? r->nthreads + 2 : 1;
+  r->ring = (struct lxt2_rd_slot *)
+    _rd_realloc (NULL, sizeof (struct lxt2_rd_slot)*r->nring);
+  memset (r->ring, 0, sizeof (struct lxt2_rd_slot)*r->nring);
+  for (i=0; i < r->nring; i++) {
+    r->ring[i].state = LXT2_BLK_FREE;
+    r->ring[i].blk = -1;
+  }
+  if (r->nthreads > 0) {
+    r->threads = (pthread_t *)
+      _rd_realloc (NULL, sizeof (pthread_t)*r->nthreads);
+    for (i=0; i < r->nthreads; i++) {
+      if (pthread_create (&r->threads[i], NULL, _rd_worker, r) != 0) {
+	break;
+      }
+    }
+    if (i == 0) {
+      free (r->threads);
+      r->threads = NULL;
+    }
+    r->nthreads = i;
+  }
+  _rd_run (r, r->cur);
+}
+
+static void _rd_file_put (struct lxt2_rd_file *f)
+{
+  struct lxt2_rd_dec *d;
+  int i;
+
+  pthread_mutex_lock (&f->lock);
+  i = --f->refs;
+  pthread_mutex_unlock (&f->lock);
+  if (i > 0) {
+    return;
+  }
+  pthread_mutex_destroy (&f->lock);
+  pthread_cond_destroy (&f->cv);
+  while (f->cache) {
+    d = f->cache;
+    f->cache = d->link;
+    _rd_dec_free (d);
+  }
+  while (f->spare) {
+    d = f->spare;
+    f->spare = d->link;
+    _rd_dec_free (d);
+  }
+  for (i=0; i < f->noldreq; i++) {
+    free (f->oldreq[i]);
+  }
+  free (f->oldreq);
+  free (f->req);
+  free (f->sgen);
+  free (f->blk);
+  free (f->htab);
+  free (f->fflags);
+  free (f->flen);
+  free (f->root);
+  free (f->name);
+  free (f->namebuf);
+  if (f->map) {
+    munmap (f->map, f->maplen);
+  }
+  if (f->fd >= 0) {
+    close (f->fd);
+  }
+  free (f);
+}
+
+static void _rd_free (struct local_lxt2_reader *r)
+{
+  int i;
+
+  if (r->nthreads > 0) {
+    pthread_mutex_lock (&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast (&r->cv_work);
+    pthread_mutex_unlock (&r->lock);
+    for (i=0; i < r->nthreads; i++) {
+      pthread_join (r->threads[i], NULL);
+    }
+    free (r->threads);
+  }
+  pthread_mutex_destroy (&r->lock);
+  pthread_cond_destroy (&r->cv_work);
+  pthread_cond_destroy (&r->cv_done);
+
+  for (i=0; i < r->nring; i++) {
+    if (r->ring[i].state == LXT2_BLK_READY) {
+      _rd_dec_put (r->f, r->ring[i].d);
+    }
+  }
+  for (i=0; i < LXT2_RD_SNAPS; i++) {
+    free (r->snap[i].bits);
+    free (r->snap[i].real);
+  }
+  free (r->ring);
+  for (i=0; i < r->nsig; i++) {
+    free (r->sig[i].bits);
+    free (r->sig[i].wide);
+  }
+  free (r->sig);
+  free (r->prev);
+  free (r->hist);
+  _rd_file_put (r->f);
+  free (r);
+}
+
+/* a cursor at time 0 on file f, with no signals */
+static struct local_lxt2_reader *_rd_new (struct lxt2_rd_file *f)
+{
+  struct local_lxt2_reader *r;
+
+  r = (struct local_lxt2_reader *) _rd_realloc (NULL, sizeof (*r));
+  memset (r, 0, sizeof (*r));
+  r->_reader = 1;
+  r->f = f;
+  _rd_snap_clear (r);
+  pthread_mutex_init (&r->lock, NULL);
+  pthread_cond_init (&r->cv_work, NULL);
+  pthread_cond_init (&r->cv_done, NULL);
+  pthread_mutex_lock (&f->lock);
+  f->refs++;
+  pthread_mutex_unlock (&f->lock);
+  return r;
+}
+
+/* parse the header, the fac tables and the block directory */
+static int _rd_header (struct lxt2_rd_file *f)
+{
+  const unsigned char *p = f->map;
+  const unsigned char *end = f->map + f->maplen;
+  unsigned int numfacbytes, zname, znamelen, zgeom;
+  unsigned char *names, *geom;
+  size_t pos, npos;
+  unsigned int i, prev;
+  int ts;
+
+  if (f->maplen < 5 || _rd_u16 (p) != LXT2_WR_HDRID) {
+    return 0;
+  }
+  f->gran = p[4];
+  if (f->gran != LXT2_WR_GRANULE_SIZE) {
+    fprintf (stderr, "ERROR: lxt2: granule size %d is not supported\n",
+	     f->gran);
+    return 0;
+  }
+  p += 5;
+  if (p + 4 > end) {
+    return 0;
+  }
+  f->numfacs = _rd_u32 (p);
+  p += 4;
+  if (f->numfacs == 0) {
+    /* extra parameters: their length, the fac count, and the time zero */
+    if (p + 8 > end) {
+      return 0;
+    }
+    i = _rd_u32 (p);
+    f->numfacs = _rd_u32 (p + 4);
+    p += 4 + i;
+  }
+  if (p + 21 > end || f->numfacs == 0) {
+    return 0;
+  }
+  numfacbytes = _rd_u32 (p);
+  zname = _rd_u32 (p + 8);
+  znamelen = _rd_u32 (p + 12);
+  zgeom = _rd_u32 (p + 16);
+  ts = (signed char)p[20];
+  p += 21;
+  (void)numfacbytes;
+  if (p + zname + zgeom > end) {
+    return 0;
+  }
+
+  f->ts = 1;
+  while (ts > 0) {
+    f->ts *= 10;
+    ts--;
+  }
+  while (ts < 0) {
+    f->ts /= 10;
+    ts++;
+  }
+
+  /* names: each shares a prefix of the one before */
+  names = (unsigned char *) _rd_realloc (NULL, znamelen + 1);
+  if (_rd_inflate (p, zname, names, znamelen) != (long)znamelen) {
+    free (names);
+    return 0;
+  }
+  p += zname;
+  f->name = (unsigned int *) _rd_realloc (NULL, sizeof (unsigned int)*f->numfacs);
+  npos = 0;
+  prev = 0;
+  pos = 0;
+  for (i=0; i < f->numfacs; i++) {
+    unsigned int pl, sl;
+    if (pos + 3 > znamelen) {
+      free (names);
+      return 0;
+    }
+    pl = _rd_u16 (names + pos);
+    pos += 2;
+    sl = strnlen ((char *)names + pos, znamelen - pos);
+    if (pos + sl >= znamelen || (i > 0 && pl > strlen (f->namebuf + prev))) {
+      free (names);
+      return 0;
+    }
+    f->namebuf = (char *) _rd_realloc (f->namebuf, npos + pl + sl + 1);
+    if (i > 0) {
+      memmove (f->namebuf + npos, f->namebuf + prev, pl);
+    }
+    memcpy (f->namebuf + npos + pl, names + pos, sl + 1);
+    f->name[i] = npos;
+    prev = npos;
+    npos += pl + sl + 1;
+    pos += sl + 1;
+  }
+  free (names);
+
+  /* geometry: rows, msb, lsb, flags per fac */
+  geom = (unsigned char *) _rd_realloc (NULL, 16*(size_t)f->numfacs);
+  if (_rd_inflate (p, zgeom, geom, 16*(size_t)f->numfacs) !=
+      16*(long)f->numfacs) {
+    free (geom);
+    return 0;
+  }
+  p += zgeom;
+  f->root = (int *) _rd_realloc (NULL, sizeof (int)*f->numfacs);
+  f->flen = (int *) _rd_realloc (NULL, sizeof (int)*f->numfacs);
+  f->fflags = (unsigned int *) _rd_realloc (NULL, sizeof (unsigned int)*f->numfacs);
+  f->nreal = 0;
+  for (i=0; i < f->numfacs; i++) {
+    unsigned char *g = geom + 16*i;
+    int msb = _rd_u32 (g + 4), lsb = _rd_u32 (g + 8);
+    f->fflags[i] = _rd_u32 (g + 12);
+    f->flen[i] = (msb > lsb ? msb - lsb : lsb - msb) + 1;
+    if (f->fflags[i] & LXT2_WR_SYM_F_ALIAS) {
+      f->root[i] = _rd_u32 (g);
+    }
+    else {
+      f->root[i] = i;
+      f->nreal++;
+    }
+  }
+  free (geom);
+  for (i=0; i < f->numfacs; i++) {
+    if (f->root[i] < 0 || f->root[i] >= (int)f->nreal) {
+      return 0;
+    }
+  }
+
+  /* name lookup */
+  f->hsize = 1;
+  while (f->hsize < 2*f->numfacs) {
+    f->hsize <<= 1;
+  }
+  f->htab = (unsigned int *) _rd_realloc (NULL, sizeof (unsigned int)*f->hsize);
+  memset (f->htab, 0, sizeof (unsigned int)*f->hsize);
+  for (i=0; i < f->numfacs; i++) {
+    unsigned int h = _rd_hash (f->namebuf + f->name[i]) & (f->hsize - 1);
+    while (f->htab[h]) {
+      h = (h + 1) & (f->hsize - 1);
+    }
+    f->htab[h] = i + 1;
+  }
+
+  f->nreq = f->numfacs +
+    (f->numfacs + LXT2_WR_PARTIAL_SIZE - 1)/LXT2_WR_PARTIAL_SIZE;
+  f->req = (int *) _rd_realloc (NULL, sizeof (int)*f->nreq);
+  for (i=0; i < f->numfacs; i++) {
+    f->req[i] = -1;
+  }
+  for (; i < f->nreq; i++) {
+    f->req[i] = 0;
+  }
+
+  /* block directory; a block with no size was never finished */
+  while (p + 24 <= end) {
+    struct lxt2_rd_block *b;
+    unsigned long unclen = _rd_u32 (p), clen = _rd_u32 (p + 4);
+    if (clen == 0 || p + 24 + clen > end) {
+      break;
+    }
+    if (f->nblk == f->maxblk) {
+      f->maxblk = f->maxblk ? 2*f->maxblk : 64;
+      f->blk = (struct lxt2_rd_block *)
+	_rd_realloc (f->blk, sizeof (struct lxt2_rd_block)*f->maxblk);
+    }
+    b = &f->blk[f->nblk++];
+    b->unclen = unclen;
+    b->clen = clen;
+    b->t0 = _rd_u64 (p + 8);
+    b->t1 = _rd_u64 (p + 16);
+    b->off = (p + 24) - f->map;
+    p += 24 + clen;
+  }
+  return 1;
+}
+
+void *lxt2_open (const char *nm)
+{
+  struct lxt2_rd_file *f;
+  struct local_lxt2_reader *r;
+  struct stat sb;
+
+  f = (struct lxt2_rd_file *) _rd_realloc (NULL, sizeof (*f));
+  memset (f, 0, sizeof (*f));
+  f->maxbytes = (size_t)LXT2_RD_CACHE_MB << 20;
+  pthread_mutex_init (&f->lock, NULL);
+  pthread_cond_init (&f->cv, NULL);
+  r = _rd_new (f);
+  f->fd = open (nm, O_RDONLY);
+  if (f->fd < 0) {
+    fprintf (stderr, "ERROR: could not open file `%s' for reading\n", nm);
+    _rd_free (r);
+    return NULL;
+  }
+  if (fstat (f->fd, &sb) != 0 || sb.st_size == 0) {
+    _rd_free (r);
+    return NULL;
+  }
+  f->maplen = sb.st_size;
+  f->map = (unsigned char *)
+    mmap (NULL, f->maplen, PROT_READ, MAP_PRIVATE, f->fd, 0);
+  if (f->map == MAP_FAILED) {
+    f->map = NULL;
+    _rd_free (r);
+    return NULL;
+  }
+  if (!_rd_header (f)) {
+    fprintf (stderr, "ERROR: `%s' is not a valid LXT2 file\n", nm);
+    _rd_free (r);
+    return NULL;
+  }
+  return r;
+}
+
+void *lxt2_open_alt (const char *nm)
+{
+  return lxt2_open (nm);
+}
+
+void lxt2_header (void *handle, float *stop_time, float *dt)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+
+  *dt = r->f->ts;
+  if (r->f->nblk > 0) {
+    *stop_time = r->f->blk[r->f->nblk-1].t1 * r->f->ts;
+  }
+  else {
+    *stop_time = -1;
+  }
+}
+
+/*
+  Only looked-up signals are decoded, so signals should be looked up
+  before time is advanced; a later lookup costs a pass over the file
+  up to the current time. Signals are numbered per file, so every
+  cursor returns the same handle for a name, but a cursor only follows
+  the signals looked up on it.
+*/
+void *lxt2_signal_lookup (void *handle, const char *name)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_file *f = r->f;
+  struct lxt2_rd_sig *s;
+  unsigned long gen;
+  unsigned int h;
+  int fac, si, *req;
+
+  h = _rd_hash (name) & (f->hsize - 1);
+  while (f->htab[h] && strcmp (f->namebuf + f->name[f->htab[h]-1], name)) {
+    h = (h + 1) & (f->hsize - 1);
+  }
+  if (!f->htab[h]) {
+    return NULL;
+  }
+  fac = f->root[f->htab[h]-1];
+
+  pthread_mutex_lock (&f->lock);
+  si = f->req[fac];
+  if (si < 0) {
+    /* decoders in progress keep reading the old table */
+    req = f->req;
+    if (f->busy > 0) {
+      req = (int *) _rd_realloc (NULL, sizeof (int)*f->nreq);
+      memcpy (req, f->req, sizeof (int)*f->nreq);
+      f->oldreq = (int **)
+	_rd_realloc (f->oldreq, sizeof (int *)*(f->noldreq + 1));
+      f->oldreq[f->noldreq++] = f->req;
+      f->req = req;
+    }
+    if (f->nsig == f->maxsig) {
+      f->maxsig = f->maxsig ? 2*f->maxsig : 16;
+      f->sgen = (unsigned long *)
+	_rd_realloc (f->sgen, sizeof (unsigned long)*f->maxsig);
+    }
+    si = f->nsig++;
+    req[fac] = si;
+    req[f->numfacs + fac/LXT2_WR_PARTIAL_SIZE] = 1;
+    f->sgen[si] = ++f->gen;
+  }
+  gen = f->sgen[si];
+  pthread_mutex_unlock (&f->lock);
+
+  if (si < r->nsig && r->sig[si].bits) {
+    return (void *)((long)si + 1);
+  }
+  if (si >= r->maxsig) {
+    r->maxsig = 2*(si + 1);
+    r->sig = (struct lxt2_rd_sig *)
+      _rd_realloc (r->sig, sizeof (struct lxt2_rd_sig)*r->maxsig);
+  }
+  if (si >= r->nsig) {
+    memset (r->sig + r->nsig, 0, sizeof (struct lxt2_rd_sig)*(si + 1 - r->nsig));
+    r->nsig = si + 1;
+  }
+  s = &r->sig[si];
+  s->fac = fac;
+  s->len = f->flen[fac];
+  s->analog = (f->fflags[fac] & LXT2_WR_SYM_F_DOUBLE) ? 1 : 0;
+  s->dirty = 1;
+  s->watch = 0;
+  s->real = 0;
+  s->bits = (char *) _rd_realloc (NULL, s->len);
+  memset (s->bits, 'x', s->len);
+  s->wide = NULL;
+  if (!s->analog && s->len > 64) {
+    s->wide = (unsigned long *)
+      _rd_realloc (NULL, sizeof (unsigned long)*ACT_TRACE_WIDE_NUM (s->len));
+  }
+
+  if (!r->started) {
+    if (gen > r->gen) {
+      r->gen = gen;
+    }
+  }
+  else {
+    _rd_catchup (r, si, gen);
+  }
+  return (void *)((long)si + 1);
+}
+
+act_signal_type_t lxt2_signal_type (void *handle, void *sig)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_sig *s = &r->sig[((long)sig)-1];
+
+  if (s->analog) {
+    return ACT_SIG_ANALOG;
+  }
+  else if (s->len == 1) {
+    return ACT_SIG_BOOL;
+  }
+  return ACT_SIG_INT;
+}
+
+int lxt2_signal_width (void *handle, void *sig)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_sig *s = &r->sig[((long)sig)-1];
+
+  return s->analog ? 0 : s->len;
+}
+
+void lxt2_advance_time (void *handle, int steps)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+
+  _rd_start (r);
+  if (steps > 0) {
+    r->cur += steps;
+    _rd_run (r, r->cur);
+  }
+}
+
+void lxt2_advance_time_by (void *handle, float dt)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+
+  if (dt <= 0) {
+    return;
+  }
+  lxt2_advance_time (handle, (int) (dt/r->f->ts + 0.5));
+}
+
+act_signal_val_t lxt2_get_signal (void *handle, void *sig)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_sig *s = &r->sig[((long)sig)-1];
+  int i;
+
+  _rd_start (r);
+  if (!s->dirty) {
+    return s->val;
+  }
+  s->dirty = 0;
+  if (s->analog) {
+    s->val.v = s->real;
+  }
+  else if (s->len == 1) {
+    switch (s->bits[0]) {
+    case '0': s->val.val = ACT_SIG_BOOL_FALSE; break;
+    case '1': s->val.val = ACT_SIG_BOOL_TRUE; break;
+    case 'z': s->val.val = ACT_SIG_BOOL_Z; break;
+    default: s->val.val = ACT_SIG_BOOL_X; break;
+    }
+  }
+  else if (s->len <= 64) {
+    s->val.val = 0;
+    for (i=0; i < s->len; i++) {
+      s->val.val = (s->val.val << 1) | (s->bits[i] == '1');
+    }
+  }
+  else {
+    memset (s->wide, 0, sizeof (unsigned long)*ACT_TRACE_WIDE_NUM (s->len));
+    for (i=0; i < s->len; i++) {
+      if (s->bits[s->len-1-i] == '1') {
+	s->wide[i/64] |= 1UL << (i % 64);
+      }
+    }
+    s->val.valp = s->wide;
+  }
+  return s->val;
+}
+
+int lxt2_has_more_data (void *handle)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+
+  _rd_start (r);
+  return (r->f->nblk > 0 && r->cur < r->f->blk[r->f->nblk-1].t1);
+}
+
+/*
+  A block written with checkpointing starts with the full value of
+  every signal; decoding can start there instead of at the first
+  block.
+*/
+static int _rd_is_checkpoint (struct local_lxt2_reader *r, long b)
+{
+  struct lxt2_rd_dec *d;
+  unsigned long i;
+  char *seen;
+  int n = 0, nmine = 0;
+
+  for (i=0; i < (unsigned long)r->nsig; i++) {
+    if (r->sig[i].bits) {
+      nmine++;
+    }
+  }
+  if (nmine == 0) {
+    return 1;
+  }
+  seen = (char *) _rd_realloc (NULL, r->nsig);
+  memset (seen, 0, r->nsig);
+  d = _rd_dec_get (r, b, 1);
+  for (i=0; i < d->nev && d->ev_time[i] == r->f->blk[b].t0; i++) {
+    unsigned int code = d->ev_code[i];
+    int si = d->ev_sig[i];
+    if (si >= r->nsig || !r->sig[si].bits) {
+      continue;
+    }
+    if (code == LXT2_WR_ENC_0 || code == LXT2_WR_ENC_1 ||
+	code == LXT2_WR_ENC_X || code == LXT2_WR_ENC_Z ||
+	code == LXT2_WR_ENC_BLACKOUT || code >= LXT2_WR_DICT_START) {
+      if (!seen[si]) {
+	seen[si] = 1;
+	n++;
+      }
+    }
+  }
+  _rd_dec_put (r->f, d);
+  free (seen);
+  return (n == nmine);
+}
+
+/*
+  Seeking back restarts from the last block at or before the target
+  for which the signal values are known: a state saved when the block
+  was entered before, or a checkpoint in the file. Otherwise it
+  restarts from the first block.
+*/
+int lxt2_seek (void *handle, unsigned long step)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_snap *p;
+  lxttime_t target = step;
+  long lo, hi, b;
+  int i;
+
+  _rd_start (r);
+  if (target < r->cur) {
+    /* last block that starts at or before the target */
+    lo = 0;
+    hi = r->f->nblk;
+    while (hi - lo > 1) {
+      long mid = (lo + hi)/2;
+      if (r->f->blk[mid].t0 <= target) {
+	lo = mid;
+      }
+      else {
+	hi = mid;
+      }
+    }
+    p = _rd_snap_find (r, lo);
+    b = p ? p->blk : 0;
+    if (b < lo && _rd_is_checkpoint (r, lo)) {
+      b = lo;
+      p = NULL;
+    }
+
+    _rd_hold (r);
+    r->skip = 0;
+    _rd_restart (r, b);
+    if (p) {
+      _rd_snap_load (r, p);
+    }
+    else {
+      for (i=0; i < r->nsig; i++) {
+	if (r->sig[i].bits) {
+	  memset (r->sig[i].bits, 'x', r->sig[i].len);
+	}
+	r->sig[i].real = 0;
+	r->sig[i].dirty = 1;
+      }
+    }
+  }
+  r->cur = target;
+  _rd_run (r, target);
+  return 1;
+}
+
+int lxt2_watch (void *handle, void *sig)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_sig *s = &r->sig[((long)sig)-1];
+
+  s->watch = 1;
+  return 1;
+}
+
+/*
+  Apply the next event of the slot to its signal, and return 1 if the
+  value changed. Checkpoints repeat values; those events are not
+  changes.
+*/
+static int _rd_apply_changed (struct local_lxt2_reader *r,
+			      struct lxt2_rd_sig *s, struct lxt2_rd_slot *sl)
+{
+  double real = s->real;
+
+  if (s->len > r->maxprev) {
+    r->maxprev = s->len;
+    r->prev = (char *) _rd_realloc (r->prev, r->maxprev);
+  }
+  memcpy (r->prev, s->bits, s->len);
+  _rd_apply (s, sl->d->ev_code[sl->next], sl->d);
+  if (s->analog) {
+    return (s->real != real);
+  }
+  return (memcmp (r->prev, s->bits, s->len) != 0);
+}
+
+/*
+  Apply events up to and including the next one of a watched signal,
+  and move the current time to it. Events of other signals in between
+  are applied on the way, so values stay consistent with the new time.
+*/
+int lxt2_next_change (void *handle, act_trace_change_t *out)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_slot *sl;
+  struct lxt2_rd_sig *s;
+  int si;
+
+  _rd_start (r);
+  while (r->use < r->f->nblk) {
+    sl = _rd_current (r);
+    while (sl->next < sl->d->nev) {
+      si = sl->d->ev_sig[sl->next];
+      s = _rd_ev_sig (r, sl);
+      if (!s || !s->watch) {
+	_rd_apply_next (r, sl);
+	sl->next++;
+	continue;
+      }
+      if (_rd_apply_changed (r, s, sl)) {
+	if (sl->d->ev_time[sl->next] > r->cur) {
+	  r->cur = sl->d->ev_time[sl->next];
+	}
+	sl->next++;
+	out->sig = (void *)((long)si + 1);
+	out->step = r->cur;
+	out->t = r->cur * r->f->ts;
+	out->v = lxt2_get_signal (handle, out->sig);
+	return 1;
+      }
+      sl->next++;
+    }
+    _rd_release (r, sl);
+  }
+  if (r->f->nblk > 0 && r->cur < r->f->blk[r->f->nblk-1].t1) {
+    r->cur = r->f->blk[r->f->nblk-1].t1;
+  }
+  return 0;
+}
+
+/* keep wide value k of a history, since s->wide is reused */
+static void _rd_hist_keep (struct local_lxt2_reader *r, long k, int nw,
+			   act_signal_val_t v)
+{
+  if ((k+1)*nw > r->maxhist) {
+    r->maxhist = 2*(k+1)*nw;
+    r->hist = (unsigned long *)
+      _rd_realloc (r->hist, sizeof (unsigned long)*r->maxhist);
+  }
+  memcpy (r->hist + k*nw, v.valp, sizeof (unsigned long)*nw);
+}
+
+/*
+  The value at s0, then every change of one signal up to s1. Only the
+  blocks in the window are visited, and events of other signals are
+  applied without being converted to values. Once cap entries are
+  stored, the reader stops at the time of the last one; otherwise it
+  stops at s1. Wide values point into r->hist.
+*/
+long lxt2_get_history (void *handle, void *sig, unsigned long s0,
+		       unsigned long s1, unsigned long *times,
+		       act_signal_val_t *vals, long cap)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_sig *s = &r->sig[((long)sig)-1];
+  struct lxt2_rd_slot *sl;
+  lxttime_t stop = s1;
+  long n, k;
+  int nw = (!s->analog && s->len > 64) ? ACT_TRACE_WIDE_NUM (s->len) : 0;
+
+  if (cap <= 0 || s1 < s0) {
+    return 0;
+  }
+  lxt2_seek (handle, s0);
+  times[0] = s0;
+  vals[0] = lxt2_get_signal (handle, sig);
+  if (nw > 0) {
+    _rd_hist_keep (r, 0, nw, vals[0]);
+  }
+  n = 1;
+  while (r->use < r->f->nblk && r->f->blk[r->use].t0 <= stop) {
+    sl = _rd_current (r);
+    while (sl->next < sl->d->nev && sl->d->ev_time[sl->next] <= stop) {
+      if (n == cap && sl->d->ev_time[sl->next] > times[n-1]) {
+	stop = times[n-1];
+	break;
+      }
+      if (_rd_ev_sig (r, sl) != s) {
+	_rd_apply_next (r, sl);
+      }
+      else if (_rd_apply_changed (r, s, sl)) {
+	if (sl->d->ev_time[sl->next] > times[n-1]) {
+	  times[n] = sl->d->ev_time[sl->next];
+	  n++;
+	}
+	/* several events at one time leave the last value */
+	vals[n-1] = lxt2_get_signal (handle, sig);
+	if (nw > 0) {
+	  _rd_hist_keep (r, n-1, nw, vals[n-1]);
+	}
+      }
+      sl->next++;
+    }
+    if (sl->next < sl->d->nev) {
+      break;
+    }
+    _rd_release (r, sl);
+  }
+  r->cur = stop;
+  _rd_run (r, stop);
+  for (k=0; nw > 0 && k < n; k++) {
+    vals[k].valp = r->hist + k*nw;
+  }
+  return n;
+}
+
+/*
+  Channel states are written as z, z01 (receive blocked) and z10 (send
+  blocked), filled with z on the left; channels narrower than three
+  bits only have z.
+*/
+static act_chan_state_t _rd_chan_state (struct lxt2_rd_sig *s)
+{
+  int i;
+
+  for (i=0; i < s->len && s->bits[i] == 'z'; i++)
+    ;
+  if (i == s->len) {
+    return ACT_CHAN_IDLE;
+  }
+  if (i > 0 && i == s->len - 2) {
+    if (s->bits[i] == '0' && s->bits[i+1] == '1') {
+      return ACT_CHAN_RECV_BLOCKED;
+    }
+    if (s->bits[i] == '1' && s->bits[i+1] == '0') {
+      return ACT_CHAN_SEND_BLOCKED;
+    }
+  }
+  return ACT_CHAN_VALUE;
+}
+
+/* can the predicate hold after a change of signal si in this block? */
+static int _rd_sum_may (struct local_lxt2_reader *r,
+			struct lxt2_rd_slot *sl, int si,
+			const act_trace_pred_t *p)
+{
+  struct lxt2_rd_sig *s = &r->sig[si];
+  struct lxt2_rd_sum *u;
+
+  if (si >= sl->d->nsum || sl->d->sum[si].nev == 0) {
+    return 0;
+  }
+  u = &sl->d->sum[si];
+  if (u->any) {
+    return 1;
+  }
+  switch (p->op) {
+  case ACT_PRED_RISE:
+    return (s->len == 1) && (u->seen & LXT2_RD_SEEN_1);
+  case ACT_PRED_FALL:
+    return (s->len == 1) && (u->seen & LXT2_RD_SEEN_0);
+  case ACT_PRED_EQ:
+    if (s->analog) {
+      return u->bounded && p->v.v >= u->rmin && p->v.v <= u->rmax;
+    }
+    if (s->len == 1) {
+      switch (p->v.val) {
+      case ACT_SIG_BOOL_FALSE: return (u->seen & LXT2_RD_SEEN_0);
+      case ACT_SIG_BOOL_TRUE: return (u->seen & LXT2_RD_SEEN_1);
+      case ACT_SIG_BOOL_X: return (u->seen & LXT2_RD_SEEN_X);
+      case ACT_SIG_BOOL_Z: return (u->seen & LXT2_RD_SEEN_Z);
+      default: return 0;
+      }
+    }
+    return u->bounded && p->v.val >= u->min && p->v.val <= u->max;
+  case ACT_PRED_CHAN_STATE:
+    if (p->state == ACT_CHAN_VALUE) {
+      return (u->seen & LXT2_RD_SEEN_VAL);
+    }
+    return (u->seen & LXT2_RD_SEEN_Z);
+  default:
+    return 1;
+  }
+}
+
+/* does the predicate hold for the new value of signal si? */
+static int _rd_pred (void *handle, int si, const act_trace_pred_t *p)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct lxt2_rd_sig *s = &r->sig[si];
+  act_signal_val_t v;
+
+  switch (p->op) {
+  case ACT_PRED_CHANGE:
+    return 1;
+  case ACT_PRED_RISE:
+    return (s->len == 1 && !s->analog && s->bits[0] == '1');
+  case ACT_PRED_FALL:
+    return (s->len == 1 && !s->analog && s->bits[0] == '0');
+  case ACT_PRED_EQ:
+    v = lxt2_get_signal (handle, (void *)((long)si + 1));
+    if (s->analog) {
+      return (v.v == p->v.v);
+    }
+    if (s->len <= 64) {
+      return (v.val == p->v.val);
+    }
+    return (memcmp (v.valp, p->v.valp, sizeof (unsigned long)*
+		    ACT_TRACE_WIDE_NUM (s->len)) == 0);
+  case ACT_PRED_CHAN_STATE:
+    return (!s->analog && _rd_chan_state (s) == p->state);
+  default:
+    return 0;
+  }
+}
+
+/*
+  Like lxt2_next_change() for one signal and a predicate, except that
+  the reader ends up after all the changes at the time found. Blocks
+  whose summary rules the predicate out are applied without looking at
+  the changes of the signal.
+*/
+int lxt2_find_next (void *handle, void *sig, act_trace_pred_t pred,
+		    act_trace_change_t *out)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  int si = ((long)sig) - 1;
+  struct lxt2_rd_sig *s = &r->sig[si];
+  struct lxt2_rd_slot *sl;
+
+  _rd_start (r);
+  while (r->use < r->f->nblk) {
+    sl = _rd_current (r);
+    if (!_rd_sum_may (r, sl, si, &pred)) {
+      while (sl->next < sl->d->nev) {
+	_rd_apply_next (r, sl);
+	sl->next++;
+      }
+    }
+    while (sl->next < sl->d->nev) {
+      if (sl->d->ev_sig[sl->next] != si) {
+	_rd_apply_next (r, sl);
+      }
+      else if (_rd_apply_changed (r, s, sl) && _rd_pred (handle, si, &pred)) {
+	if (sl->d->ev_time[sl->next] > r->cur) {
+	  r->cur = sl->d->ev_time[sl->next];
+	}
+	sl->next++;
+	out->sig = sig;
+	out->step = r->cur;
+	out->t = r->cur * r->f->ts;
+	out->v = lxt2_get_signal (handle, sig);
+	/* the other changes at this time */
+	_rd_run (r, r->cur);
+	return 1;
+      }
+      sl->next++;
+    }
+    _rd_release (r, sl);
+  }
+  if (r->f->nblk > 0 && r->cur < r->f->blk[r->f->nblk-1].t1) {
+    r->cur = r->f->blk[r->f->nblk-1].t1;
+  }
+  return 0;
+}
+
+
+/*
+  Another cursor on the same file, at time 0, following the signals
+  looked up on this one. Blocks decoded by either are shared through
+  the file's cache. Each cursor can be used by a different thread.
+*/
+void *lxt2_cursor (void *handle)
+{
+  struct local_lxt2_reader *r = (struct local_lxt2_reader *)handle;
+  struct local_lxt2_reader *c;
+  struct lxt2_rd_sig *s;
+  int i;
+
+  c = _rd_new (r->f);
+  c->gen = r->gen;
+  c->nsig = r->nsig;
+  c->maxsig = r->nsig;
+  c->sig = (struct lxt2_rd_sig *)
+    _rd_realloc (NULL, sizeof (struct lxt2_rd_sig)*c->maxsig);
+  memset (c->sig, 0, sizeof (struct lxt2_rd_sig)*c->maxsig);
+  for (i=0; i < r->nsig; i++) {
+    if (!r->sig[i].bits) {
+      continue;
+    }
+    s = &c->sig[i];
+    s->fac = r->sig[i].fac;
+    s->len = r->sig[i].len;
+    s->analog = r->sig[i].analog;
+    s->dirty = 1;
+    s->bits = (char *) _rd_realloc (NULL, s->len);
+    memset (s->bits, 'x', s->len);
+    if (r->sig[i].wide) {
+      s->wide = (unsigned long *)
+	_rd_realloc (NULL, sizeof (unsigned long)*ACT_TRACE_WIDE_NUM (s->len));
+    }
+  }
+  return c;
+}
+
+/* the reader part of lxt2_set_option() */
+static int _rd_set_option (struct local_lxt2_reader *r, const char *key,
+			   const char *value)
+{
+  char *end;
+  long v;
+
+  if (!strcmp (key, "cache")) {
+    v = strtol (value, &end, 10);
+    if (end == value || *end || v < 0) {
+      fprintf (stderr, "WARNING: lxt2: bad value `%s' for option `%s'\n",
+	       value, key);
+      return 0;
+    }
+    pthread_mutex_lock (&r->f->lock);
+    r->f->maxbytes = (size_t)v << 20;
+    _rd_cache_trim (r->f);
+    pthread_mutex_unlock (&r->f->lock);
+    return 1;
+  }
+  return 0;
+}
+
+int lxt2_close (void *handle)
+{
+  struct local_lxt2_state *st = (struct local_lxt2_state *)handle;
+
+  if (st->_reader) {
+    _rd_free ((struct local_lxt2_reader *)handle);
+    return 1;
+  }
   lxt2_wr_close (st->f);
   free (st);
   return 1;
@@ -173,3 +173,78 @@ int prefix_close (void *handle)
 {
   return 0;
 }
+
+/** optional: format-specific settings; return 1 if applied **/
+
+int prefix_set_option (void *handle, const char *key, const char *value)
+{
+  return 0;
+}
+
+/** optional: values of several signals at once; otherwise get_signal
+    is called for each one **/
+
+void prefix_get_signals (void *handle, void **signals, int n,
+			 act_signal_val_t *out)
+{
+  return;
+}
+
+/** optional: move to a time in units of dt, also backward; return 1
+    on success **/
+
+int prefix_seek (void *handle, unsigned long step)
+{
+  return 0;
+}
+
+/** optional: the bit width of a digital signal, so that tracelib
+    can compare values wider than 64 bits word by word **/
+
+int prefix_signal_width (void *handle, void *signal)
+{
+  return 1;
+}
+
+/** optional: change-driven reading; otherwise tracelib steps through
+    the trace and compares the watched signals **/
+
+int prefix_watch (void *handle, void *signal)
+{
+  return 0;
+}
+
+int prefix_next_change (void *handle, act_trace_change_t *out)
+{
+  return 0;
+}
+
+/** optional: advance to the next change of one signal after which
+    pred holds; otherwise tracelib steps through the trace **/
+
+int prefix_find_next (void *handle, void *signal, act_trace_pred_t pred,
+		      act_trace_change_t *out)
+{
+  return 0;
+}
+
+/** optional: the value at s0 and the changes of one signal up to s1
+    (units of dt), at most cap entries; return the number stored.
+    Otherwise tracelib steps through the window **/
+
+long prefix_get_history (void *handle, void *signal,
+			 unsigned long s0, unsigned long s1,
+			 unsigned long *times, act_signal_val_t *vals,
+			 long cap)
+{
+  return 0;
+}
+
+/** optional: another reader on the file opened as handle, at time 0,
+    following the signals looked up on it and sharing what was
+    decoded; each may be used by a different thread **/
+
+void *prefix_cursor (void *handle)
+{
+  return NULL;
+}
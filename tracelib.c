@@ -34,6 +34,88 @@
     }									\
   } while (0)
 
+/*
+  act_trace_next_change() for formats without it: step through the
+  trace one dt at a time and compare the watched signals with their
+  previous values.
+*/
+struct act_trace_watch {
+  int n, max;
+  void **sig;
+  int *analog;
+  int *nw;			/* words of a wide value, else 0 */
+  act_signal_val_t *last;
+  unsigned long **wlast;	/* copies of wide values */
+  int next;			/* signal to compare next at this step;
+				   -1: time moved, re-read the values */
+};
+
+static float _trace_dt (act_trace_t *t)
+{
+  float stop;
+  if (t->dt < 0) {
+    (*t->t->read_header) (t->handle, &stop, &t->dt);
+  }
+  return t->dt;
+}
+
+/*
+  Words of sig's value at valp, or 0 if the value is in val or v.
+  Formats that do not report widths are taken to have no wide values.
+*/
+static int _trace_words (act_trace_t *t, void *sig)
+{
+  int w;
+
+  if (!t->t->signal_width ||
+      (*t->t->signal_type) (t->handle, sig) == ACT_SIG_ANALOG) {
+    return 0;
+  }
+  w = (*t->t->signal_width) (t->handle, sig);
+  return (w > 64) ? ACT_TRACE_WIDE_NUM (w) : 0;
+}
+
+/* wide values are copied, since valp points into the reader */
+static void _watch_set (struct act_trace_watch *w, int i, act_signal_val_t v)
+{
+  w->last[i] = v;
+  if (w->nw[i] > 0) {
+    memcpy (w->wlast[i], v.valp, sizeof (unsigned long)*w->nw[i]);
+  }
+}
+
+static int _watch_changed (struct act_trace_watch *w, int i,
+			   act_signal_val_t v)
+{
+  if (w->nw[i] > 0) {
+    return memcmp (v.valp, w->wlast[i],
+		   sizeof (unsigned long)*w->nw[i]) != 0;
+  }
+  if (w->analog[i]) {
+    return v.v != w->last[i].v;
+  }
+  return v.val != w->last[i].val;
+}
+
+static void _watch_free (act_trace_t *t)
+{
+  struct act_trace_watch *w = (struct act_trace_watch *)t->watch;
+  if (w) {
+    for (int i=0; i < w->n; i++) {
+      if (w->wlast[i]) {
+	free (w->wlast[i]);
+      }
+    }
+    free (w->sig);
+    free (w->analog);
+    free (w->nw);
+    free (w->last);
+    free (w->wlast);
+    free (w);
+    t->watch = NULL;
+  }
+}
+
 act_extern_trace_func_t *act_trace_load_format (const char *prefix, const char *dl)
 {
   void *dlib;
@@ -91,11 +173,22 @@ act_extern_trace_func_t *act_trace_load_format (const char *prefix, const char *
        { "header", (void **)&t.read_header, 0 },
        { "signal_lookup", (void **)&t.signal_lookup, 0 },
        { "signal_type", (void **)&t.signal_type, 0 },
+       { "signal_width", (void **)&t.signal_width, 0 },
 
        { "advance_time", (void **)&t.advance_time, 0 },
        { "advance_time_by", (void **)&t.advance_time_by, 0 },
        { "get_signal", (void **)&t.get_signal, 0 },
+       { "get_signals", (void **)&t.get_signals, 0 },
+       { "seek", (void **)&t.seek, 0 },
+       { "watch", (void **)&t.watch, 0 },
+       { "next_change", (void **)&t.next_change, 0 },
+       { "find_next", (void **)&t.find_next, 0 },
+       { "get_history", (void **)&t.get_history, 0 },
+       { "cursor", (void **)&t.cursor, 0 },
        { "has_more_data", (void **)&t.has_more_data, 0 },
+
+       /* backend settings */
+       { "set_option", (void **)&t.set_option, 0 },
        
        { NULL, NULL, 0 }
       };
@@ -389,6 +482,11 @@ act_trace_t *act_trace_create (act_extern_trace_func_t *tlib,
   t->state = 0;
   t->t = tlib;
   t->handle = NULL;
+  t->watch = NULL;
+  t->hist = NULL;
+  t->maxhist = 0;
+  t->step = 0;
+  t->dt = -1;
   t->readonly = 0;
 
   if (mode == 0) {
@@ -517,6 +615,17 @@ int act_trace_init_end (act_trace_t *t)
   return (*t->t->init_end) (t->handle);
 }
 
+int act_trace_set_option (act_trace_t *t, const char *key,
+			  const char *value)
+{
+  if (!t || !key || !value) return 0;
+
+  if (!t->t->set_option) {
+    return 0;
+  }
+  return (*t->t->set_option) (t->handle, key, value);
+}
+
 int act_trace_close (act_trace_t *t)
 {
   int ret;
@@ -532,6 +641,10 @@ int act_trace_close (act_trace_t *t)
     return 0;
   }
   ret = (*t->t->close_tracefile) (t->handle);
+  _watch_free (t);
+  if (t->hist) {
+    free (t->hist);
+  }
   free (t);
   return ret;
 }
@@ -867,6 +980,11 @@ act_trace_t *act_trace_open (act_extern_trace_func_t *tlib,
   t->state = 0;
   t->t = tlib;
   t->handle = NULL;
+  t->watch = NULL;
+  t->hist = NULL;
+  t->maxhist = 0;
+  t->step = 0;
+  t->dt = -1;
   t->readonly = 1;
 
   if (mode == 0) {
@@ -890,6 +1008,41 @@ act_trace_t *act_trace_open (act_extern_trace_func_t *tlib,
   return t;
 }
 
+act_trace_t *act_trace_cursor (act_trace_t *t)
+{
+  act_trace_t *c;
+
+  if (!t) {
+    return NULL;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_cursor() called while writing\n");
+    return NULL;
+  }
+  if (!t->t->cursor) {
+    return NULL;
+  }
+
+  NEW (c, act_trace_t);
+
+  c->state = 5;
+  c->t = t->t;
+  c->handle = (*t->t->cursor) (t->handle);
+  c->watch = NULL;
+  c->hist = NULL;
+  c->maxhist = 0;
+  c->step = 0;
+  c->dt = t->dt;
+  c->readonly = 1;
+  c->mode = t->mode;
+
+  if (!c->handle) {
+    free (c);
+    return NULL;
+  }
+  return c;
+}
+
 void act_trace_header (act_trace_t *t, float *stop_time, float *dt)
 {
   *stop_time = -1;
@@ -939,6 +1092,12 @@ void act_trace_advance_steps (act_trace_t *t, int steps)
     return;
   }
   (*t->t->advance_time) (t->handle, steps);
+  if (steps > 0) {
+    t->step += steps;
+    if (t->watch) {
+      ((struct act_trace_watch *)t->watch)->next = -1;
+    }
+  }
 }
 
 void act_trace_advance_time (act_trace_t *t, float dt)
@@ -951,6 +1110,14 @@ void act_trace_advance_time (act_trace_t *t, float dt)
     return;
   }
   (*t->t->advance_time_by) (t->handle, dt);
+  if (dt > 0) {
+    if (_trace_dt (t) > 0) {
+      t->step += (unsigned long) (dt/t->dt + 0.5);
+    }
+    if (t->watch) {
+      ((struct act_trace_watch *)t->watch)->next = -1;
+    }
+  }
 }
 
 int act_trace_has_more_data (act_trace_t *t)
@@ -979,6 +1146,1368 @@ act_signal_val_t act_trace_get_signal (act_trace_t *t, void *sig)
   return (t->t->get_signal) (t->handle, sig);
 }
 
+void act_trace_get_signals (act_trace_t *t, void **sigs, int n,
+			    act_signal_val_t *out)
+{
+  if (!t || n <= 0) {
+    return;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_get_signals() called while writing\n");
+    for (int i=0; i < n; i++) {
+      out[i].val = 0;
+    }
+    return;
+  }
+  if (t->t->get_signals) {
+    (*t->t->get_signals) (t->handle, sigs, n, out);
+  }
+  else {
+    for (int i=0; i < n; i++) {
+      out[i] = (*t->t->get_signal) (t->handle, sigs[i]);
+    }
+  }
+}
+
+static int _trace_seek_step (act_trace_t *t, unsigned long step)
+{
+  if (t->t->seek) {
+    if (!(*t->t->seek) (t->handle, step)) {
+      return 0;
+    }
+  }
+  else if (step < t->step) {
+    /* the format can only move forward */
+    return 0;
+  }
+  else {
+    unsigned long n = step - t->step;
+    while (n > 0) {
+      int k = (n > 0x7fffffffUL) ? 0x7fffffff : (int)n;
+      if (t->t->advance_time) {
+	(*t->t->advance_time) (t->handle, k);
+      }
+      else {
+	(*t->t->advance_time_by) (t->handle, k*t->dt);
+      }
+      n -= k;
+    }
+  }
+  t->step = step;
+  if (t->watch) {
+    ((struct act_trace_watch *)t->watch)->next = -1;
+  }
+  return 1;
+}
+
+int act_trace_seek (act_trace_t *t, float tm)
+{
+  float dt;
+
+  if (!t) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_seek() called while writing\n");
+    return 0;
+  }
+  dt = _trace_dt (t);
+  if (dt <= 0) {
+    return 0;
+  }
+  return _trace_seek_step (t, (tm > 0) ? (unsigned long) (tm/dt + 0.5) : 0);
+}
+
+int act_trace_step_back (act_trace_t *t, int steps)
+{
+  if (!t) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_step_back() called while writing\n");
+    return 0;
+  }
+  if (steps <= 0) {
+    return 1;
+  }
+  if (!t->t->seek || _trace_dt (t) <= 0) {
+    return 0;
+  }
+  return _trace_seek_step (t, ((unsigned long)steps < t->step) ?
+			   t->step - steps : 0);
+}
+
+int act_trace_watch (act_trace_t *t, void *sig)
+{
+  struct act_trace_watch *w;
+
+  if (!t || !sig) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_watch() called while writing\n");
+    return 0;
+  }
+  if (t->t->watch && t->t->next_change) {
+    return (*t->t->watch) (t->handle, sig);
+  }
+
+  w = (struct act_trace_watch *)t->watch;
+  if (!w) {
+    NEW (w, struct act_trace_watch);
+    w->n = 0;
+    w->max = 0;
+    w->sig = NULL;
+    w->analog = NULL;
+    w->nw = NULL;
+    w->last = NULL;
+    w->wlast = NULL;
+    w->next = 0;
+    t->watch = w;
+  }
+  for (int i=0; i < w->n; i++) {
+    if (w->sig[i] == sig) {
+      return 1;
+    }
+  }
+  if (w->n == w->max) {
+    w->max = w->max ? 2*w->max : 16;
+    w->sig = (void **) realloc (w->sig, sizeof (void *)*w->max);
+    w->analog = (int *) realloc (w->analog, sizeof (int)*w->max);
+    w->nw = (int *) realloc (w->nw, sizeof (int)*w->max);
+    w->last = (act_signal_val_t *)
+      realloc (w->last, sizeof (act_signal_val_t)*w->max);
+    w->wlast = (unsigned long **)
+      realloc (w->wlast, sizeof (unsigned long *)*w->max);
+    if (!w->sig || !w->analog || !w->nw || !w->last || !w->wlast) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       (sizeof (void *) + 2*sizeof (int) +
+		sizeof (act_signal_val_t) + sizeof (unsigned long *))*w->max);
+      exit (1);
+    }
+  }
+  w->sig[w->n] = sig;
+  w->analog[w->n] =
+    ((*t->t->signal_type) (t->handle, sig) == ACT_SIG_ANALOG);
+  w->nw[w->n] = _trace_words (t, sig);
+  w->wlast[w->n] = NULL;
+  if (w->nw[w->n] > 0) {
+    w->wlast[w->n] = (unsigned long *)
+      malloc (sizeof (unsigned long)*w->nw[w->n]);
+    if (!w->wlast[w->n]) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       sizeof (unsigned long)*w->nw[w->n]);
+      exit (1);
+    }
+  }
+  _watch_set (w, w->n, (*t->t->get_signal) (t->handle, sig));
+  w->n++;
+  return 1;
+}
+
+int act_trace_next_change (act_trace_t *t, act_trace_change_t *out)
+{
+  struct act_trace_watch *w;
+
+  if (!t) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_next_change() called while writing\n");
+    return 0;
+  }
+  if (t->t->watch && t->t->next_change) {
+    if (!(*t->t->next_change) (t->handle, out)) {
+      return 0;
+    }
+    t->step = out->step;
+    return 1;
+  }
+
+  w = (struct act_trace_watch *)t->watch;
+  if (!w || w->n == 0) {
+    return 0;
+  }
+  if (w->next < 0) {
+    for (int i=0; i < w->n; i++) {
+      _watch_set (w, i, (*t->t->get_signal) (t->handle, w->sig[i]));
+    }
+    w->next = w->n;
+  }
+  while (1) {
+    while (w->next < w->n) {
+      int i = w->next++;
+      act_signal_val_t v = (*t->t->get_signal) (t->handle, w->sig[i]);
+      if (_watch_changed (w, i, v)) {
+	_watch_set (w, i, v);
+	out->sig = w->sig[i];
+	out->step = t->step;
+	out->t = t->step*_trace_dt (t);
+	out->v = v;
+	return 1;
+      }
+    }
+    if (!(*t->t->has_more_data) (t->handle)) {
+      return 0;
+    }
+    if (t->t->advance_time) {
+      (*t->t->advance_time) (t->handle, 1);
+    }
+    else {
+      (*t->t->advance_time_by) (t->handle, _trace_dt (t));
+    }
+    t->step++;
+    w->next = 0;
+  }
+}
+
+/*
+  Search back in windows that double in size: seek to the start of the
+  window, and keep the last change before the starting time.
+*/
+int act_trace_prev_change (act_trace_t *t, act_trace_change_t *out)
+{
+  act_trace_change_t c, last;
+  unsigned long cur, from, win;
+  int found;
+
+  if (!t) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_prev_change() called while writing\n");
+    return 0;
+  }
+  if (!t->t->seek || _trace_dt (t) <= 0 || t->step == 0) {
+    return 0;
+  }
+  cur = t->step;
+  win = 64;
+  while (1) {
+    from = (cur > win) ? cur - win : 0;
+    if (!_trace_seek_step (t, from)) {
+      return 0;
+    }
+    found = 0;
+    while (act_trace_next_change (t, &c) && c.step < cur) {
+      last = c;
+      found = 1;
+    }
+    if (found) {
+      _trace_seek_step (t, last.step);
+      *out = last;
+      out->v = act_trace_get_signal (t, last.sig);
+      return 1;
+    }
+    if (from == 0) {
+      _trace_seek_step (t, cur);
+      return 0;
+    }
+    win *= 2;
+  }
+}
+
+/* nw: words of a wide value, else 0 */
+static int _trace_pred (act_signal_type_t type, int nw, act_signal_val_t v,
+			const act_trace_pred_t *p)
+{
+  switch (p->op) {
+  case ACT_PRED_CHANGE:
+    return 1;
+  case ACT_PRED_RISE:
+    return (type == ACT_SIG_BOOL && v.val == ACT_SIG_BOOL_TRUE);
+  case ACT_PRED_FALL:
+    return (type == ACT_SIG_BOOL && v.val == ACT_SIG_BOOL_FALSE);
+  case ACT_PRED_EQ:
+    if (nw > 0) {
+      return memcmp (v.valp, p->v.valp, sizeof (unsigned long)*nw) == 0;
+    }
+    return (type == ACT_SIG_ANALOG) ? (v.v == p->v.v) : (v.val == p->v.val);
+  case ACT_PRED_CHAN_STATE:
+    /* the atrace encoding: states, then values offset past them */
+    if (type != ACT_SIG_CHAN) {
+      return 0;
+    }
+    return (v.val < ACT_CHAN_VALUE ? (act_chan_state_t)v.val :
+	    ACT_CHAN_VALUE) == p->state;
+  default:
+    return 0;
+  }
+}
+
+/*
+  The fallback steps one dt at a time, and, like the
+  act_trace_next_change() fallback, compares a copy of the words of a
+  wide value.
+*/
+int act_trace_find_next (act_trace_t *t, void *sig, act_trace_pred_t pred,
+			 act_trace_change_t *out)
+{
+  act_signal_type_t type;
+  act_signal_val_t v, last;
+  unsigned long *wlast = NULL;
+  int nw, changed;
+  int found = 0;
+
+  if (!t || !sig || !out) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_find_next() called while writing\n");
+    return 0;
+  }
+  if (t->t->find_next) {
+    found = (*t->t->find_next) (t->handle, sig, pred, out);
+    if (found) {
+      t->step = out->step;
+    }
+  }
+  else if (_trace_dt (t) > 0) {
+    type = (*t->t->signal_type) (t->handle, sig);
+    nw = _trace_words (t, sig);
+    last = (*t->t->get_signal) (t->handle, sig);
+    if (nw > 0) {
+      wlast = (unsigned long *) malloc (sizeof (unsigned long)*nw);
+      if (!wlast) {
+	fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+		 sizeof (unsigned long)*nw);
+	exit (1);
+      }
+      memcpy (wlast, last.valp, sizeof (unsigned long)*nw);
+    }
+    while (!found && (*t->t->has_more_data) (t->handle)) {
+      if (t->t->advance_time) {
+	(*t->t->advance_time) (t->handle, 1);
+      }
+      else {
+	(*t->t->advance_time_by) (t->handle, t->dt);
+      }
+      t->step++;
+      v = (*t->t->get_signal) (t->handle, sig);
+      if (nw > 0) {
+	changed = memcmp (v.valp, wlast, sizeof (unsigned long)*nw) != 0;
+	if (changed) {
+	  memcpy (wlast, v.valp, sizeof (unsigned long)*nw);
+	}
+      }
+      else {
+	changed = (type == ACT_SIG_ANALOG) ? (v.v != last.v) : (v.val != last.val);
+      }
+      if (changed) {
+	if (_trace_pred (type, nw, v, &pred)) {
+	  out->sig = sig;
+	  out->step = t->step;
+	  out->t = t->step*t->dt;
+	  out->v = v;
+	  found = 1;
+	}
+	last = v;
+      }
+    }
+  }
+  if (wlast) {
+    free (wlast);
+  }
+  if (t->watch) {
+    ((struct act_trace_watch *)t->watch)->next = -1;
+  }
+  return found;
+}
+
+/* keep wide value k of a history, since valp points into the reader */
+static void _trace_hist_keep (act_trace_t *t, long k, int nw,
+			      act_signal_val_t v)
+{
+  if ((k+1)*nw > t->maxhist) {
+    t->maxhist = 2*(k+1)*nw;
+    t->hist = (unsigned long *)
+      realloc (t->hist, sizeof (unsigned long)*t->maxhist);
+    if (!t->hist) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       sizeof (unsigned long)*t->maxhist);
+      exit (1);
+    }
+  }
+  memcpy (t->hist + k*nw, v.valp, sizeof (unsigned long)*nw);
+}
+
+/*
+  The fallback steps through the window one dt at a time. Like the
+  act_trace_next_change() fallback, it compares the words of a wide
+  value; those are kept in t->hist, and vals[] points there once the
+  history is complete.
+*/
+static long _trace_history (act_trace_t *t, void *sig,
+			    unsigned long s0, unsigned long s1,
+			    unsigned long *times, act_signal_val_t *vals,
+			    long cap)
+{
+  act_signal_val_t v;
+  long n;
+  int analog, nw;
+
+  if (t->t->get_history) {
+    n = (*t->t->get_history) (t->handle, sig, s0, s1, times, vals, cap);
+    if (n > 0) {
+      t->step = (n == cap) ? times[n-1] : s1;
+      if (t->watch) {
+	((struct act_trace_watch *)t->watch)->next = -1;
+      }
+    }
+    return n;
+  }
+
+  if (!_trace_seek_step (t, s0)) {
+    return 0;
+  }
+  analog = ((*t->t->signal_type) (t->handle, sig) == ACT_SIG_ANALOG);
+  nw = _trace_words (t, sig);
+  times[0] = s0;
+  vals[0] = (*t->t->get_signal) (t->handle, sig);
+  if (nw > 0) {
+    _trace_hist_keep (t, 0, nw, vals[0]);
+  }
+  n = 1;
+  while (n < cap && t->step < s1 && (*t->t->has_more_data) (t->handle)) {
+    if (t->t->advance_time) {
+      (*t->t->advance_time) (t->handle, 1);
+    }
+    else {
+      (*t->t->advance_time_by) (t->handle, t->dt);
+    }
+    t->step++;
+    v = (*t->t->get_signal) (t->handle, sig);
+    if (nw > 0) {
+      if (memcmp (v.valp, t->hist + (n-1)*nw,
+		  sizeof (unsigned long)*nw) != 0) {
+	times[n] = t->step;
+	vals[n] = v;
+	_trace_hist_keep (t, n, nw, v);
+	n++;
+      }
+    }
+    else if (analog ? (v.v != vals[n-1].v) : (v.val != vals[n-1].val)) {
+      times[n] = t->step;
+      vals[n] = v;
+      n++;
+    }
+  }
+  for (long k=0; nw > 0 && k < n; k++) {
+    vals[k].valp = t->hist + k*nw;
+  }
+  if (t->step < s1 && n < cap) {
+    _trace_seek_step (t, s1);
+  }
+  if (t->watch) {
+    ((struct act_trace_watch *)t->watch)->next = -1;
+  }
+  return n;
+}
+
+long act_trace_get_history (act_trace_t *t, void *sig, float t0, float t1,
+			    unsigned long *times, act_signal_val_t *vals,
+			    long cap)
+{
+  float dt;
+
+  if (!t || !sig || !times || !vals || cap <= 0) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_get_history() called while writing\n");
+    return 0;
+  }
+  dt = _trace_dt (t);
+  if (dt <= 0 || t1 < t0) {
+    return 0;
+  }
+  return _trace_history (t, sig,
+			 (t0 > 0) ? (unsigned long) (t0/dt + 0.5) : 0,
+			 (t1 > 0) ? (unsigned long) (t1/dt + 0.5) : 0,
+			 times, vals, cap);
+}
+
+/*
+  Sample positions in units of dt: times[j]/dt if a list of times is
+  given, otherwise the grid t0 + j*period.
+*/
+static double _trace_sample_x (act_trace_t *t, const float *times,
+			       float t0, float period, long j)
+{
+  double x = times ? times[j] : (t0 + (double)j*period);
+  return (x > 0) ? x/t->dt : 0;
+}
+
+#define ACT_TRACE_HIST_CHUNK 256
+
+/*
+  Linear interpolation of one analog signal between its recorded
+  points, read through _trace_history() in chunks. The point before
+  the first sample is found in windows that double in size, as in
+  act_trace_prev_change(). Samples after the last point hold its
+  value. Returns 0 if the history cannot be read.
+*/
+static int _trace_analog_column (act_trace_t *t, void *sig,
+				 const float *times, float t0, float period,
+				 long m, unsigned long send,
+				 act_signal_val_t *col)
+{
+  unsigned long ht[ACT_TRACE_HIST_CHUNK];
+  act_signal_val_t hv[ACT_TRACE_HIST_CHUNK];
+  unsigned long s0, from, win, c0;
+  double x;
+  float v0;
+  long j, k, n;
+  int more;
+
+  s0 = (unsigned long) _trace_sample_x (t, times, t0, period, 0);
+  win = 64;
+  while (1) {
+    from = (s0 > win) ? s0 - win : 0;
+    n = _trace_history (t, sig, from, s0, ht, hv, ACT_TRACE_HIST_CHUNK);
+    if (n == 0) {
+      return 0;
+    }
+    more = (n > 1);
+    while (n == ACT_TRACE_HIST_CHUNK && ht[n-1] < s0) {
+      n = _trace_history (t, sig, ht[n-1], s0, ht, hv,
+			  ACT_TRACE_HIST_CHUNK);
+    }
+    if (more || n > 1 || from == 0) {
+      break;
+    }
+    win *= 2;
+  }
+  c0 = ht[n-1];
+  v0 = hv[n-1].v;
+
+  /* the buffer is refilled from its last point, which is entry 0 of
+     the next chunk */
+  k = n;
+  more = 1;
+  for (j=0; j < m; j++) {
+    x = _trace_sample_x (t, times, t0, period, j);
+    while (1) {
+      if (k == n && more) {
+	from = ht[n-1];
+	n = _trace_history (t, sig, from, send, ht, hv,
+			    ACT_TRACE_HIST_CHUNK);
+	if (n == 0) {
+	  return 0;
+	}
+	more = (n == ACT_TRACE_HIST_CHUNK);
+	k = 1;
+      }
+      if (k >= n || ht[k] > x) {
+	break;
+      }
+      c0 = ht[k];
+      v0 = hv[k].v;
+      k++;
+    }
+    if (k < n && ht[k] > c0) {
+      col[j].v = v0 + (hv[k].v - v0)*(x - c0)/(ht[k] - c0);
+    }
+    else {
+      col[j].v = v0;
+    }
+  }
+  return 1;
+}
+
+static int _trace_sample (act_trace_t *t, const char *fn,
+			  void **sigs, int n, const float *times,
+			  float t0, float period, long m,
+			  act_signal_val_t *out)
+{
+  act_signal_val_t *row;
+  unsigned long step, send;
+  float stop;
+  long j;
+  int i;
+
+  if (!t || !sigs || n <= 0 || m <= 0 || !out) {
+    return 0;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: %s() called while writing\n", fn);
+    return 0;
+  }
+  if (_trace_dt (t) <= 0 || (!times && period < 0)) {
+    return 0;
+  }
+  for (j=1; times && j < m; j++) {
+    if (times[j] < times[j-1]) {
+      fprintf (stderr, "WARNING: %s(): times are not sorted\n", fn);
+      return 0;
+    }
+  }
+
+  /* sample and hold: one pass over the samples, reading all the
+     signals at each one */
+  row = (act_signal_val_t *) malloc (sizeof (act_signal_val_t)*n);
+  if (!row) {
+    fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	     sizeof (act_signal_val_t)*n);
+    exit (1);
+  }
+  for (j=0; j < m; j++) {
+    step = (unsigned long) (_trace_sample_x (t, times, t0, period, j) + 0.5);
+    if ((j == 0 || step != t->step) && !_trace_seek_step (t, step)) {
+      free (row);
+      return 0;
+    }
+    act_trace_get_signals (t, sigs, n, row);
+    for (i=0; i < n; i++) {
+      out[i*m + j] = row[i];
+    }
+  }
+  free (row);
+
+  /* analog signals are then interpolated, which needs to move back */
+  if (!t->t->seek) {
+    return 1;
+  }
+  (*t->t->read_header) (t->handle, &stop, &t->dt);
+  step = t->step;
+  send = (stop > 0) ? (unsigned long) (stop/t->dt + 0.5) : 0;
+  if (send < step + 1) {
+    send = step + 1;
+  }
+  for (i=0; i < n; i++) {
+    if ((*t->t->signal_type) (t->handle, sigs[i]) == ACT_SIG_ANALOG) {
+      _trace_analog_column (t, sigs[i], times, t0, period, m, send,
+			    out + i*m);
+    }
+  }
+  _trace_seek_step (t, step);
+  return 1;
+}
+
+int act_trace_sample (act_trace_t *t, void **sigs, int n,
+		      const float *times, long m, act_signal_val_t *out)
+{
+  if (!times) {
+    return 0;
+  }
+  return _trace_sample (t, "act_trace_sample", sigs, n, times, 0, 0, m, out);
+}
+
+int act_trace_sample_grid (act_trace_t *t, void **sigs, int n,
+			   float t0, float period, long m,
+			   act_signal_val_t *out)
+{
+  return _trace_sample (t, "act_trace_sample_grid", sigs, n, NULL,
+			t0, period, m, out);
+}
+
+/*------------------------------------------------------------------------
+ *
+ *  Trigger expressions
+ *
+ *  An expression over signals is compiled into code for a stack
+ *  machine. The trace is cut into segments at the changes of those
+ *  signals, where all their values are constant, and the code is run
+ *  over a batch of segments at a time: every instruction is a loop
+ *  over the batch, which the compiler can vectorize.
+ *
+ *------------------------------------------------------------------------
+ */
+
+enum {
+  TRIG_SIG, TRIG_CONST, TRIG_SLICE, TRIG_LNOT,
+  TRIG_LOR, TRIG_LAND, TRIG_OR, TRIG_XOR, TRIG_AND,
+  TRIG_EQ, TRIG_NE, TRIG_LT, TRIG_LE, TRIG_GT, TRIG_GE
+};
+
+#define ACT_TRACE_TRIG_BATCH 256
+
+struct act_trace_trig_op {
+  int op;
+  int arg;			/* signal, or shift for TRIG_SLICE */
+  unsigned long k;		/* constant, or mask for TRIG_SLICE */
+};
+
+struct act_trace_trigger {
+  act_trace_t *t;
+
+  int nsig, maxsig;
+  void **sig;
+  int *isbool;			/* booleans read as 1 when true, else 0 */
+
+  struct act_trace_trig_op *code;
+  int ncode, maxcode;
+  int depth, maxdepth;		/* stack depth while compiling, maximum */
+};
+
+struct act_trace_trig_parse {
+  act_trace_trigger_t *tr;
+  const char *expr;
+  const char *p;
+  int err;
+};
+
+static void _trig_error (struct act_trace_trig_parse *ps, const char *msg)
+{
+  if (!ps->err) {
+    fprintf (stderr, "ERROR: trigger `%s': %s at offset %d\n", ps->expr,
+	     msg, (int)(ps->p - ps->expr));
+    ps->err = 1;
+  }
+}
+
+static void _trig_emit (act_trace_trigger_t *tr, int op, int arg,
+			unsigned long k)
+{
+  if (tr->ncode == tr->maxcode) {
+    tr->maxcode = tr->maxcode ? 2*tr->maxcode : 16;
+    tr->code = (struct act_trace_trig_op *)
+      realloc (tr->code, sizeof (struct act_trace_trig_op)*tr->maxcode);
+    if (!tr->code) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       sizeof (struct act_trace_trig_op)*tr->maxcode);
+      exit (1);
+    }
+  }
+  tr->code[tr->ncode].op = op;
+  tr->code[tr->ncode].arg = arg;
+  tr->code[tr->ncode].k = k;
+  tr->ncode++;
+  if (op == TRIG_SIG || op == TRIG_CONST) {
+    if (++tr->depth > tr->maxdepth) {
+      tr->maxdepth = tr->depth;
+    }
+  }
+  else if (op != TRIG_SLICE && op != TRIG_LNOT) {
+    tr->depth--;
+  }
+}
+
+static void _trig_space (struct act_trace_trig_parse *ps)
+{
+  while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n') {
+    ps->p++;
+  }
+}
+
+static int _trig_namechar (char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+
+/* an index group [n] at p; returns its length, or 0 */
+static int _trig_index (const char *p)
+{
+  int i = 1;
+
+  if (p[0] != '[' || p[1] < '0' || p[1] > '9') {
+    return 0;
+  }
+  while (p[i] >= '0' && p[i] <= '9') {
+    i++;
+  }
+  return (p[i] == ']') ? i + 1 : 0;
+}
+
+static int _trig_signal (struct act_trace_trig_parse *ps, const char *s,
+			 int len)
+{
+  act_trace_trigger_t *tr = ps->tr;
+  act_signal_type_t type;
+  char *nm;
+  void *sig;
+  int i;
+
+  nm = (char *) malloc (len + 1);
+  if (!nm) {
+    fprintf (stderr, "FATAL: could not allocate %d bytes\n", len + 1);
+    exit (1);
+  }
+  memcpy (nm, s, len);
+  nm[len] = '\0';
+  sig = act_trace_lookup (tr->t, nm);
+  free (nm);
+  if (!sig) {
+    return -1;
+  }
+  for (i=0; i < tr->nsig; i++) {
+    if (tr->sig[i] == sig) {
+      return i;
+    }
+  }
+  type = act_trace_sigtype (tr->t, sig);
+  if (type == ACT_SIG_ANALOG) {
+    _trig_error (ps, "analog signals are not supported");
+    return -1;
+  }
+  if (tr->nsig == tr->maxsig) {
+    tr->maxsig = tr->maxsig ? 2*tr->maxsig : 8;
+    tr->sig = (void **) realloc (tr->sig, sizeof (void *)*tr->maxsig);
+    tr->isbool = (int *) realloc (tr->isbool, sizeof (int)*tr->maxsig);
+    if (!tr->sig || !tr->isbool) {
+      fprintf (stderr, "FATAL: could not allocate %lu bytes\n",
+	       (sizeof (void *) + sizeof (int))*tr->maxsig);
+      exit (1);
+    }
+  }
+  tr->sig[tr->nsig] = sig;
+  tr->isbool[tr->nsig] = (type == ACT_SIG_BOOL);
+  return tr->nsig++;
+}
+
+/*
+  A signal name, with the dots and [n] of array elements. If the whole
+  name is not in the trace, a final [n] is a bit select instead.
+*/
+static void _trig_name (struct act_trace_trig_parse *ps)
+{
+  const char *start = ps->p;
+  const char *last = NULL;
+  const char *q = ps->p;
+  int i, n;
+
+  while (_trig_namechar (*q)) {
+    q++;
+  }
+  while (1) {
+    if (q[0] == '.' && _trig_namechar (q[1])) {
+      q++;
+      while (_trig_namechar (*q)) {
+	q++;
+      }
+      last = NULL;
+    }
+    else if ((n = _trig_index (q)) > 0) {
+      last = q;
+      q += n;
+    }
+    else {
+      break;
+    }
+  }
+  i = _trig_signal (ps, start, q - start);
+  if (i < 0 && last && !ps->err) {
+    q = last;
+    i = _trig_signal (ps, start, q - start);
+  }
+  if (i < 0) {
+    if (!ps->err) {
+      _trig_error (ps, "unknown signal");
+    }
+    return;
+  }
+  ps->p = q;
+  _trig_emit (ps->tr, TRIG_SIG, i, 0);
+}
+
+static unsigned long _trig_number (struct act_trace_trig_parse *ps)
+{
+  unsigned long v = 0;
+  int base = 10, d, nd = 0;
+
+  if (ps->p[0] == '0' && (ps->p[1] == 'x' || ps->p[1] == 'X')) {
+    base = 16;
+    ps->p += 2;
+  }
+  else if (ps->p[0] == '0' && (ps->p[1] == 'b' || ps->p[1] == 'B')) {
+    base = 2;
+    ps->p += 2;
+  }
+  while (1) {
+    char c = *ps->p;
+    if (c >= '0' && c <= '9') {
+      d = c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+      d = c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F') {
+      d = c - 'A' + 10;
+    }
+    else if (c == '_') {
+      ps->p++;
+      continue;
+    }
+    else {
+      break;
+    }
+    if (d >= base) {
+      break;
+    }
+    v = v*base + d;
+    nd++;
+    ps->p++;
+  }
+  if (nd == 0) {
+    _trig_error (ps, "bad number");
+  }
+  return v;
+}
+
+/* [hi:lo] or [bit] after a signal or parenthesized expression */
+static void _trig_slice (struct act_trace_trig_parse *ps)
+{
+  unsigned long hi, lo;
+
+  ps->p++;
+  _trig_space (ps);
+  hi = _trig_number (ps);
+  _trig_space (ps);
+  lo = hi;
+  if (*ps->p == ':') {
+    ps->p++;
+    _trig_space (ps);
+    lo = _trig_number (ps);
+    _trig_space (ps);
+  }
+  if (ps->err) {
+    return;
+  }
+  if (*ps->p != ']') {
+    _trig_error (ps, "expected `]'");
+    return;
+  }
+  ps->p++;
+  if (hi > 63 || lo > hi) {
+    _trig_error (ps, "bad bit range");
+    return;
+  }
+  _trig_emit (ps->tr, TRIG_SLICE, lo,
+	      (hi - lo == 63) ? ~0UL : ((1UL << (hi - lo + 1)) - 1));
+}
+
+static void _trig_binary (struct act_trace_trig_parse *ps, int prec);
+
+static void _trig_unary (struct act_trace_trig_parse *ps)
+{
+  _trig_space (ps);
+  if (*ps->p == '!') {
+    ps->p++;
+    _trig_unary (ps);
+    _trig_emit (ps->tr, TRIG_LNOT, 0, 0);
+    return;
+  }
+  if (*ps->p == '(') {
+    ps->p++;
+    _trig_binary (ps, 1);
+    _trig_space (ps);
+    if (ps->err) {
+      return;
+    }
+    if (*ps->p != ')') {
+      _trig_error (ps, "expected `)'");
+      return;
+    }
+    ps->p++;
+  }
+  else if (*ps->p >= '0' && *ps->p <= '9') {
+    _trig_emit (ps->tr, TRIG_CONST, 0, _trig_number (ps));
+    return;
+  }
+  else if (_trig_namechar (*ps->p)) {
+    _trig_name (ps);
+  }
+  else {
+    _trig_error (ps, "expected a signal, number, `!' or `('");
+    return;
+  }
+  _trig_space (ps);
+  if (!ps->err && *ps->p == '[') {
+    _trig_slice (ps);
+  }
+}
+
+/* the binary operator at p: C precedence, 1 (||) to 7 (relations) */
+static int _trig_binop (const char *p, int *op, int *len)
+{
+  *len = 2;
+  if (p[0] == '|' && p[1] == '|') { *op = TRIG_LOR; return 1; }
+  if (p[0] == '&' && p[1] == '&') { *op = TRIG_LAND; return 2; }
+  if (p[0] == '=' && p[1] == '=') { *op = TRIG_EQ; return 6; }
+  if (p[0] == '!' && p[1] == '=') { *op = TRIG_NE; return 6; }
+  if (p[0] == '<' && p[1] == '=') { *op = TRIG_LE; return 7; }
+  if (p[0] == '>' && p[1] == '=') { *op = TRIG_GE; return 7; }
+  *len = 1;
+  switch (p[0]) {
+  case '|': *op = TRIG_OR; return 3;
+  case '^': *op = TRIG_XOR; return 4;
+  case '&': *op = TRIG_AND; return 5;
+  case '<': *op = TRIG_LT; return 7;
+  case '>': *op = TRIG_GT; return 7;
+  default: return 0;
+  }
+}
+
+static void _trig_binary (struct act_trace_trig_parse *ps, int prec)
+{
+  int op, len, p;
+
+  _trig_unary (ps);
+  while (!ps->err) {
+    _trig_space (ps);
+    p = _trig_binop (ps->p, &op, &len);
+    if (p < prec) {
+      break;
+    }
+    ps->p += len;
+    _trig_binary (ps, p + 1);
+    _trig_emit (ps->tr, op, 0, 0);
+  }
+}
+
+act_trace_trigger_t *act_trace_trigger_compile (act_trace_t *t,
+						const char *expr)
+{
+  struct act_trace_trig_parse ps;
+  act_trace_trigger_t *tr;
+
+  if (!t || !expr) {
+    return NULL;
+  }
+  if (!t->readonly) {
+    fprintf (stderr, "WARNING: act_trace_trigger_compile() called while writing\n");
+    return NULL;
+  }
+  NEW (tr, act_trace_trigger_t);
+  tr->t = t;
+  tr->nsig = 0;
+  tr->maxsig = 0;
+  tr->sig = NULL;
+  tr->isbool = NULL;
+  tr->code = NULL;
+  tr->ncode = 0;
+  tr->maxcode = 0;
+  tr->depth = 0;
+  tr->maxdepth = 0;
+
+  ps.tr = tr;
+  ps.expr = expr;
+  ps.p = expr;
+  ps.err = 0;
+  _trig_binary (&ps, 1);
+  _trig_space (&ps);
+  if (!ps.err && *ps.p != '\0') {
+    _trig_error (&ps, "unexpected character");
+  }
+  if (ps.err) {
+    act_trace_trigger_free (tr);
+    return NULL;
+  }
+  return tr;
+}
+
+void act_trace_trigger_free (act_trace_trigger_t *tr)
+{
+  if (!tr) {
+    return;
+  }
+  free (tr->sig);
+  free (tr->isbool);
+  free (tr->code);
+  free (tr);
+}
+
+#define TRIG_LOOP(x,y,e)			\
+  do {						\
+    for (j=0; j < nb; j++) {			\
+      x[j] = (e);				\
+    }						\
+  } while (0)
+
+/* run the code over nb segments; col[i] has the values of signal i */
+static unsigned long *_trig_run (act_trace_trigger_t *tr, int nb,
+				 unsigned long *col, unsigned long *stk)
+{
+  unsigned long *x, *y;
+  int pc, sp = 0, j;
+
+  for (pc=0; pc < tr->ncode; pc++) {
+    struct act_trace_trig_op *o = &tr->code[pc];
+    unsigned long k = o->k;
+    int sh = o->arg;
+
+    switch (o->op) {
+    case TRIG_SIG:
+      memcpy (stk + sp*ACT_TRACE_TRIG_BATCH,
+	      col + o->arg*ACT_TRACE_TRIG_BATCH, sizeof (unsigned long)*nb);
+      sp++;
+      continue;
+    case TRIG_CONST:
+      x = stk + sp*ACT_TRACE_TRIG_BATCH;
+      TRIG_LOOP (x, x, k);
+      sp++;
+      continue;
+    case TRIG_SLICE:
+      x = stk + (sp-1)*ACT_TRACE_TRIG_BATCH;
+      TRIG_LOOP (x, x, (x[j] >> sh) & k);
+      continue;
+    case TRIG_LNOT:
+      x = stk + (sp-1)*ACT_TRACE_TRIG_BATCH;
+      TRIG_LOOP (x, x, !x[j]);
+      continue;
+    default:
+      break;
+    }
+    sp--;
+    x = stk + (sp-1)*ACT_TRACE_TRIG_BATCH;
+    y = stk + sp*ACT_TRACE_TRIG_BATCH;
+    switch (o->op) {
+    case TRIG_LOR: TRIG_LOOP (x, y, (x[j] != 0) | (y[j] != 0)); break;
+    case TRIG_LAND: TRIG_LOOP (x, y, (x[j] != 0) & (y[j] != 0)); break;
+    case TRIG_OR: TRIG_LOOP (x, y, x[j] | y[j]); break;
+    case TRIG_XOR: TRIG_LOOP (x, y, x[j] ^ y[j]); break;
+    case TRIG_AND: TRIG_LOOP (x, y, x[j] & y[j]); break;
+    case TRIG_EQ: TRIG_LOOP (x, y, x[j] == y[j]); break;
+    case TRIG_NE: TRIG_LOOP (x, y, x[j] != y[j]); break;
+    case TRIG_LT: TRIG_LOOP (x, y, x[j] < y[j]); break;
+    case TRIG_LE: TRIG_LOOP (x, y, x[j] <= y[j]); break;
+    case TRIG_GT: TRIG_LOOP (x, y, x[j] > y[j]); break;
+    case TRIG_GE: TRIG_LOOP (x, y, x[j] >= y[j]); break;
+    }
+  }
+  return stk;
+}
+
+/* segments collected for evaluation, and the intervals found so far */
+struct act_trace_trig_eval {
+  act_trace_trigger_t *tr;
+  unsigned long seg[ACT_TRACE_TRIG_BATCH];	/* segment start times */
+  unsigned long *col;
+  unsigned long *stk;
+  int nb;
+
+  int open;			/* an interval is open... */
+  unsigned long ostart;		/* ...since this time */
+  unsigned long *start, *end;
+  long n, cap;
+};
+
+static void _trig_flush (struct act_trace_trig_eval *ev)
+{
+  unsigned long *res;
+  int j;
+
+  if (ev->nb == 0) {
+    return;
+  }
+  res = _trig_run (ev->tr, ev->nb, ev->col, ev->stk);
+  for (j=0; j < ev->nb && ev->n < ev->cap; j++) {
+    if (res[j] && !ev->open) {
+      ev->open = 1;
+      ev->ostart = ev->seg[j];
+    }
+    else if (!res[j] && ev->open) {
+      ev->open = 0;
+      ev->start[ev->n] = ev->ostart;
+      ev->end[ev->n] = ev->seg[j];
+      ev->n++;
+    }
+  }
+  ev->nb = 0;
+}
+
+/* a segment starting at step s with the values in v */
+static void _trig_segment (struct act_trace_trig_eval *ev, unsigned long s,
+			   const act_signal_val_t *v)
+{
+  act_trace_trigger_t *tr = ev->tr;
+  int i;
+
+  for (i=0; i < tr->nsig; i++) {
+    ev->col[i*ACT_TRACE_TRIG_BATCH + ev->nb] =
+      tr->isbool[i] ? (v[i].val == ACT_SIG_BOOL_TRUE) : v[i].val;
+  }
+  ev->seg[ev->nb++] = s;
+  if (ev->nb == ACT_TRACE_TRIG_BATCH) {
+    _trig_flush (ev);
+  }
+}
+
+/*
+  Segments from the history of each signal, read in chunks: the next
+  segment starts at the earliest pending change of any signal.
+*/
+static int _trig_segments_history (struct act_trace_trig_eval *ev,
+				   unsigned long s0, unsigned long s1)
+{
+  act_trace_trigger_t *tr = ev->tr;
+  int ns = tr->nsig;
+  unsigned long *ht;
+  act_signal_val_t *hv, *cur;
+  long *n, *k;
+  unsigned long s, next;
+  int i, ok = 1;
+
+  ht = (unsigned long *)
+    malloc (sizeof (unsigned long)*ns*ACT_TRACE_HIST_CHUNK);
+  hv = (act_signal_val_t *)
+    malloc (sizeof (act_signal_val_t)*(ns*ACT_TRACE_HIST_CHUNK + ns));
+  n = (long *) malloc (sizeof (long)*2*ns);
+  if (!ht || !hv || !n) {
+    fprintf (stderr, "FATAL: could not allocate trigger buffers\n");
+    exit (1);
+  }
+  cur = hv + ns*ACT_TRACE_HIST_CHUNK;
+  k = n + ns;
+
+#define HT(i) (ht + (i)*ACT_TRACE_HIST_CHUNK)
+#define HV(i) (hv + (i)*ACT_TRACE_HIST_CHUNK)
+
+  for (i=0; i < ns; i++) {
+    n[i] = _trace_history (tr->t, tr->sig[i], s0, s1 - 1, HT(i), HV(i),
+			   ACT_TRACE_HIST_CHUNK);
+    if (n[i] == 0) {
+      ok = 0;
+      goto done;
+    }
+    cur[i] = HV(i)[0];
+    k[i] = 1;
+  }
+  s = s0;
+  while (ev->n < ev->cap) {
+    _trig_segment (ev, s, cur);
+    next = s1;
+    for (i=0; i < ns; i++) {
+      if (k[i] == n[i] && n[i] == ACT_TRACE_HIST_CHUNK) {
+	/* refill from the last point, which is entry 0 again */
+	n[i] = _trace_history (tr->t, tr->sig[i], HT(i)[n[i]-1], s1 - 1,
+			       HT(i), HV(i), ACT_TRACE_HIST_CHUNK);
+	if (n[i] == 0) {
+	  ok = 0;
+	  goto done;
+	}
+	k[i] = 1;
+      }
+      if (k[i] < n[i] && HT(i)[k[i]] < next) {
+	next = HT(i)[k[i]];
+      }
+    }
+    if (next >= s1) {
+      break;
+    }
+    for (i=0; i < ns; i++) {
+      while (k[i] < n[i] && HT(i)[k[i]] == next) {
+	cur[i] = HV(i)[k[i]++];
+      }
+    }
+    s = next;
+  }
+
+#undef HT
+#undef HV
+
+done:
+  free (ht);
+  free (hv);
+  free (n);
+  return ok;
+}
+
+/* formats that cannot seek: one step at a time */
+static int _trig_segments_step (struct act_trace_trig_eval *ev,
+				unsigned long s0, unsigned long s1)
+{
+  act_trace_trigger_t *tr = ev->tr;
+  act_trace_t *t = tr->t;
+  act_signal_val_t *cur, *v;
+  unsigned long s;
+  int i;
+
+  if (!_trace_seek_step (t, s0)) {
+    return 0;
+  }
+  cur = (act_signal_val_t *) malloc (sizeof (act_signal_val_t)*2*tr->nsig);
+  if (!cur) {
+    fprintf (stderr, "FATAL: could not allocate trigger buffers\n");
+    exit (1);
+  }
+  v = cur + tr->nsig;
+  act_trace_get_signals (t, tr->sig, tr->nsig, cur);
+  _trig_segment (ev, s0, cur);
+  for (s=s0+1; s < s1 && ev->n < ev->cap; s++) {
+    if (!(*t->t->has_more_data) (t->handle)) {
+      break;
+    }
+    _trace_seek_step (t, s);
+    act_trace_get_signals (t, tr->sig, tr->nsig, v);
+    for (i=0; i < tr->nsig; i++) {
+      if (v[i].val != cur[i].val) {
+	break;
+      }
+    }
+    if (i < tr->nsig) {
+      memcpy (cur, v, sizeof (act_signal_val_t)*tr->nsig);
+      _trig_segment (ev, s, cur);
+    }
+  }
+  free (cur);
+  return 1;
+}
+
+long act_trace_trigger_eval (act_trace_trigger_t *tr, float t0, float t1,
+			     unsigned long *start, unsigned long *end,
+			     long cap)
+{
+  struct act_trace_trig_eval ev;
+  unsigned long s0, s1, step;
+  act_trace_t *t;
+  float dt;
+  int ok;
+
+  if (!tr || !start || !end || cap <= 0) {
+    return 0;
+  }
+  t = tr->t;
+  dt = _trace_dt (t);
+  if (dt <= 0 || t1 <= t0) {
+    return 0;
+  }
+  s0 = (t0 > 0) ? (unsigned long) (t0/dt + 0.5) : 0;
+  s1 = (t1 > 0) ? (unsigned long) (t1/dt + 0.5) : 0;
+  if (s1 <= s0) {
+    return 0;
+  }
+
+  ev.tr = tr;
+  ev.nb = 0;
+  ev.open = 0;
+  ev.start = start;
+  ev.end = end;
+  ev.n = 0;
+  ev.cap = cap;
+  ev.col = (unsigned long *)
+    malloc (sizeof (unsigned long)*ACT_TRACE_TRIG_BATCH*
+	    (tr->nsig + tr->maxdepth + 1));
+  if (!ev.col) {
+    fprintf (stderr, "FATAL: could not allocate trigger buffers\n");
+    exit (1);
+  }
+  ev.stk = ev.col + ACT_TRACE_TRIG_BATCH*tr->nsig;
+
+  if (tr->nsig == 0) {
+    /* constant */
+    _trig_segment (&ev, s0, NULL);
+    ok = 1;
+  }
+  else if (t->t->seek) {
+    step = t->step;
+    ok = _trig_segments_history (&ev, s0, s1);
+    _trace_seek_step (t, step);
+  }
+  else {
+    ok = _trig_segments_step (&ev, s0, s1);
+  }
+  _trig_flush (&ev);
+  if (ok && ev.open && ev.n < cap) {
+    start[ev.n] = ev.ostart;
+    end[ev.n] = s1;
+    ev.n++;
+  }
+  free (ev.col);
+  return ok ? ev.n : -1;
+}
+
 unsigned long act_trace_get_smallval (act_trace_t *t, void *sig)
 {
   act_signal_val_t v = act_trace_get_signal (t, sig);
@@ -55,6 +55,30 @@ extern "C" {
 
 #define ACT_TRACE_WIDE_NUM(w) (((w)+8*sizeof (unsigned long)-1)/(8*sizeof(unsigned long)))
 
+  /* a change of a watched signal, from act_trace_next_change() */
+  typedef struct {
+    void *sig;			/* signal that changed */
+    unsigned long step;		/* time in units of dt */
+    float t;			/* time in SI units */
+    act_signal_val_t v;		/* new value; wide values are only
+				   valid until the next reader call */
+  } act_trace_change_t;
+
+  /* conditions for act_trace_find_next() */
+  typedef enum act_trace_pred_op {
+    ACT_PRED_CHANGE = 0,	/* any change */
+    ACT_PRED_RISE = 1,		/* a boolean becomes true */
+    ACT_PRED_FALL = 2,		/* a boolean becomes false */
+    ACT_PRED_EQ = 3,		/* the value becomes v */
+    ACT_PRED_CHAN_STATE = 4	/* a channel enters state */
+  } act_trace_pred_op_t;
+
+  typedef struct {
+    act_trace_pred_op_t op;
+    act_signal_val_t v;		/* ACT_PRED_EQ; valp for wide values */
+    act_chan_state_t state;	/* ACT_PRED_CHAN_STATE */
+  } act_trace_pred_t;
+
   typedef struct {
 
     unsigned int has_reader:1;
@@ -152,16 +176,47 @@ extern "C" {
     /* return signal type */
     act_signal_type_t (*signal_type) (void *handle, void *node);
 
+    /* bit width of a digital signal; optional, otherwise all values
+       are taken to fit in val */
+    int (*signal_width) (void *handle, void *node);
+
     void (*advance_time) (void *handle, int nsteps);
     void (*advance_time_by) (void *handle, float delta);
 
     act_signal_val_t (*get_signal) (void *nandle, void *node);
 
+    /* values of n signals at once; optional */
+    void (*get_signals) (void *handle, void **nodes, int n,
+			 act_signal_val_t *out);
+
+    /* move to a time in units of dt, also backward; optional */
+    int (*seek) (void *handle, unsigned long step);
+
+    /* change-driven reading; optional, both or neither */
+    int (*watch) (void *handle, void *node);
+    int (*next_change) (void *handle, act_trace_change_t *out);
+
+    /* next change of one signal that satisfies a predicate; optional */
+    int (*find_next) (void *handle, void *node, act_trace_pred_t pred,
+		      act_trace_change_t *out);
+
+    /* changes of one signal in a window of steps; optional */
+    long (*get_history) (void *handle, void *node,
+			 unsigned long s0, unsigned long s1,
+			 unsigned long *times, act_signal_val_t *vals,
+			 long cap);
+
+    /* another reader sharing the opened file; optional */
+    void *(*cursor) (void *handle);
+
     int (*has_more_data) (void *handle);
 
     /* close trace file */
     int (*close_tracefile) (void *handle);
 
+    /* set a backend-specific option; optional */
+    int (*set_option) (void *handle, const char *key, const char *value);
+
     /* use this to close the library */
     void *dlib;
 
@@ -181,6 +236,13 @@ extern "C" {
     */
     void *handle;
     act_extern_trace_func_t *t;
+    void *watch;		/* act_trace_next_change() state, when
+				   the format does not provide it */
+    unsigned long *hist;	/* wide values from the
+				   act_trace_get_history() fallback */
+    long maxhist;
+    unsigned long step;		/* reader: time so far, in units of dt */
+    float dt;			/* reader: dt, or -1 if not known yet */
   } act_trace_t;
     
 
@@ -214,6 +276,16 @@ extern "C" {
      
      close - close_tracefile
 
+     set_option - mapped to set_option (optional)
+     signal_width - mapped to signal_width (optional)
+     get_signals - mapped to get_signals (optional)
+     seek - mapped to seek (optional)
+     watch - mapped to watch (optional)
+     next_change - mapped to next_change (optional)
+     find_next - mapped to find_next (optional)
+     get_history - mapped to get_history (optional)
+     cursor - mapped to cursor (optional)
+
      If your file format ooes not support a signal type, you can omit
      the funcftions from the library. Those signals will be skipped.
   */
@@ -262,6 +334,13 @@ extern "C" {
 
   int act_trace_has_alt (act_extern_trace_func_t *);
 
+  /* set a format-specific option, e.g. "depth" to "9" for LXT2. Can be
+     called any time after create/open; some options only take effect
+     before the first signal change. Returns 1 if the option was
+     applied, 0 if the format does not support it. */
+  int act_trace_set_option (act_trace_t *, const char *key,
+			    const char *value);
+
 
 
   /*-- API for reading --*/
@@ -269,13 +348,22 @@ extern "C" {
   /* mode = 0/1 : same as the .._create() function */
   act_trace_t *act_trace_open (act_extern_trace_func_t *,
 			       const char *name, int mode);
+
+  /* another reader on an opened trace, at time 0, following the
+     signals looked up so far; their pointers are valid on both. The
+     readers share what the format has decoded, and may be used by
+     different threads at once. Close it with act_trace_close().
+     Returns NULL if the format does not support it. */
+  act_trace_t *act_trace_cursor (act_trace_t *);
    
 
   /* get parameters from the header: if info is missing from the file
      format, a -1 is returned in stop_time/dt */
   void act_trace_header (act_trace_t *, float *stop_time, float *dt);
 
-  /* get a signal pointer given the signal name */
+  /* get a signal pointer given the signal name. Formats may decode
+     only the signals looked up before the first read; a later lookup
+     can then cost a pass over the trace up to the current time. */
   void *act_trace_lookup (act_trace_t *, const char *name);
 
   /* return the signal type: bool, int, channel, analog */
@@ -293,6 +381,88 @@ extern "C" {
   /* get the value of the specified signal */
   act_signal_val_t act_trace_get_signal (act_trace_t *, void *sig);
 
+  /* get the values of n signals; out[i] is the value of sigs[i] */
+  void act_trace_get_signals (act_trace_t *, void **sigs, int n,
+			      act_signal_val_t *out);
+
+  /* move the reader to time t (SI units). Moving backward needs
+     support from the format. Returns 1 on success, 0 on failure. */
+  int act_trace_seek (act_trace_t *, float t);
+
+  /* move the reader back by the given number of steps; needs seek
+     support from the format. Returns 1 on success, 0 on failure. */
+  int act_trace_step_back (act_trace_t *, int steps);
+
+  /* report the changes of sig through act_trace_next_change();
+     returns 1 on success, 0 on failure. Without next_change from the
+     format, changes of values wider than 64 bits are found by
+     comparing their words, which needs signal_width from the format;
+     otherwise every value is taken to fit in val. */
+  int act_trace_watch (act_trace_t *, void *sig);
+
+  /* advance to the next change of a watched signal, and return it in
+     out. Changes at the same time are returned one per call. Returns
+     0 at the end of the trace. */
+  int act_trace_next_change (act_trace_t *, act_trace_change_t *out);
+
+  /* move back to the latest change of a watched signal before the
+     current time, and return it in out. If several signals changed at
+     that time, one of them is returned. Returns 0 if there is none;
+     needs seek support from the format. */
+  int act_trace_prev_change (act_trace_t *, act_trace_change_t *out);
+
+  /* advance to the next change of sig after which pred holds, and
+     return it in out. The reader is left at that time. Returns 0 at
+     the end of the trace. Values wider than 64 bits are compared
+     word by word, as for act_trace_watch(). */
+  int act_trace_find_next (act_trace_t *, void *sig, act_trace_pred_t pred,
+			   act_trace_change_t *out);
+
+  /* the waveform of sig from t0 to t1 (SI units): times[0]/vals[0] is
+     the value at t0, followed by each change up to t1 (times in units
+     of dt). At most cap entries are stored; the number stored is
+     returned, or 0 on failure. The reader is left at t1, or at the
+     last entry if cap was reached. Values wider than 64 bits point
+     to copies that stay valid until the next call on this trace that
+     reads a history; the fallback needs signal_width from the
+     format to find their changes, as for act_trace_watch(). */
+  long act_trace_get_history (act_trace_t *, void *sig, float t0, float t1,
+			      unsigned long *times, act_signal_val_t *vals,
+			      long cap);
+
+  /* sample n signals at m times (SI units, sorted), or at the grid
+     t0 + j*period, into out[i*m + j] for signal i and sample j.
+     Digital values are held from the last change; analog values are
+     interpolated between recorded points if the format can seek,
+     otherwise held. The reader is left at the last sample. Returns 1
+     on success, 0 on failure. */
+  int act_trace_sample (act_trace_t *, void **sigs, int n,
+			const float *times, long m, act_signal_val_t *out);
+  int act_trace_sample_grid (act_trace_t *, void **sigs, int n,
+			     float t0, float period, long m,
+			     act_signal_val_t *out);
+
+  /* trigger expressions over digital signals of up to 64 bits, with
+     C operators and precedence: ! == != < <= > >= & ^ | && ||,
+     parentheses, numbers (decimal, 0x, 0b), and bit selects
+     sig[hi:lo] or sig[bit]. Booleans are 1 when true, else 0. */
+  typedef struct act_trace_trigger act_trace_trigger_t;
+
+  /* compile expr, looking up its signals in the trace; returns NULL
+     on a syntax error or unknown signal */
+  act_trace_trigger_t *act_trace_trigger_compile (act_trace_t *,
+						  const char *expr);
+  void act_trace_trigger_free (act_trace_trigger_t *);
+
+  /* the intervals [start[i], end[i]) (units of dt) between t0 and t1
+     (SI units) where the expression is non-zero. At most cap are
+     stored; the number stored is returned, or -1 if the trace could
+     not be read. The reader is moved back to where it was if the
+     format can seek, and is otherwise left at t1. */
+  long act_trace_trigger_eval (act_trace_trigger_t *, float t0, float t1,
+			       unsigned long *start, unsigned long *end,
+			       long cap);
+
   /* get value, shortcuts optimized for specific signal types */
   unsigned long act_trace_get_smallval (act_trace_t *, void *sig);
   float act_trace_get_analog (act_trace_t *, void *sig);
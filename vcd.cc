@@ -25,6 +25,16 @@
 #include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "tracelib.h"
 
 #ifdef ACT_MODE
@@ -190,7 +200,16 @@ static int _vcd_group_signals (char *a, char *b)
 }
 
 
-class VCDInfo {
+/*
+  Common base for reader and writer handles, so that vcd_close() can
+  release either one.
+*/
+class VCDFile {
+ public:
+  virtual ~VCDFile () { }
+};
+
+class VCDInfo : public VCDFile {
  public:
   VCDInfo (FILE *fp, float ts, int mode = 0) {
     _fp = fp;
@@ -545,233 +564,2378 @@ class VCDInfo {
 
 };
 
-}
-
-extern "C" {
+/*
+ *
+ * VCD reader
+ *
+ */
 
-void *vcd_create (const  char *nm, float stop_time, float ts)
+void *_vcd_malloc (size_t sz)
 {
-  FILE *fp;
-  VCDInfo *vi;
-
-  fp = fopen (nm, "w");
-  if (!fp) {
-    fprintf (stderr, "ERROR: could not open file `%s' for writing\n", nm);
-    return NULL;
+  void *p = malloc (sz);
+  if (!p) {
+    fprintf (stderr, "Failed to allocate %lu bytes\n", (unsigned long) sz);
+    exit (1);
   }
-  vi = new VCDInfo (fp, ts);
-  vi->emitHeader ();
-
-  return vi;
+  return p;
 }
 
-#ifdef ACT_MODE
-void *vcd_create_alt (const  char *nm, float stop_time, float ts)
+void *_vcd_realloc (void *p, size_t sz)
 {
-  FILE *fp;
-  VCDInfo *vi;
-
-  fp = fopen (nm, "w");
-  if (!fp) {
-    fprintf (stderr, "ERROR: could not open file `%s' for writing\n", nm);
-    return NULL;
+  p = realloc (p, sz);
+  if (!p) {
+    fprintf (stderr, "Failed to allocate %lu bytes\n", (unsigned long) sz);
+    exit (1);
   }
-  vi = new VCDInfo (fp, ts, 1);
-  vi->emitHeader ();
-
-  return vi;
+  return p;
 }
-#endif
 
-int vcd_signal_start (void *handle)
+/*
+  Byte scanners used by the tokenizer. Anything <= ' ' is whitespace.
+  With SSE2 we check 16 bytes at a time: an unsigned byte x is <= ' '
+  exactly when max(x, ' ') == ' '.
+*/
+inline const char *_vcd_skip_ws (const char *p, const char *end)
 {
-  // nothing to do
-  return 1;
+  if (p < end && (unsigned char)*p > ' ') {
+    return p;
+  }
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8 (' ');
+  while (end - p >= 16) {
+    __m128i x = _mm_loadu_si128 ((const __m128i *)p);
+    unsigned int m =
+      _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_max_epu8 (x, sp), sp));
+    m = ~m & 0xffff;
+    if (m) {
+      return p + __builtin_ctz (m);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && (unsigned char)*p <= ' ') {
+    p++;
+  }
+  return p;
 }
 
-void *vcd_add_analog_signal (void *handle, const char *s)
+inline const char *_vcd_find_ws (const char *p, const char *end)
 {
-  VCDInfo *vi = (VCDInfo *)handle;
-  int idx = vi->addAnalog (s);
-  return (void *)((long)idx+1);
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8 (' ');
+  while (end - p >= 16) {
+    __m128i x = _mm_loadu_si128 ((const __m128i *)p);
+    unsigned int m =
+      _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_max_epu8 (x, sp), sp));
+    if (m) {
+      return p + __builtin_ctz (m);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && (unsigned char)*p > ' ') {
+    p++;
+  }
+  return p;
 }
 
-void *vcd_add_digital_signal (void *handle, const char *s)
+/*
+  Convert a VCD bit string (MSB first) into little-endian words; x/z
+  bits read as zero. Only the low nw words are filled in, so longer
+  strings are truncated and shorter ones are zero-extended.
+*/
+void _vcd_str_to_bits (const char *s, int n, unsigned long *w, int nw)
 {
-  VCDInfo *vi = (VCDInfo *)handle;
-  int idx = vi->addDigital (s);
-  return (void *)((long)idx+1);
-}
+  int k = 0;			// bit position of s[n-1-k]
 
-void *vcd_add_int_signal (void *handle, const char *s, int width)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
-  int idx = vi->addDigital (s, width);
-  return (void *)((long)idx+1);
+  for (int i=0; i < nw; i++) {
+    w[i] = 0;
+  }
+#ifdef __SSE2__
+  const __m128i one = _mm_set1_epi8 ('1');
+  while (n - k >= 16 && k < nw*64) {
+    __m128i x = _mm_loadu_si128 ((const __m128i *)(s + n - k - 16));
+    unsigned int m = _mm_movemask_epi8 (_mm_cmpeq_epi8 (x, one));
+    /* byte i holds bit 15-i of this group */
+    m = ((m >> 1) & 0x5555) | ((m & 0x5555) << 1);
+    m = ((m >> 2) & 0x3333) | ((m & 0x3333) << 2);
+    m = ((m >> 4) & 0x0f0f) | ((m & 0x0f0f) << 4);
+    m = ((m >> 8) & 0x00ff) | ((m & 0x00ff) << 8);
+    w[k/64] |= ((unsigned long)m) << (k % 64);
+    k += 16;
+  }
+#endif
+  while (k < n && k < nw*64) {
+    if (s[n-1-k] == '1') {
+      w[k/64] |= 1UL << (k % 64);
+    }
+    k++;
+  }
 }
 
-void *vcd_add_chan_signal (void *handle, const char *s, int width)
+const char *_vcd_token (const char **pos, const char *end, int *len)
 {
-  VCDInfo *vi = (VCDInfo *)handle;
-  int idx = vi->addDigital (s, width);
-  return (void *)((long)idx+1);
+  const char *s;
+  s = _vcd_skip_ws (*pos, end);
+  if (s == end) {
+    *pos = s;
+    return NULL;
+  }
+  *pos = _vcd_find_ws (s, end);
+  *len = *pos - s;
+  return s;
 }
 
-int vcd_signal_end (void *handle)
+/* skip past the next $end; returns 0 if there isn't one */
+int _vcd_skip_to_end (const char **pos, const char *end)
 {
-  // nothing to do
-  return 1;
+  const char *tok;
+  int len;
+  while ((tok = _vcd_token (pos, end, &len))) {
+    if (len == 4 && memcmp (tok, "$end", 4) == 0) {
+      return 1;
+    }
+  }
+  return 0;
 }
 
-
-int vcd_init_start (void *handle)
+unsigned long _vcd_num (const char *s, int len)
 {
-  VCDInfo *vi = (VCDInfo *)handle;
-  vi->dumpStart ();
-  return 1;
+  unsigned long v = 0;
+  for (int i=0; i < len && isdigit (s[i]); i++) {
+    v = v*10 + (s[i] - '0');
+  }
+  return v;
 }
 
-int vcd_init_end (void *handle)
+float _vcd_real (const char *s, int len)
 {
-  VCDInfo *vi = (VCDInfo *)handle;
-  vi->dumpEnd ();
-  
-  return 1;
+  char buf[64];
+  if (len > 63) {
+    len = 63;
+  }
+  memcpy (buf, s, len);
+  buf[len] = '\0';
+  return atof (buf);
 }
 
-int vcd_change_digital (void *handle, void *node, float t, unsigned long v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
 
-  if (!vi->isInDump()) {
-    vi->emitTime (t);
+/*
+  Open-addressed string -> int table. Keys are not copied, so they
+  must outlive the table.
+*/
+class VCDStrTab {
+ public:
+  VCDStrTab () {
+    _tab = NULL;
+    _sz = 0;
+    _n = 0;
   }
-  vi->emitDigital (((unsigned long)node)-1, v);
-  
-  return 1;
-}
 
-int vcd_change_analog (void *handle, void *node, float t, float v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
+  ~VCDStrTab () {
+    if (_tab) {
+      free (_tab);
+    }
+  }
 
-  if (!vi->isInDump()) {
-    vi->emitTime (t);
+  int find (const char *s, int len) {
+    unsigned int h, i;
+    if (_sz == 0) {
+      return -1;
+    }
+    h = _hash (s, len);
+    i = h & (_sz - 1);
+    while (_tab[i].s) {
+      if (_tab[i].h == h && _tab[i].len == len &&
+	  memcmp (_tab[i].s, s, len) == 0) {
+	return _tab[i].val;
+      }
+      i = (i + 1) & (_sz - 1);
+    }
+    return -1;
   }
-  vi->emitAnalog (((unsigned long)node)-1, v);
-  
-  return 1;
-}
 
-int vcd_change_wide_digital (void *handle, void *node, float t,
-			     int len, unsigned long *v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
+  void add (const char *s, int len, int val) {
+    if (2*(_n + 1) > _sz) {
+      _grow ();
+    }
+    _put (s, len, _hash (s, len), val);
+    _n++;
+  }
 
-  if (!vi->isInDump()) {
-    vi->emitTime (t);
+ private:
+  struct ent {
+    const char *s;
+    int len;
+    int val;
+    unsigned int h;
+  };
+  ent *_tab;
+  unsigned int _sz;
+  unsigned int _n;
+
+  static unsigned int _hash (const char *s, int len) {
+    unsigned int h = 2166136261U;
+    for (int i=0; i < len; i++) {
+      h = (h ^ (unsigned char)s[i]) * 16777619U;
+    }
+    return h;
   }
-  vi->emitDigital (((unsigned long)node)-1, len, v);
-  
-  return 0;
-}
 
+  void _put (const char *s, int len, unsigned int h, int val) {
+    unsigned int i = h & (_sz - 1);
+    while (_tab[i].s) {
+      i = (i + 1) & (_sz - 1);
+    }
+    _tab[i].s = s;
+    _tab[i].len = len;
+    _tab[i].val = val;
+    _tab[i].h = h;
+  }
 
-int vcd_change_chan (void *handle, void *node, float t,
-		     act_chan_state_t s, unsigned long v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
+  void _grow () {
+    ent *old = _tab;
+    unsigned int osz = _sz;
 
-  if (!vi->isInDump()) {
-    vi->emitTime (t);
-  }
-  if (s != ACT_CHAN_VALUE) {
-    vi->emitChanState (((unsigned long)node)-1, s);
-  }
-  else {
-    vi->emitDigital (((unsigned long)node)-1, v);
+    _sz = (_sz == 0) ? 64 : 2*_sz;
+    _tab = (ent *) _vcd_malloc (sizeof (ent) * _sz);
+    for (unsigned int i=0; i < _sz; i++) {
+      _tab[i].s = NULL;
+    }
+    for (unsigned int i=0; i < osz; i++) {
+      if (old[i].s) {
+	_put (old[i].s, old[i].len, old[i].h, old[i].val);
+      }
+    }
+    if (old) {
+      free (old);
+    }
   }
-  return 1;
-}
+};
 
 
-int vcd_change_wide_chan (void *handle, void *node, float t,
-			     act_chan_state_t s,
-			     int len, unsigned long *v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
+/* text per chunk when parsing the value changes */
+#define VCD_CHUNK_SIZE (1 << 20)
 
-  if (!vi->isInDump()) {
-    vi->emitTime (t);
-  }
-  if (s != ACT_CHAN_VALUE) {
-    vi->emitChanState (((unsigned long)node)-1, s);
+struct VCDChange {
+  int slot;			// -1 marks a timestamp
+  act_signal_val_t v;		// value, time, or offset into words
+};
+
+/*
+  Sidecar index, <file>.tidx: the header, then the value of every
+  slot at each checkpoint, then the checkpoint table. Host byte order;
+  it is a cache, and is rebuilt if it does not match the trace.
+*/
+#define VCD_INDEX_MAGIC "tidxvcd1"
+#define VCD_INDEX_MIN (2*VCD_CHUNK_SIZE)	// smaller files are not indexed
+#define VCD_INDEX_HASH (1 << 16)	// bytes hashed at each end of the file
+
+struct VCDIndexHdr {
+  char magic[8];
+  unsigned long size;		// the trace file: size, mtime, and a
+  long mtime;			// hash of its first and last bytes
+  unsigned long hash;
+  unsigned long nslots, nwide;	// shape of the saved state
+  unsigned long last;		// last timestamp in the file
+  unsigned long ncheck;
+};
+
+struct VCDCheck {
+  unsigned long t;		// first timestamp of the chunk
+  unsigned long off;		// chunk start, from the value changes
+};
+
+struct VCDChunk {
+  const char *start, *end;	// text, starting at a timestamp
+  VCDChange *chg;
+  unsigned long nchg, maxchg;
+  unsigned long *words;		// > 64 bit values
+  unsigned long nwords, maxwords;
+  int state;
+  int in_comment;		// chunk ended inside a $comment
+  int from_comment;		// chunk was parsed as starting in one
+  int all;			// parse every signal, not just those wanted
+  char *buf;			// owned text, for compressed input
+  unsigned long maxbuf;
+};
+
+class VCDReader : public VCDFile {
+ public:
+  VCDReader () {
+    _fd = -1;
+    _map = NULL;
+    _maplen = 0;
+    _pos = NULL;
+    _end = NULL;
+    _data = NULL;
+    _ts = -1;
+    _nvars = 0;
+    _maxvars = 0;
+    _vname = NULL;
+    _vslot = NULL;
+    _roots = NULL;
+    _nroots = 0;
+    _nslots = 0;
+    _maxslots = 0;
+    _sid = NULL;
+    _swidth = NULL;
+    _sval = NULL;
+    _wide = NULL;
+    _nwide = 0;
+    _code2slot = NULL;
+    _ncodes = 0;
+    _want = NULL;
+    _nwant = 0;
+    _selected = 0;
+    _cur = 0;
+    _next = 0;
+    _started = 0;
+    _have_next = 0;
+    _ring = NULL;
+    _nring = 0;
+    _seq_fill = 0;
+    _seq_parse = 0;
+    _seq_use = 0;
+    _crec = 0;
+    _split = NULL;
+    _carry_comment = 0;
+    _threads = NULL;
+    _shutdown = 0;
+    _gz = NULL;
+    _gzbuf[0] = NULL;
+    _gzbuf[1] = NULL;
+    _gzfull[0] = 0;
+    _gzfull[1] = 0;
+    _gztake = 0;
+    _gzstop = 0;
+    _gzdone = 0;
+    _gzdata = 0;
+    _carry = NULL;
+    _ncarry = 0;
+    _maxcarry = 0;
+    _voff = 0;
+    _foff = 0;
+    _name = NULL;
+    _at_end = 0;
+    _idxname = NULL;
+    _idxon = 1;
+    _ifd = -1;
+    _ncheck = 0;
+    _check = NULL;
+    _ilast = 0;
+    _istate = NULL;
+    _bfd = -1;
+    _btmp = NULL;
+    _nbcheck = 0;
+    _maxbcheck = 0;
+    _bcheck = NULL;
+    _bnext = 0;
+    _bval = NULL;
+    _bwide = NULL;
+    _bbuf = NULL;
+    _brun = BUILD_NONE;
+    _bstop = 0;
+    pthread_mutex_init (&_blk, NULL);
+    _nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (_nthreads > 32) {
+      _nthreads = 32;
+    }
   }
-  else {
-    vi->emitDigital (((unsigned long)node)-1, len, v);
+
+  ~VCDReader () {
+    _stop ();
+    /* the index pass finishes only after a read to the end */
+    _idxEnd (_at_end);
+    pthread_mutex_destroy (&_blk);
+    if (_gz) {
+      pthread_mutex_lock (&_gzlock);
+      _gzstop = 1;
+      pthread_cond_broadcast (&_gzcv);
+      pthread_mutex_unlock (&_gzlock);
+      pthread_join (_inflater, NULL);
+      pthread_mutex_destroy (&_gzlock);
+      pthread_cond_destroy (&_gzcv);
+      gzclose (_gz);
+      free (_gzbuf[0]);
+      free (_gzbuf[1]);
+    }
+    if (_carry) {
+      free (_carry);
+    }
+    if (_map) {
+      munmap (_map, _maplen);
+    }
+    if (_fd >= 0) {
+      close (_fd);
+    }
+    for (int i=0; i < _nvars; i++) {
+      free (_vname[i]);
+    }
+    if (_vname) {
+      free (_vname);
+      free (_vslot);
+    }
+    for (int i=0; i < _nroots; i++) {
+      free (_roots[i]);
+    }
+    if (_roots) {
+      free (_roots);
+    }
+    for (int i=0; i < _nslots; i++) {
+      free (_sid[i]);
+    }
+    if (_sid) {
+      free (_sid);
+      free (_swidth);
+    }
+    if (_sval) {
+      free (_sval);
+    }
+    if (_wide) {
+      free (_wide);
+    }
+    if (_code2slot) {
+      free (_code2slot);
+    }
+    if (_want) {
+      free (_want);
+    }
+    _idxAbandon ();
+    _idxClose ();
+    if (_idxname) {
+      free (_idxname);
+    }
+    if (_name) {
+      free (_name);
+    }
+    if (_istate) {
+      free (_istate);
+    }
   }
-  return 0;
-}
 
+  int openFile (const char *nm) {
+    struct stat sb;
+    unsigned char magic[2];
 
-#ifdef ACT_MODE
-int vcd_change_digital_alt (void *handle, void *node, int len,
-			    unsigned long *tm, unsigned long v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
-  if (!vi->isInDump()) {
-    BigInt tmp;
-    tmp.setWidth (len * 8 * sizeof (unsigned long));
-    for (int i=0; i < len; i++) {
-      tmp.setVal (i, tm[i]);
+    _fd = open (nm, O_RDONLY);
+    if (_fd < 0) {
+      fprintf (stderr, "ERROR: could not open file `%s' for reading\n", nm);
+      return 0;
     }
-    vi->emitTime (tmp);
-  }
-  vi->emitDigital (((unsigned long)node)-1, v);
-  
-  return 1;
-}
+    if (fstat (_fd, &sb) != 0 || sb.st_size == 0) {
+      fprintf (stderr, "ERROR: `%s' is empty or unreadable\n", nm);
+      return 0;
+    }
+    _idxIdentify (nm, &sb);
+    _name = (char *) _vcd_malloc (strlen (nm) + 1);
+    strcpy (_name, nm);
+    if (pread (_fd, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+      if (!_openCompressed (nm)) {
+	return 0;
+      }
+      _idxOpen ();
+      return 1;
+    }
+    _maplen = sb.st_size;
+    _map = (char *) mmap (NULL, _maplen, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (_map == MAP_FAILED) {
+      _map = NULL;
+      fprintf (stderr, "ERROR: could not map file `%s'\n", nm);
+      return 0;
+    }
+    madvise (_map, _maplen, MADV_SEQUENTIAL);
+    _pos = _map;
+    _end = _map + _maplen;
 
-int vcd_change_analog_alt (void *handle, void *node, int len,
-			   unsigned long *tm, float v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
+    if (!_parseHeader ()) {
+      fprintf (stderr, "ERROR: `%s' is missing $enddefinitions\n", nm);
+      return 0;
+    }
+    _idxOpen ();
+    return 1;
+  }
 
-  if (!vi->isInDump()) {
-    BigInt tmp;
-    tmp.setWidth (len * 8 * sizeof (unsigned long));
-    for (int i=0; i < len; i++) {
-      tmp.setVal (i, tm[i]);
+  void getHeader (float *stop_time, float *dt) {
+    if (_ts < 0) {
+      *stop_time = -1;
+      *dt = -1;
+      return;
+    }
+    *dt = _ts;
+    if (_gz) {
+      /* would need to inflate the whole file to find out, unless it
+	 has been indexed */
+      _idxPoll ();
+      *stop_time = (_ifd >= 0) ? _ilast * _ts : -1;
+    }
+    else {
+      *stop_time = _lastTime () * _ts;
     }
-    vi->emitTime (tmp);
   }
-  vi->emitAnalog (((unsigned long)node)-1, v);
-  
-  return 1;
-}
 
-int vcd_change_wide_digital_alt (void *handle, void *node, int len,
-			     unsigned long *tm,
-			     int lenv, unsigned long *v)
-{
-  VCDInfo *vi = (VCDInfo *)handle;
+  void *lookup (const char *nm) {
+    int len = strlen (nm);
+    int v = _names.find (nm, len);
+
+    /* names from a single-rooted dump are usually given without the
+       top-level scope */
+    for (int i=0; v < 0 && i < _nroots; i++) {
+      int rl = strlen (_roots[i]);
+      char *buf = (char *) _vcd_malloc (rl + len + 2);
+      memcpy (buf, _roots[i], rl);
+      buf[rl] = '.';
+      memcpy (buf + rl + 1, nm, len + 1);
+      v = _names.find (buf, rl + len + 1);
+      free (buf);
+    }
+    if (v < 0) {
+      return NULL;
+    }
+    _select (_vslot[v]);
+    return (void *)((long)_vslot[v]+1);
+  }
 
-  if (!vi->isInDump()) {
-    BigInt tmp;
-    tmp.setWidth (len * 8 * sizeof (unsigned long));
-    for (int i=0; i < len; i++) {
-      tmp.setVal (i, tm[i]);
+  act_signal_type_t sigType (void *sig) {
+    int w = _swidth[((long)sig)-1];
+    if (w < 0) {
+      return ACT_SIG_ANALOG;
     }
-    vi->emitTime (tmp);
+    else if (w == 1) {
+      return ACT_SIG_BOOL;
+    }
+    return ACT_SIG_INT;
   }
-  vi->emitDigital (((unsigned long)node)-1, lenv, v);
-  
-  return 0;
-}
 
+  int sigWidth (void *sig) {
+    int w = _swidth[((long)sig)-1];
+    return (w < 0) ? 0 : w;
+  }
 
-int vcd_change_chan_alt (void *handle, void *node, int len,
-			 unsigned long *tm,
+  act_signal_val_t getSignal (void *sig) {
+    _start ();
+    return _sval[((long)sig)-1];
+  }
+
+  void advance (unsigned long steps) {
+    _start ();
+    _cur += steps;
+    _run (_cur);
+  }
+
+  void advanceBy (float delta) {
+    if (_ts <= 0 || delta <= 0) {
+      return;
+    }
+    advance ((unsigned long) (delta/_ts + 0.5));
+  }
+
+  int hasMoreData () {
+    _start ();
+    return _have_next;
+  }
+
+  /* move to a time, also backward */
+  int seek (unsigned long target) {
+    long k;
+
+    _start ();
+    _idxPoll ();
+    k = _idxFind (target);
+    /* jump ahead past the text already handed out, and for
+       compressed input, inflated */
+    if (target < _cur ||
+	(k >= 0 && _check[k].off > _foff + _ncarry + 2*VCD_CHUNK_SIZE)) {
+      _reposition (k, target);
+    }
+    else {
+      _cur = target;
+      _run (_cur);
+    }
+    return 1;
+  }
+
+  int setOption (const char *key, const char *value) {
+    if (!strcmp (key, "index")) {
+      if (!strcmp (value, "on")) {
+	_idxon = 1;
+	_idxOpen ();
+      }
+      else if (!strcmp (value, "off")) {
+	_idxon = 0;
+	_idxEnd (0);
+	_idxClose ();
+      }
+      else {
+	fprintf (stderr, "WARNING: vcd: bad value `%s' for option `%s'\n",
+		 value, key);
+	return 0;
+      }
+      return 1;
+    }
+    return 0;
+  }
+
+ private:
+  int _fd;
+  char *_map;
+  size_t _maplen;
+  const char *_pos, *_end;	// tokenizer position
+  const char *_data;		// start of the value change section
+
+  double _ts;			// seconds per time unit, -1 if missing
+
+  /* variable names, mapped to slots */
+  int _nvars, _maxvars;
+  char **_vname;
+  int *_vslot;
+  VCDStrTab _names;
+  char **_roots;		// top-level scope names
+  int _nroots;
+
+  /* one slot per identifier code; aliased vars share a slot */
+  int _nslots, _maxslots;
+  char **_sid;
+  int *_swidth;			// -1 = real, otherwise bit width
+  act_signal_val_t *_sval;	// current values, indexed by slot
+  unsigned long *_wide;		// storage for > 64 bit values
+  unsigned long _nwide;
+  VCDStrTab _ids;
+  int *_code2slot;		// direct map for short identifier codes
+  unsigned long _ncodes;
+
+  /* signals looked up; once reading starts, only these are parsed */
+  char *_want;			// indexed by slot
+  int _nwant;
+  unsigned int _selected:1;	// parsing is limited to _want
+
+  unsigned long _cur;		// current time
+  unsigned long _next;		// next timestamp, if _have_next
+  unsigned int _started:1;
+  unsigned int _have_next:1;
+  unsigned int _at_end:1;	// reading has reached the end of the file
+
+  /* chunked parse of the value changes */
+  VCDChunk *_ring;
+  int _nring;
+  unsigned long _seq_fill;	// chunks handed out so far
+  unsigned long _seq_parse;	// chunks picked up for parsing
+  unsigned long _seq_use;	// chunk being consumed
+  unsigned long _crec;		// next change in that chunk
+  const char *_split;		// start of the text not yet handed out
+  int _carry_comment;
+  int _nthreads;
+  pthread_t *_threads;
+  int _shutdown;
+  pthread_mutex_t _lock;
+  pthread_cond_t _cv_work;	// workers wait for queued chunks
+  pthread_cond_t _cv_done;	// consumer waits for parsed chunks
+
+  /* gzip input: a thread inflates into two alternating blocks */
+  gzFile _gz;
+  pthread_t _inflater;
+  pthread_mutex_t _gzlock;
+  pthread_cond_t _gzcv;
+  char *_gzbuf[2];
+  int _gzlen[2];
+  int _gzfull[2];		// block holds data (length 0 = end of file)
+  int _gztake;			// next block to consume
+  int _gzstop;
+  int _gzdone;			// all text handed out
+  long _gzdata;			// inflated offset of the value changes
+  char *_carry;			// text after the last timestamp seen
+  unsigned long _ncarry, _maxcarry;
+
+  unsigned long _voff;		// start of the chunk being consumed,
+				// from the start of the value changes
+  unsigned long _foff;		// end of the text handed out
+
+  /* sidecar index */
+  char *_name;			// the trace file
+  char *_idxname;
+  int _idxon;
+  VCDIndexHdr _ihdr;		// identity of the trace file
+  int _ifd;			// index in use, or -1
+  unsigned long _ncheck;
+  VCDCheck *_check;
+  unsigned long _ilast;
+  char *_istate;		// one checkpoint's worth of state
+
+  /* index being written by a pass of its own; the fields below are
+     the pass's until it has been joined */
+  int _bfd;			// index being written, or -1
+  char *_btmp;
+  unsigned long _nbcheck, _maxbcheck;
+  VCDCheck *_bcheck;
+  unsigned long _bnext;		// offset of the next checkpoint
+  act_signal_val_t *_bval;	// values in the pass; wide ones hold
+  unsigned long *_bwide;	// their offset into _bwide
+  char *_bbuf;			// one checkpoint's worth of state
+  pthread_t _builder;
+  pthread_mutex_t _blk;		// for _brun and _bstop
+  int _brun;
+  int _bstop;
+
+  int _openCompressed (const char *nm) {
+    const char *p, *q;
+    long qoff;
+    char *b;
+    int n, r;
+
+    _gz = gzdopen (_fd, "rb");
+    if (!_gz) {
+      fprintf (stderr, "ERROR: could not open compressed file `%s'\n", nm);
+      return 0;
+    }
+    _fd = -1;
+    gzbuffer (_gz, 1 << 17);
+    _gzbuf[0] = (char *) _vcd_malloc (VCD_CHUNK_SIZE);
+    _gzbuf[1] = (char *) _vcd_malloc (VCD_CHUNK_SIZE);
+    pthread_mutex_init (&_gzlock, NULL);
+    pthread_cond_init (&_gzcv, NULL);
+    pthread_create (&_inflater, NULL, _inflate, this);
+
+    /* collect text until the end of the definitions; _append() may
+       move _carry, so remember an offset */
+    qoff = -1;
+    while ((r = _gzNext (&b, &n, 1)) == 1) {
+      _append (b, n);
+      _gzRelease ();
+      if (qoff < 0) {
+	q = (const char *)
+	  memmem (_carry, _ncarry, "$enddefinitions", 15);
+	if (q) {
+	  qoff = q - _carry;
+	}
+      }
+      /* the $end after $enddefinitions */
+      q = (qoff < 0) ? NULL : _carry + qoff + 15;
+      if (q && (p = (const char *)
+		memmem (q, _carry + _ncarry - q, "$end", 4)) &&
+	  p + 4 < _carry + _ncarry &&
+	  (unsigned char)p[4] <= ' ') {
+	break;
+      }
+    }
+    _pos = _carry;
+    _end = _carry + _ncarry;
+    if (!_parseHeader ()) {
+      fprintf (stderr, "ERROR: `%s' is missing $enddefinitions\n", nm);
+      return 0;
+    }
+    /* keep the start of the value changes as the carry */
+    _gzdata = _data - _carry;
+    _ncarry = _end - _data;
+    memmove (_carry, _data, _ncarry);
+    _pos = _end = _data = NULL;
+    return 1;
+  }
+
+  static void *_inflate (void *arg) {
+    VCDReader *vr = (VCDReader *)arg;
+    int i = 0;
+    int n;
+
+    pthread_mutex_lock (&vr->_gzlock);
+    while (!vr->_gzstop) {
+      if (vr->_gzfull[i]) {
+	pthread_cond_wait (&vr->_gzcv, &vr->_gzlock);
+	continue;
+      }
+      pthread_mutex_unlock (&vr->_gzlock);
+      n = gzread (vr->_gz, vr->_gzbuf[i], VCD_CHUNK_SIZE);
+      if (n < 0) {
+	int err;
+	fprintf (stderr, "WARNING: vcd: %s; ignoring the rest of the file\n",
+		 gzerror (vr->_gz, &err));
+	n = 0;
+      }
+      pthread_mutex_lock (&vr->_gzlock);
+      vr->_gzlen[i] = n;
+      vr->_gzfull[i] = 1;
+      pthread_cond_broadcast (&vr->_gzcv);
+      if (n == 0) {
+	break;
+      }
+      i = 1 - i;
+    }
+    pthread_mutex_unlock (&vr->_gzlock);
+    return NULL;
+  }
+
+  /*
+    Next inflated block: returns 1 with *n bytes at *buf, 0 at the end
+    of the file, or -1 if nothing is ready and wait is 0.
+  */
+  int _gzNext (char **buf, int *n, int wait) {
+    int r;
+
+    pthread_mutex_lock (&_gzlock);
+    while (!_gzfull[_gztake] && wait) {
+      pthread_cond_wait (&_gzcv, &_gzlock);
+    }
+    if (!_gzfull[_gztake]) {
+      r = -1;
+    }
+    else {
+      *buf = _gzbuf[_gztake];
+      *n = _gzlen[_gztake];
+      r = (*n > 0);
+    }
+    pthread_mutex_unlock (&_gzlock);
+    return r;
+  }
+
+  /* restart the inflater at _voff into the value changes */
+  void _gzRewind () {
+    long at;
+
+    pthread_mutex_lock (&_gzlock);
+    _gzstop = 1;
+    pthread_cond_broadcast (&_gzcv);
+    pthread_mutex_unlock (&_gzlock);
+    pthread_join (_inflater, NULL);
+
+    /* moving forward only inflates the text in between */
+    at = _gzdata + _voff;
+    if ((gztell (_gz) > at && gzrewind (_gz) != 0) ||
+	gzseek (_gz, at, SEEK_SET) != at) {
+      fprintf (stderr, "WARNING: vcd: could not rewind the compressed file\n");
+    }
+    _gzfull[0] = 0;
+    _gzfull[1] = 0;
+    _gztake = 0;
+    _gzstop = 0;
+    _gzdone = 0;
+    _ncarry = 0;
+    pthread_create (&_inflater, NULL, _inflate, this);
+  }
+
+  void _gzRelease () {
+    pthread_mutex_lock (&_gzlock);
+    _gzfull[_gztake] = 0;
+    _gztake = 1 - _gztake;
+    pthread_cond_broadcast (&_gzcv);
+    pthread_mutex_unlock (&_gzlock);
+  }
+
+  void _append (const char *s, unsigned long n) {
+    if (_ncarry + n > _maxcarry) {
+      _maxcarry = 2*(_ncarry + n);
+      _carry = (char *) _vcd_realloc (_carry, _maxcarry);
+    }
+    memcpy (_carry + _ncarry, s, n);
+    _ncarry += n;
+  }
+
+  const char *_token (int *len) {
+    return _vcd_token (&_pos, _end, len);
+  }
+
+  static int _is (const char *s, int len, const char *kw) {
+    return ((int)strlen (kw) == len) && (memcmp (s, kw, len) == 0);
+  }
+
+  void _skipToEnd () {
+    _vcd_skip_to_end (&_pos, _end);
+  }
+
+  int _parseHeader () {
+    const char *tok;
+    int len;
+    char *scope = NULL;
+    int scope_len = 0, scope_max = 0;
+    int *scope_stack = NULL;
+    int depth = 0, depth_max = 0;
+
+    while ((tok = _token (&len))) {
+      if (_is (tok, len, "$enddefinitions")) {
+	_skipToEnd ();
+	_data = _pos;
+	if (scope) {
+	  free (scope);
+	  free (scope_stack);
+	}
+	_finishHeader ();
+	return 1;
+      }
+      else if (_is (tok, len, "$timescale")) {
+	_parseTimescale ();
+      }
+      else if (_is (tok, len, "$scope")) {
+	const char *nm;
+	int nlen;
+	if (!_token (&nlen) || !(nm = _token (&nlen))) {
+	  break;
+	}
+	if (depth == depth_max) {
+	  depth_max = depth_max ? 2*depth_max : 8;
+	  scope_stack = (int *) _vcd_realloc (scope_stack,
+					      sizeof (int) * depth_max);
+	}
+	scope_stack[depth++] = scope_len;
+	if (scope_len + nlen + 2 > scope_max) {
+	  scope_max = 2*(scope_len + nlen + 2);
+	  scope = (char *) _vcd_realloc (scope, scope_max);
+	}
+	if (scope_len > 0) {
+	  scope[scope_len++] = '.';
+	}
+	else {
+	  _addRoot (nm, nlen);
+	}
+	memcpy (scope + scope_len, nm, nlen);
+	scope_len += nlen;
+	scope[scope_len] = '\0';
+	_skipToEnd ();
+      }
+      else if (_is (tok, len, "$upscope")) {
+	if (depth > 0) {
+	  scope_len = scope_stack[--depth];
+	  scope[scope_len] = '\0';
+	}
+	_skipToEnd ();
+      }
+      else if (_is (tok, len, "$var")) {
+	_parseVar (scope, scope_len);
+      }
+      else if (tok[0] == '$') {
+	/* $date, $version, $comment, ... */
+	_skipToEnd ();
+      }
+    }
+    if (scope) {
+      free (scope);
+      free (scope_stack);
+    }
+    return 0;
+  }
+
+  void _parseTimescale () {
+    char buf[32];
+    int pos = 0;
+    const char *tok;
+    int len;
+    char *unit;
+    double mult;
+
+    /* "1 ps", "1ps", "100 ns" */
+    while ((tok = _token (&len)) && !_is (tok, len, "$end")) {
+      if (pos + len < (int)sizeof (buf)) {
+	memcpy (buf + pos, tok, len);
+	pos += len;
+      }
+    }
+    buf[pos] = '\0';
+    mult = strtod (buf, &unit);
+    if (unit == buf) {
+      mult = 1;
+    }
+    if (strcmp (unit, "s") == 0) {
+      _ts = mult;
+    }
+    else if (strcmp (unit, "ms") == 0) {
+      _ts = mult*1e-3;
+    }
+    else if (strcmp (unit, "us") == 0) {
+      _ts = mult*1e-6;
+    }
+    else if (strcmp (unit, "ns") == 0) {
+      _ts = mult*1e-9;
+    }
+    else if (strcmp (unit, "ps") == 0) {
+      _ts = mult*1e-12;
+    }
+    else if (strcmp (unit, "fs") == 0) {
+      _ts = mult*1e-15;
+    }
+  }
+
+  void _addRoot (const char *nm, int len) {
+    for (int i=0; i < _nroots; i++) {
+      if (_is (nm, len, _roots[i])) {
+	return;
+      }
+    }
+    _roots = (char **) _vcd_realloc (_roots, sizeof (char *)*(_nroots+1));
+    _roots[_nroots] = (char *) _vcd_malloc (len + 1);
+    memcpy (_roots[_nroots], nm, len);
+    _roots[_nroots][len] = '\0';
+    _nroots++;
+  }
+
+  void _parseVar (const char *scope, int scope_len) {
+    const char *type, *sz, *id, *ref;
+    int tlen, szlen, idlen, rlen;
+    int width, slot;
+
+    if (!(type = _token (&tlen)) || !(sz = _token (&szlen)) ||
+	!(id = _token (&idlen)) || !(ref = _token (&rlen))) {
+      return;
+    }
+    /* any bit range after the reference is not part of the name */
+    _skipToEnd ();
+
+    if (_is (type, tlen, "real") || _is (type, tlen, "realtime") ||
+	_is (type, tlen, "shortreal")) {
+      width = -1;
+    }
+    else {
+      width = _vcd_num (sz, szlen);
+      if (width < 1) {
+	width = 1;
+      }
+    }
+
+    slot = _ids.find (id, idlen);
+    if (slot < 0) {
+      if (_nslots == _maxslots) {
+	_maxslots = _maxslots ? 2*_maxslots : 64;
+	_sid = (char **) _vcd_realloc (_sid, sizeof (char *)*_maxslots);
+	_swidth = (int *) _vcd_realloc (_swidth, sizeof (int)*_maxslots);
+      }
+      slot = _nslots++;
+      _sid[slot] = (char *) _vcd_malloc (idlen + 1);
+      memcpy (_sid[slot], id, idlen);
+      _sid[slot][idlen] = '\0';
+      _swidth[slot] = width;
+      _ids.add (_sid[slot], idlen, slot);
+    }
+
+    if (_nvars == _maxvars) {
+      _maxvars = _maxvars ? 2*_maxvars : 64;
+      _vname = (char **) _vcd_realloc (_vname, sizeof (char *)*_maxvars);
+      _vslot = (int *) _vcd_realloc (_vslot, sizeof (int)*_maxvars);
+    }
+    _vname[_nvars] = (char *) _vcd_malloc (scope_len + rlen + 2);
+    if (scope_len > 0) {
+      memcpy (_vname[_nvars], scope, scope_len);
+      _vname[_nvars][scope_len] = '.';
+      memcpy (_vname[_nvars] + scope_len + 1, ref, rlen);
+      _vname[_nvars][scope_len + rlen + 1] = '\0';
+    }
+    else {
+      memcpy (_vname[_nvars], ref, rlen);
+      _vname[_nvars][rlen] = '\0';
+    }
+    _vslot[_nvars] = slot;
+    _nvars++;
+  }
+
+  /*
+    Identifier codes read as bijective base-94 numbers (first
+    character least significant), so distinct codes get distinct
+    numbers.
+  */
+  static long _code (const char *s, int len) {
+    long c = 0;
+    if (len > 4) {
+      return -1;
+    }
+    for (int i=len-1; i >= 0; i--) {
+      if ((unsigned char)s[i] > 126) {
+	return -1;
+      }
+      c = c*94 + (s[i] - 32);
+    }
+    return c;
+  }
+
+  /* the values before the first change */
+  void _resetValues () {
+    unsigned long nwide = 0;
+
+    if (_nwide > 0) {
+      memset (_wide, 0, sizeof (unsigned long)*_nwide);
+    }
+    for (int i=0; i < _nslots; i++) {
+      if (_swidth[i] < 0) {
+	_sval[i].v = 0;
+      }
+      else if (_swidth[i] == 1) {
+	_sval[i].val = ACT_SIG_BOOL_X;
+      }
+      else if (_swidth[i] <= 64) {
+	_sval[i].val = 0;
+      }
+      else {
+	_sval[i].valp = _wide + nwide;
+	nwide += ACT_TRACE_WIDE_NUM (_swidth[i]);
+      }
+    }
+  }
+
+  void _finishHeader () {
+    long maxcode = 0;
+    unsigned long nwide = 0;
+
+    for (int i=0; i < _nvars; i++) {
+      _names.add (_vname[i], strlen (_vname[i]), i);
+    }
+
+    /* flat value array, with wide values carved out of one block */
+    _sval = (act_signal_val_t *)
+      _vcd_malloc (sizeof (act_signal_val_t) * (_nslots > 0 ? _nslots : 1));
+    for (int i=0; i < _nslots; i++) {
+      if (_swidth[i] > 64) {
+	nwide += ACT_TRACE_WIDE_NUM (_swidth[i]);
+      }
+    }
+    if (nwide > 0) {
+      _wide = (unsigned long *) _vcd_malloc (sizeof (unsigned long)*nwide);
+    }
+    _nwide = nwide;
+    _resetValues ();
+
+    _want = (char *) _vcd_malloc (_nslots > 0 ? _nslots : 1);
+    memset (_want, 0, _nslots > 0 ? _nslots : 1);
+
+    /* use a direct map from identifier codes to slots when the codes
+       are dense, which is the common case */
+    for (int i=0; i < _nslots; i++) {
+      long c = _code (_sid[i], strlen (_sid[i]));
+      if (c < 0) {
+	return;
+      }
+      if (c > maxcode) {
+	maxcode = c;
+      }
+    }
+    if (maxcode >= 8L*_nslots + 4096) {
+      return;
+    }
+    _ncodes = maxcode + 1;
+    _code2slot = (int *) _vcd_malloc (sizeof (int)*_ncodes);
+    for (unsigned long i=0; i < _ncodes; i++) {
+      _code2slot[i] = -1;
+    }
+    for (int i=0; i < _nslots; i++) {
+      _code2slot[_code (_sid[i], strlen (_sid[i]))] = i;
+    }
+  }
+
+  int _keep (VCDChunk *c, int slot) {
+    return c->all || !_selected || _want[slot];
+  }
+
+  int _slot (const char *s, int len) {
+    if (_code2slot) {
+      long c = _code (s, len);
+      if (c < 0 || (unsigned long)c >= _ncodes) {
+	return -1;
+      }
+      return _code2slot[c];
+    }
+    return _ids.find (s, len);
+  }
+
+  /*
+    The last timestamp: a line that is '#' and digits only, since
+    identifier codes can also start with '#'.
+  */
+  unsigned long _lastTime () {
+    const char *p = _end;
+    const char *q;
+
+    while (p > _data) {
+      p--;
+      if (*p != '#' || (p != _data && p[-1] != '\n')) {
+	continue;
+      }
+      q = p + 1;
+      while (q < _end && isdigit (*q)) {
+	q++;
+      }
+      if (q == p + 1) {
+	continue;
+      }
+      while (q < _end && *q != '\n' && isspace (*q)) {
+	q++;
+      }
+      if (q == _end || *q == '\n') {
+	return _vcd_num (p + 1, q - p - 1);
+      }
+    }
+    return 0;
+  }
+
+  /*
+    Sidecar index. When a large file without one is read, a separate
+    pass over the whole file saves the value of every slot at chunk
+    starts, at most one checkpoint per VCD_CHUNK_SIZE bytes of text (or
+    four times the size of the state, for wide designs). Later readers
+    of the same file restore the last checkpoint before a time instead
+    of parsing everything up to it.
+  */
+  void _idxIdentify (const char *nm, struct stat *sb) {
+    unsigned long h = 14695981039346656037UL;
+    char *buf;
+    ssize_t n;
+
+    memset (&_ihdr, 0, sizeof (_ihdr));
+    memcpy (_ihdr.magic, VCD_INDEX_MAGIC, 8);
+    _ihdr.size = sb->st_size;
+    _ihdr.mtime = sb->st_mtime;
+
+    buf = (char *) _vcd_malloc (VCD_INDEX_HASH);
+    for (int i=0; i < 2; i++) {
+      off_t at = (i == 0) ? 0 : sb->st_size - VCD_INDEX_HASH;
+      if (i == 1 && at <= 0) {
+	break;
+      }
+      n = pread (_fd, buf, VCD_INDEX_HASH, at);
+      for (ssize_t j=0; j < n; j++) {
+	h = (h ^ (unsigned char)buf[j]) * 1099511628211UL;
+      }
+    }
+    free (buf);
+    _ihdr.hash = h;
+
+    _idxname = (char *) _vcd_malloc (strlen (nm) + 6);
+    sprintf (_idxname, "%s.tidx", nm);
+  }
+
+  unsigned long _idxStateSize () {
+    return sizeof (act_signal_val_t)*_nslots + sizeof (unsigned long)*_nwide;
+  }
+
+  /* use the index if it matches the file */
+  void _idxOpen () {
+    VCDIndexHdr h;
+    struct stat sb;
+    unsigned long sz;
+    int fd;
+
+    if (!_idxon || _ifd >= 0 || !_idxname) {
+      return;
+    }
+    fd = open (_idxname, O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    sz = _idxStateSize ();
+    if (pread (fd, &h, sizeof (h), 0) != sizeof (h) ||
+	memcmp (h.magic, _ihdr.magic, 8) != 0 ||
+	h.size != _ihdr.size || h.mtime != _ihdr.mtime ||
+	h.hash != _ihdr.hash ||
+	h.nslots != (unsigned long)_nslots || h.nwide != _nwide ||
+	h.ncheck == 0 || fstat (fd, &sb) != 0 ||
+	(unsigned long)sb.st_size !=
+	sizeof (h) + h.ncheck*(sz + sizeof (VCDCheck))) {
+      close (fd);
+      return;
+    }
+    _check = (VCDCheck *) _vcd_malloc (sizeof (VCDCheck)*h.ncheck);
+    if (pread (fd, _check, sizeof (VCDCheck)*h.ncheck,
+	       sizeof (h) + h.ncheck*sz) !=
+	(ssize_t)(sizeof (VCDCheck)*h.ncheck)) {
+      free (_check);
+      _check = NULL;
+      close (fd);
+      return;
+    }
+    _ifd = fd;
+    _ncheck = h.ncheck;
+    _ilast = h.last;
+  }
+
+  void _idxClose () {
+    if (_ifd < 0) {
+      return;
+    }
+    close (_ifd);
+    _ifd = -1;
+    free (_check);
+    _check = NULL;
+    _ncheck = 0;
+  }
+
+  /* last checkpoint at or before time t, or -1 */
+  long _idxFind (unsigned long t) {
+    long lo, hi;
+
+    if (_ifd < 0 || _check[0].t > t) {
+      return -1;
+    }
+    lo = 0;
+    hi = _ncheck;
+    while (hi - lo > 1) {
+      long mid = (lo + hi)/2;
+      if (_check[mid].t <= t) {
+	lo = mid;
+      }
+      else {
+	hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  /* restore the values at checkpoint k */
+  int _idxLoad (long k) {
+    unsigned long sz = _idxStateSize ();
+    char *p;
+
+    if (!_istate) {
+      _istate = (char *) _vcd_malloc (sz > 0 ? sz : 1);
+    }
+    if (pread (_ifd, _istate, sz, sizeof (VCDIndexHdr) + k*sz) !=
+	(ssize_t)sz) {
+      fprintf (stderr, "WARNING: vcd: could not read `%s'\n", _idxname);
+      return 0;
+    }
+    p = _istate;
+    for (int i=0; i < _nslots; i++) {
+      if (_swidth[i] <= 64) {
+	memcpy (&_sval[i], p, sizeof (act_signal_val_t));
+      }
+      p += sizeof (act_signal_val_t);
+    }
+    if (_nwide > 0) {
+      memcpy (_wide, p, sizeof (unsigned long)*_nwide);
+    }
+    return 1;
+  }
+
+  static int _idxWrite (int fd, const void *buf, unsigned long n) {
+    const char *p = (const char *)buf;
+    ssize_t w;
+
+    while (n > 0) {
+      w = write (fd, p, n);
+      if (w <= 0) {
+	return 0;
+      }
+      p += w;
+      n -= w;
+    }
+    return 1;
+  }
+
+  enum build_state { BUILD_NONE, BUILD_RUNNING, BUILD_EXITED, BUILD_JOINED };
+
+  /*
+    Start the index pass when reading starts. It parses every signal of
+    the whole file on its own thread, so the reader itself still parses
+    only the signals looked up.
+  */
+  void _idxBegin () {
+    if (_brun != BUILD_NONE || !_idxon || _ifd >= 0 || !_idxname ||
+	_ihdr.size < VCD_INDEX_MIN) {
+      return;
+    }
+    _btmp = (char *) _vcd_malloc (strlen (_idxname) + 24);
+    sprintf (_btmp, "%s.%ld", _idxname, (long) getpid ());
+    _bfd = open (_btmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (_bfd < 0) {
+      /* no index if the directory is not writable */
+      free (_btmp);
+      _btmp = NULL;
+      return;
+    }
+    _bstop = 0;
+    _brun = BUILD_RUNNING;
+    pthread_create (&_builder, NULL, _idxPass, this);
+  }
+
+  /* pick up an index that the pass has finished */
+  void _idxPoll () {
+    int done;
+
+    pthread_mutex_lock (&_blk);
+    done = (_brun == BUILD_EXITED);
+    pthread_mutex_unlock (&_blk);
+    if (done) {
+      pthread_join (_builder, NULL);
+      _brun = BUILD_JOINED;
+      _idxOpen ();
+    }
+  }
+
+  /* wait for the index pass, or make it give up */
+  void _idxEnd (int wait) {
+    int run;
+
+    pthread_mutex_lock (&_blk);
+    run = (_brun == BUILD_RUNNING || _brun == BUILD_EXITED);
+    if (!wait) {
+      _bstop = 1;
+    }
+    pthread_mutex_unlock (&_blk);
+    if (run) {
+      pthread_join (_builder, NULL);
+      _brun = BUILD_JOINED;
+    }
+  }
+
+  static void *_idxPass (void *arg) {
+    VCDReader *vr = (VCDReader *)arg;
+
+    if (!vr->_idxBuild ()) {
+      vr->_idxAbandon ();
+    }
+    pthread_mutex_lock (&vr->_blk);
+    vr->_brun = BUILD_EXITED;
+    pthread_mutex_unlock (&vr->_blk);
+    return NULL;
+  }
+
+  int _idxStopped () {
+    int r;
+
+    pthread_mutex_lock (&_blk);
+    r = _bstop;
+    pthread_mutex_unlock (&_blk);
+    return r;
+  }
+
+  /* the whole index: returns 1 once it is in place */
+  int _idxBuild () {
+    VCDIndexHdr h;
+    VCDChunk c;
+    gzFile gz = NULL;
+    const char *split = _data;
+    unsigned long off = 0, last = 0, left = 0, nwide = 0;
+    int in_comment = 0;
+    int ok = 0;
+    int r;
+
+    memset (&h, 0, sizeof (h));
+    if (!_idxWrite (_bfd, &h, sizeof (h))) {
+      return 0;
+    }
+    if (_gz) {
+      /* a stream of its own, so the reader's is left alone */
+      gz = gzopen (_name, "rb");
+      if (!gz) {
+	return 0;
+      }
+      gzbuffer (gz, 1 << 17);
+      if (gzseek (gz, _gzdata, SEEK_SET) != _gzdata) {
+	gzclose (gz);
+	return 0;
+      }
+    }
+
+    /* the values before the first change, as in _resetValues() */
+    _bval = (act_signal_val_t *)
+      _vcd_malloc (sizeof (act_signal_val_t) * (_nslots > 0 ? _nslots : 1));
+    _bwide = (unsigned long *)
+      _vcd_malloc (sizeof (unsigned long) * (_nwide > 0 ? _nwide : 1));
+    memset (_bwide, 0, sizeof (unsigned long) * (_nwide > 0 ? _nwide : 1));
+    for (int i=0; i < _nslots; i++) {
+      if (_swidth[i] < 0) {
+	_bval[i].v = 0;
+      }
+      else if (_swidth[i] == 1) {
+	_bval[i].val = ACT_SIG_BOOL_X;
+      }
+      else if (_swidth[i] <= 64) {
+	_bval[i].val = 0;
+      }
+      else {
+	_bval[i].val = nwide;
+	nwide += ACT_TRACE_WIDE_NUM (_swidth[i]);
+      }
+    }
+    _nbcheck = 0;
+    _bnext = 4*_idxStateSize ();
+    if (_bnext < VCD_CHUNK_SIZE) {
+      _bnext = VCD_CHUNK_SIZE;
+    }
+
+    memset (&c, 0, sizeof (c));
+    c.all = 1;
+    while (1) {
+      if (_idxStopped ()) {
+	break;
+      }
+      r = gz ? _idxCutInflated (&c, gz, &left) : _cutMapped (&c, &split);
+      if (r < 0) {
+	break;
+      }
+      if (r == 0) {
+	ok = 1;
+	break;
+      }
+      in_comment = _parseChunk (&c, in_comment);
+      if (c.nchg > 0 && c.chg[0].slot < 0 && !c.from_comment &&
+	  !_idxAdd (c.chg[0].v.val, off)) {
+	break;
+      }
+      for (unsigned long i=0; i < c.nchg; i++) {
+	VCDChange *x = &c.chg[i];
+	int w;
+	if (x->slot < 0) {
+	  last = x->v.val;
+	  continue;
+	}
+	w = _swidth[x->slot];
+	if (w > 64) {
+	  memcpy (_bwide + _bval[x->slot].val, c.words + x->v.val,
+		  sizeof (unsigned long) * ACT_TRACE_WIDE_NUM (w));
+	}
+	else {
+	  _bval[x->slot] = x->v;
+	}
+      }
+      off += c.end - c.start;
+    }
+
+    if (gz) {
+      gzclose (gz);
+    }
+    if (c.chg) {
+      free (c.chg);
+    }
+    if (c.words) {
+      free (c.words);
+    }
+    if (c.buf) {
+      free (c.buf);
+    }
+    free (_bval);
+    _bval = NULL;
+    free (_bwide);
+    _bwide = NULL;
+    if (_bbuf) {
+      free (_bbuf);
+      _bbuf = NULL;
+    }
+    return ok && _idxFinish (last);
+  }
+
+  /*
+    The next chunk of compressed text for the index pass, in c->buf:
+    what is left from the last one (*left bytes after c->end) plus
+    inflated text up to its last timestamp. Returns 0 at the end of
+    the file, -1 on an error.
+  */
+  int _idxCutInflated (VCDChunk *c, gzFile gz, unsigned long *left) {
+    unsigned long n = *left;
+    unsigned long i, lo;
+    int r;
+
+    if (n > 0) {
+      memmove (c->buf, c->end, n);
+    }
+    while (1) {
+      if (n + VCD_CHUNK_SIZE > c->maxbuf) {
+	c->maxbuf = 2*(n + VCD_CHUNK_SIZE);
+	c->buf = (char *) _vcd_realloc (c->buf, c->maxbuf);
+      }
+      r = gzread (gz, c->buf + n, VCD_CHUNK_SIZE);
+      if (r < 0) {
+	return -1;
+      }
+      if (r == 0) {
+	if (n == 0) {
+	  return 0;
+	}
+	i = n;
+	break;
+      }
+      lo = (n > 0) ? n : 1;
+      n += r;
+      for (i=n-1; i >= lo; i--) {
+	if (c->buf[i] == '#' && c->buf[i-1] == '\n') {
+	  break;
+	}
+      }
+      if (i >= lo) {
+	break;
+      }
+    }
+    c->start = c->buf;
+    c->end = c->buf + i;
+    *left = n - i;
+    return 1;
+  }
+
+  /* a checkpoint at text offset off, before time t, if it is due */
+  int _idxAdd (unsigned long t, unsigned long off) {
+    unsigned long sz = _idxStateSize ();
+    unsigned long gap;
+    char *p;
+
+    if (off < _bnext) {
+      return 1;
+    }
+    if (!_bbuf) {
+      _bbuf = (char *) _vcd_malloc (sz > 0 ? sz : 1);
+    }
+    p = _bbuf;
+    for (int i=0; i < _nslots; i++) {
+      if (_swidth[i] <= 64) {
+	memcpy (p, &_bval[i], sizeof (act_signal_val_t));
+      }
+      else {
+	memset (p, 0, sizeof (act_signal_val_t));
+      }
+      p += sizeof (act_signal_val_t);
+    }
+    if (_nwide > 0) {
+      memcpy (p, _bwide, sizeof (unsigned long)*_nwide);
+    }
+    if (!_idxWrite (_bfd, _bbuf, sz)) {
+      return 0;
+    }
+    if (_nbcheck == _maxbcheck) {
+      _maxbcheck = _maxbcheck ? 2*_maxbcheck : 64;
+      _bcheck = (VCDCheck *)
+	_vcd_realloc (_bcheck, sizeof (VCDCheck)*_maxbcheck);
+    }
+    _bcheck[_nbcheck].t = t;
+    _bcheck[_nbcheck].off = off;
+    _nbcheck++;
+    gap = 4*sz;
+    _bnext = off + (gap > VCD_CHUNK_SIZE ? gap : VCD_CHUNK_SIZE);
+    return 1;
+  }
+
+  /* the whole file has been parsed: put the index in place */
+  int _idxFinish (unsigned long last) {
+    VCDIndexHdr h;
+
+    if (_nbcheck == 0) {
+      return 0;
+    }
+    h = _ihdr;
+    h.nslots = _nslots;
+    h.nwide = _nwide;
+    h.last = last;
+    h.ncheck = _nbcheck;
+    if (!_idxWrite (_bfd, _bcheck, sizeof (VCDCheck)*_nbcheck) ||
+	pwrite (_bfd, &h, sizeof (h), 0) != sizeof (h) ||
+	close (_bfd) != 0) {
+      _bfd = -1;
+      return 0;
+    }
+    _bfd = -1;
+    if (rename (_btmp, _idxname) != 0) {
+      return 0;
+    }
+    free (_btmp);
+    _btmp = NULL;
+    free (_bcheck);
+    _bcheck = NULL;
+    _nbcheck = 0;
+    _maxbcheck = 0;
+    return 1;
+  }
+
+  void _idxAbandon () {
+    if (_bfd >= 0) {
+      close (_bfd);
+      _bfd = -1;
+    }
+    if (_btmp) {
+      unlink (_btmp);
+      free (_btmp);
+      _btmp = NULL;
+    }
+    if (_bcheck) {
+      free (_bcheck);
+      _bcheck = NULL;
+    }
+    _nbcheck = 0;
+    _maxbcheck = 0;
+  }
+
+  /*
+    The value change section is cut into chunks that start at a
+    timestamp. Chunks are parsed into change lists, by worker threads
+    when the file is large, and consumed in file order.
+  */
+  enum chunk_state { CHUNK_FREE, CHUNK_QUEUED, CHUNK_PARSING, CHUNK_READY };
+
+  /*
+    Signals looked up before reading starts are the only ones parsed
+    (if there are none, all are). A later lookup of another signal
+    parses the file again from the start, or from the last checkpoint
+    of the index, up to the current time.
+  */
+  void _select (int slot) {
+    int again;
+
+    if (_want[slot]) {
+      return;
+    }
+    /* the workers read _want */
+    again = (_started && _selected);
+    if (again) {
+      _stop ();
+    }
+    _want[slot] = 1;
+    _nwant++;
+    if (again) {
+      _idxPoll ();
+      _reposition (_idxFind (_cur), _cur);
+    }
+  }
+
+  /* restart parsing at checkpoint k (-1 = the start), and run to target */
+  void _reposition (long k, unsigned long target) {
+    _stop ();
+    if (k >= 0 && !_idxLoad (k)) {
+      k = -1;
+    }
+    if (k < 0) {
+      _resetValues ();
+    }
+    _voff = (k >= 0) ? _check[k].off : 0;
+    _foff = _voff;
+    if (_gz) {
+      _gzRewind ();
+    }
+    _seq_fill = 0;
+    _seq_parse = 0;
+    _seq_use = 0;
+    _crec = 0;
+    _carry_comment = 0;
+    _have_next = 0;
+    _shutdown = 0;
+    _cur = target;
+    _start ();
+  }
+
+  void _start () {
+    if (_started) {
+      return;
+    }
+    _started = 1;
+    _split = _data + _voff;
+    _selected = (_nwant > 0);
+    _idxBegin ();
+
+    if (_nthreads > 1 &&
+	(_gz || (unsigned long)(_end - _data) > 2*VCD_CHUNK_SIZE)) {
+      _nring = _nthreads + 2;
+    }
+    else {
+      _nthreads = 0;
+      _nring = 1;
+    }
+    _ring = (VCDChunk *) _vcd_malloc (sizeof (VCDChunk) * _nring);
+    for (int i=0; i < _nring; i++) {
+      _ring[i].chg = NULL;
+      _ring[i].nchg = 0;
+      _ring[i].maxchg = 0;
+      _ring[i].words = NULL;
+      _ring[i].nwords = 0;
+      _ring[i].maxwords = 0;
+      _ring[i].state = CHUNK_FREE;
+      _ring[i].from_comment = 0;
+      _ring[i].all = 0;
+      _ring[i].buf = NULL;
+      _ring[i].maxbuf = 0;
+    }
+    pthread_mutex_init (&_lock, NULL);
+    pthread_cond_init (&_cv_work, NULL);
+    pthread_cond_init (&_cv_done, NULL);
+    _fill ();
+    if (_nthreads > 0) {
+      _threads = (pthread_t *) _vcd_malloc (sizeof (pthread_t) * _nthreads);
+      for (int i=0; i < _nthreads; i++) {
+	pthread_create (&_threads[i], NULL, _worker, this);
+      }
+    }
+    _run (_cur);
+  }
+
+  void _stop () {
+    if (!_started) {
+      return;
+    }
+    if (_threads) {
+      pthread_mutex_lock (&_lock);
+      _shutdown = 1;
+      pthread_cond_broadcast (&_cv_work);
+      pthread_mutex_unlock (&_lock);
+      for (int i=0; i < _nthreads; i++) {
+	pthread_join (_threads[i], NULL);
+      }
+      free (_threads);
+      _threads = NULL;
+    }
+    for (int i=0; i < _nring; i++) {
+      if (_ring[i].chg) {
+	free (_ring[i].chg);
+      }
+      if (_ring[i].words) {
+	free (_ring[i].words);
+      }
+      if (_ring[i].buf) {
+	free (_ring[i].buf);
+      }
+    }
+    free (_ring);
+    _ring = NULL;
+    pthread_mutex_destroy (&_lock);
+    pthread_cond_destroy (&_cv_work);
+    pthread_cond_destroy (&_cv_done);
+    _started = 0;
+  }
+
+  /* hand out text to free ring slots; called with _lock held */
+  void _fill () {
+    while (_seq_fill < _seq_use + _nring) {
+      VCDChunk *c = &_ring[_seq_fill % _nring];
+
+      if (_gz) {
+	/* only block for text when the consumer has nothing queued */
+	if (!_cutInflated (c, _seq_fill == _seq_use)) {
+	  break;
+	}
+      }
+      else if (!_cutMapped (c, &_split)) {
+	break;
+      }
+      c->state = CHUNK_QUEUED;
+      _foff += c->end - c->start;
+      _seq_fill++;
+    }
+    if (_threads) {
+      pthread_cond_broadcast (&_cv_work);
+    }
+  }
+
+  int _cutMapped (VCDChunk *c, const char **split) {
+    const char *p;
+
+    if (*split >= _end) {
+      return 0;
+    }
+    c->start = *split;
+    p = *split + VCD_CHUNK_SIZE;
+    c->end = _end;
+    while (p < _end) {
+      p = (const char *) memchr (p, '\n', _end - p);
+      if (!p) {
+	break;
+      }
+      p++;
+      if (p < _end && *p == '#') {
+	c->end = p;
+	break;
+      }
+    }
+    *split = c->end;
+    return 1;
+  }
+
+  /*
+    A chunk of compressed input is the carried-over text plus the next
+    inflated block up to its last timestamp.
+  */
+  int _cutInflated (VCDChunk *c, int wait) {
+    char *b, *tmp;
+    unsigned long tmpsz;
+    int n, r, i;
+
+    while (!_gzdone) {
+      r = _gzNext (&b, &n, wait);
+      if (r < 0) {
+	return 0;
+      }
+      if (r == 0) {
+	_gzdone = 1;
+	if (_ncarry == 0) {
+	  return 0;
+	}
+	i = 0;
+      }
+      else {
+	for (i=n-1; i >= 0; i--) {
+	  if (b[i] == '#' &&
+	      (i > 0 ? b[i-1] == '\n' : (_ncarry > 0 && _carry[_ncarry-1] == '\n'))) {
+	    break;
+	  }
+	}
+	if (i < 0) {
+	  /* no timestamp in this block */
+	  _append (b, n);
+	  _gzRelease ();
+	  continue;
+	}
+      }
+      /* the carry becomes the chunk text, and the chunk's old buffer
+	 holds the new carry */
+      _append (b, i);
+      tmp = c->buf;
+      tmpsz = c->maxbuf;
+      c->buf = _carry;
+      c->maxbuf = _maxcarry;
+      c->start = c->buf;
+      c->end = c->buf + _ncarry;
+      _carry = tmp;
+      _maxcarry = tmpsz;
+      _ncarry = 0;
+      if (r == 1) {
+	_append (b + i, n - i);
+	_gzRelease ();
+      }
+      return 1;
+    }
+    return 0;
+  }
+
+  static void *_worker (void *arg) {
+    VCDReader *vr = (VCDReader *)arg;
+
+    pthread_mutex_lock (&vr->_lock);
+    while (!vr->_shutdown) {
+      if (vr->_seq_parse < vr->_seq_fill) {
+	VCDChunk *c = &vr->_ring[vr->_seq_parse % vr->_nring];
+	vr->_seq_parse++;
+	c->state = CHUNK_PARSING;
+	pthread_mutex_unlock (&vr->_lock);
+	c->in_comment = vr->_parseChunk (c, 0);
+	pthread_mutex_lock (&vr->_lock);
+	c->state = CHUNK_READY;
+	pthread_cond_broadcast (&vr->_cv_done);
+      }
+      else {
+	pthread_cond_wait (&vr->_cv_work, &vr->_lock);
+      }
+    }
+    pthread_mutex_unlock (&vr->_lock);
+    return NULL;
+  }
+
+  /* the chunk being consumed, or NULL at the end of the file */
+  VCDChunk *_current () {
+    VCDChunk *c;
+
+    pthread_mutex_lock (&_lock);
+    while (_seq_use < _seq_fill) {
+      c = &_ring[_seq_use % _nring];
+      if (c->state == CHUNK_QUEUED && _seq_parse == _seq_use) {
+	/* nobody has picked it up yet: parse it here */
+	_seq_parse++;
+	c->state = CHUNK_PARSING;
+	pthread_mutex_unlock (&_lock);
+	c->in_comment = _parseChunk (c, _carry_comment);
+	_carry_comment = 0;
+	pthread_mutex_lock (&_lock);
+	c->state = CHUNK_READY;
+      }
+      else if (c->state != CHUNK_READY) {
+	pthread_cond_wait (&_cv_done, &_lock);
+	continue;
+      }
+      if (_carry_comment) {
+	/* fix-up: the previous chunk ended inside a $comment, so this
+	   one was parsed from the wrong starting state */
+	pthread_mutex_unlock (&_lock);
+	c->in_comment = _parseChunk (c, 1);
+	_carry_comment = 0;
+	pthread_mutex_lock (&_lock);
+      }
+      if (_crec < c->nchg) {
+	pthread_mutex_unlock (&_lock);
+	return c;
+      }
+      /* done with this one */
+      _carry_comment = c->in_comment;
+      c->state = CHUNK_FREE;
+      _voff += c->end - c->start;
+      _seq_use++;
+      _crec = 0;
+      _fill ();
+    }
+    pthread_mutex_unlock (&_lock);
+    return NULL;
+  }
+
+  /* apply all changes with time <= target */
+  void _run (unsigned long target) {
+    VCDChunk *c;
+
+    while (1) {
+      if (_have_next) {
+	if (_next > target) {
+	  return;
+	}
+	_have_next = 0;
+      }
+      if (!(c = _current ())) {
+	_at_end = 1;
+	return;
+      }
+      while (_crec < c->nchg) {
+	VCDChange *x = &c->chg[_crec++];
+	int w;
+	if (x->slot < 0) {
+	  _next = x->v.val;
+	  _have_next = 1;
+	  break;
+	}
+	w = _swidth[x->slot];
+	if (w > 64) {
+	  memcpy (_sval[x->slot].valp, c->words + x->v.val,
+		  sizeof (unsigned long) * ACT_TRACE_WIDE_NUM (w));
+	}
+	else {
+	  _sval[x->slot] = x->v;
+	}
+      }
+    }
+  }
+
+  VCDChange *_newChange (VCDChunk *c, int slot) {
+    if (c->nchg == c->maxchg) {
+      c->maxchg = c->maxchg ? 2*c->maxchg : 4096;
+      c->chg = (VCDChange *)
+	_vcd_realloc (c->chg, sizeof (VCDChange) * c->maxchg);
+    }
+    c->chg[c->nchg].slot = slot;
+    return &c->chg[c->nchg++];
+  }
+
+  /*
+    Parse one chunk into its change list. Only reads the identifier
+    tables, so it can run on any thread. Returns 1 if the chunk ends
+    inside a $comment.
+  */
+  int _parseChunk (VCDChunk *c, int in_comment) {
+    const char *p = c->start;
+    const char *tok, *id;
+    int len, idlen, slot;
+
+    c->nchg = 0;
+    c->nwords = 0;
+    c->from_comment = in_comment;
+    if (in_comment && !_vcd_skip_to_end (&p, c->end)) {
+      return 1;
+    }
+    while ((tok = _vcd_token (&p, c->end, &len))) {
+      switch (tok[0]) {
+      case '#':
+	_newChange (c, -1)->v.val = _vcd_num (tok + 1, len - 1);
+	break;
+
+      case '0':
+      case '1':
+      case 'x':
+      case 'X':
+      case 'z':
+      case 'Z':
+	if ((slot = _slot (tok + 1, len - 1)) >= 0 && _keep (c, slot)) {
+	  _setBits (c, slot, tok, 1);
+	}
+	break;
+
+      case 'b':
+      case 'B':
+	if ((id = _vcd_token (&p, c->end, &idlen)) &&
+	    (slot = _slot (id, idlen)) >= 0 && _keep (c, slot)) {
+	  _setBits (c, slot, tok + 1, len - 1);
+	}
+	break;
+
+      case 'r':
+      case 'R':
+	if ((id = _vcd_token (&p, c->end, &idlen)) &&
+	    (slot = _slot (id, idlen)) >= 0 && _swidth[slot] < 0 &&
+	    _keep (c, slot)) {
+	  _newChange (c, slot)->v.v = _vcd_real (tok + 1, len - 1);
+	}
+	break;
+
+      case 's':
+      case 'S':
+	_vcd_token (&p, c->end, &idlen);
+	break;
+
+      case '$':
+	/* $dumpvars, $dumpon, etc. are followed by ordinary changes */
+	if (_is (tok, len, "$comment") && !_vcd_skip_to_end (&p, c->end)) {
+	  return 1;
+	}
+	break;
+
+      default:
+	break;
+      }
+    }
+    return 0;
+  }
+
+  void _setBits (VCDChunk *c, int slot, const char *s, int n) {
+    int w = _swidth[slot];
+    VCDChange *x;
+
+    if (n <= 0 || w < 0) {
+      return;
+    }
+    x = _newChange (c, slot);
+    if (w == 1) {
+      switch (s[n-1]) {
+      case '0':
+	x->v.val = ACT_SIG_BOOL_FALSE;
+	break;
+      case '1':
+	x->v.val = ACT_SIG_BOOL_TRUE;
+	break;
+      case 'z':
+      case 'Z':
+	x->v.val = ACT_SIG_BOOL_Z;
+	break;
+      default:
+	x->v.val = ACT_SIG_BOOL_X;
+	break;
+      }
+    }
+    else if (w <= 64) {
+      unsigned long v;
+      _vcd_str_to_bits (s, n, &v, 1);
+      if (w < 64) {
+	v &= (1UL << w) - 1;
+      }
+      x->v.val = v;
+    }
+    else {
+      int nw = ACT_TRACE_WIDE_NUM (w);
+      if (c->nwords + nw > c->maxwords) {
+	c->maxwords = 2*(c->nwords + nw);
+	c->words = (unsigned long *)
+	  _vcd_realloc (c->words, sizeof (unsigned long) * c->maxwords);
+      }
+      _vcd_str_to_bits (s, n, c->words + c->nwords, nw);
+      x->v.val = c->nwords;
+      c->nwords += nw;
+    }
+  }
+};
+
+}
+
+extern "C" {
+
+void *vcd_create (const  char *nm, float stop_time, float ts)
+{
+  FILE *fp;
+  VCDInfo *vi;
+
+  fp = fopen (nm, "w");
+  if (!fp) {
+    fprintf (stderr, "ERROR: could not open file `%s' for writing\n", nm);
+    return NULL;
+  }
+  vi = new VCDInfo (fp, ts);
+  vi->emitHeader ();
+
+  return vi;
+}
+
+#ifdef ACT_MODE
+void *vcd_create_alt (const  char *nm, float stop_time, float ts)
+{
+  FILE *fp;
+  VCDInfo *vi;
+
+  fp = fopen (nm, "w");
+  if (!fp) {
+    fprintf (stderr, "ERROR: could not open file `%s' for writing\n", nm);
+    return NULL;
+  }
+  vi = new VCDInfo (fp, ts, 1);
+  vi->emitHeader ();
+
+  return vi;
+}
+#endif
+
+int vcd_signal_start (void *handle)
+{
+  // nothing to do
+  return 1;
+}
+
+void *vcd_add_analog_signal (void *handle, const char *s)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  int idx = vi->addAnalog (s);
+  return (void *)((long)idx+1);
+}
+
+void *vcd_add_digital_signal (void *handle, const char *s)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  int idx = vi->addDigital (s);
+  return (void *)((long)idx+1);
+}
+
+void *vcd_add_int_signal (void *handle, const char *s, int width)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  int idx = vi->addDigital (s, width);
+  return (void *)((long)idx+1);
+}
+
+void *vcd_add_chan_signal (void *handle, const char *s, int width)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  int idx = vi->addDigital (s, width);
+  return (void *)((long)idx+1);
+}
+
+int vcd_signal_end (void *handle)
+{
+  // nothing to do
+  return 1;
+}
+
+
+int vcd_init_start (void *handle)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  vi->dumpStart ();
+  return 1;
+}
+
+int vcd_init_end (void *handle)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  vi->dumpEnd ();
+  
+  return 1;
+}
+
+int vcd_change_digital (void *handle, void *node, float t, unsigned long v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    vi->emitTime (t);
+  }
+  vi->emitDigital (((unsigned long)node)-1, v);
+  
+  return 1;
+}
+
+int vcd_change_analog (void *handle, void *node, float t, float v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    vi->emitTime (t);
+  }
+  vi->emitAnalog (((unsigned long)node)-1, v);
+  
+  return 1;
+}
+
+int vcd_change_wide_digital (void *handle, void *node, float t,
+			     int len, unsigned long *v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    vi->emitTime (t);
+  }
+  vi->emitDigital (((unsigned long)node)-1, len, v);
+  
+  return 0;
+}
+
+
+int vcd_change_chan (void *handle, void *node, float t,
+		     act_chan_state_t s, unsigned long v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    vi->emitTime (t);
+  }
+  if (s != ACT_CHAN_VALUE) {
+    vi->emitChanState (((unsigned long)node)-1, s);
+  }
+  else {
+    vi->emitDigital (((unsigned long)node)-1, v);
+  }
+  return 1;
+}
+
+
+int vcd_change_wide_chan (void *handle, void *node, float t,
+			     act_chan_state_t s,
+			     int len, unsigned long *v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    vi->emitTime (t);
+  }
+  if (s != ACT_CHAN_VALUE) {
+    vi->emitChanState (((unsigned long)node)-1, s);
+  }
+  else {
+    vi->emitDigital (((unsigned long)node)-1, len, v);
+  }
+  return 0;
+}
+
+
+#ifdef ACT_MODE
+int vcd_change_digital_alt (void *handle, void *node, int len,
+			    unsigned long *tm, unsigned long v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+  if (!vi->isInDump()) {
+    BigInt tmp;
+    tmp.setWidth (len * 8 * sizeof (unsigned long));
+    for (int i=0; i < len; i++) {
+      tmp.setVal (i, tm[i]);
+    }
+    vi->emitTime (tmp);
+  }
+  vi->emitDigital (((unsigned long)node)-1, v);
+  
+  return 1;
+}
+
+int vcd_change_analog_alt (void *handle, void *node, int len,
+			   unsigned long *tm, float v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    BigInt tmp;
+    tmp.setWidth (len * 8 * sizeof (unsigned long));
+    for (int i=0; i < len; i++) {
+      tmp.setVal (i, tm[i]);
+    }
+    vi->emitTime (tmp);
+  }
+  vi->emitAnalog (((unsigned long)node)-1, v);
+  
+  return 1;
+}
+
+int vcd_change_wide_digital_alt (void *handle, void *node, int len,
+			     unsigned long *tm,
+			     int lenv, unsigned long *v)
+{
+  VCDInfo *vi = (VCDInfo *)handle;
+
+  if (!vi->isInDump()) {
+    BigInt tmp;
+    tmp.setWidth (len * 8 * sizeof (unsigned long));
+    for (int i=0; i < len; i++) {
+      tmp.setVal (i, tm[i]);
+    }
+    vi->emitTime (tmp);
+  }
+  vi->emitDigital (((unsigned long)node)-1, lenv, v);
+  
+  return 0;
+}
+
+
+int vcd_change_chan_alt (void *handle, void *node, int len,
+			 unsigned long *tm,
 			 act_chan_state_t s, unsigned long v)
 {
   VCDInfo *vi = (VCDInfo *)handle;
@@ -823,9 +2987,92 @@ int vcd_change_wide_chan_alt (void *handle, void *node, int len,
 
 int vcd_close (void *handle)
 {
-  VCDInfo *vi = (VCDInfo *)handle;
-  delete vi;
+  VCDFile *vf = (VCDFile *)handle;
+  delete vf;
   return 1;
 }
 
+
+void *vcd_open (const char *nm)
+{
+  VCDReader *vr = new VCDReader ();
+
+  if (!vr->openFile (nm)) {
+    delete vr;
+    return NULL;
+  }
+  return vr;
+}
+
+void *vcd_open_alt (const char *nm)
+{
+  return vcd_open (nm);
+}
+
+void vcd_header (void *handle, float *stop_time, float *dt)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  vr->getHeader (stop_time, dt);
+}
+
+void *vcd_signal_lookup (void *handle, const char *name)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  return vr->lookup (name);
+}
+
+act_signal_type_t vcd_signal_type (void *handle, void *sig)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  return vr->sigType (sig);
+}
+
+int vcd_signal_width (void *handle, void *sig)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  return vr->sigWidth (sig);
+}
+
+void vcd_advance_time (void *handle, int steps)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  if (steps > 0) {
+    vr->advance (steps);
+  }
+}
+
+void vcd_advance_time_by (void *handle, float dt)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  vr->advanceBy (dt);
+}
+
+act_signal_val_t vcd_get_signal (void *handle, void *sig)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  return vr->getSignal (sig);
+}
+
+int vcd_has_more_data (void *handle)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  return vr->hasMoreData ();
+}
+
+int vcd_seek (void *handle, unsigned long step)
+{
+  VCDReader *vr = (VCDReader *)handle;
+  return vr->seek (step);
+}
+
+int vcd_set_option (void *handle, const char *key, const char *value)
+{
+  VCDReader *vr = dynamic_cast<VCDReader *> ((VCDFile *)handle);
+
+  if (!vr || !key || !value) {
+    return 0;
+  }
+  return vr->setOption (key, value);
+}
+
 }  